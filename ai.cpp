@@ -8,6 +8,9 @@
 #include "embark.h"
 #include "trade.h"
 
+#include <mutex>
+#include <sstream>
+
 #include "modules/Gui.h"
 #include "modules/Screen.h"
 
@@ -26,7 +29,7 @@ REQUIRE_GLOBAL(world);
 
 AI::AI() :
     rng{ 0 },
-    logger{ "df-ai.log", std::ios::out | std::ios::app },
+    logger{ "df-ai.log", size_t(config.log_rotate_mb) << 20 },
     eventsJson{},
     pop{ *this },
     plan{ *this },
@@ -302,32 +305,93 @@ bool AI::is_embarking()
     return events.has_exclusive<EmbarkExclusive>() || events.has_exclusive<PlanSetup>();
 }
 
-BOOST_NOINLINE std::ostream & dfai_debug_log()
+static std::mutex debug_log_mutex;
+static std::ofstream debug_log_file;
+static bool debug_log_closed = false;
+static std::once_flag debug_log_opened;
+
+// the debug log is only opened once something has gone wrong, and the lines
+// written just before a crash are the ones that matter, so unlike the other
+// logs it is written and flushed on the calling thread.
+static void debug_log_write(const std::string & text)
 {
-    static std::ofstream log;
+    std::lock_guard<std::mutex> lock(debug_log_mutex);
+    if (!debug_log_file.is_open())
+    {
+        return;
+    }
+    debug_log_file << text;
+    debug_log_file.flush();
+}
 
-    if (BOOST_UNLIKELY(!log.is_open()))
+// each thread formats into its own buffer, and every std::endl or flush
+// writes the finished text.
+class debug_log_buf : public std::stringbuf
+{
+protected:
+    virtual int sync()
     {
-        log.open("df-ai-debug.log", std::ios::out | std::ios::app);
-        log << "\n\ndf-ai debug log opened. version information follows:" << std::endl;
-        ai_version(log);
-
-        color_ostream_proxy out(Core::getInstance().getConsole());
-        out << std::endl;
-        out << std::endl;
-        out << COLOR_LIGHTRED << "It was inevitable. ";
-        out << COLOR_YELLOW << "df-ai has encountered an issue." << std::endl;
-        out << "Some information that might help fix this has been written to a file named ";
-        out << COLOR_LIGHTCYAN << "df-ai-debug.log";
-        out << COLOR_YELLOW << " in your Dwarf Fortress folder." << std::endl;
-        out << "If you would like to help, create an issue at https://github.com/BenLubar/df-ai/issues/new (you can drag or copy and paste the log file into the editor)." << std::endl;
+        if (!str().empty())
+        {
+            debug_log_write(str());
+            str(std::string());
+        }
+        return 0;
+    }
+};
+
+static void open_debug_log()
+{
+    {
+        std::lock_guard<std::mutex> lock(debug_log_mutex);
+        if (debug_log_closed)
+        {
+            return;
+        }
+        debug_log_file.open("df-ai-debug.log", std::ios::out | std::ios::app);
+    }
+
+    std::ostringstream banner;
+    banner << "\n\ndf-ai debug log opened. version information follows:" << std::endl;
+    ai_version(banner);
+    debug_log_write(banner.str());
+
+    color_ostream_proxy out(Core::getInstance().getConsole());
+    out << std::endl;
+    out << std::endl;
+    out << COLOR_LIGHTRED << "It was inevitable. ";
+    out << COLOR_YELLOW << "df-ai has encountered an issue." << std::endl;
+    out << "Some information that might help fix this has been written to a file named ";
+    out << COLOR_LIGHTCYAN << "df-ai-debug.log";
+    out << COLOR_YELLOW << " in your Dwarf Fortress folder." << std::endl;
+    out << "If you would like to help, create an issue at https://github.com/BenLubar/df-ai/issues/new (you can drag or copy and paste the log file into the editor)." << std::endl;
 
 #ifndef DFAI_RELEASE
-        out << COLOR_LIGHTRED << "If your game crashes after this message, please attach a debugger or use a release mode version of df-ai." << std::endl;
+    out << COLOR_LIGHTRED << "If your game crashes after this message, please attach a debugger or use a release mode version of df-ai." << std::endl;
 #endif
-        out << std::endl;
-        out << std::endl;
-    }
+    out << std::endl;
+    out << std::endl;
+}
+
+BOOST_NOINLINE std::ostream & dfai_debug_log()
+{
+    static thread_local debug_log_buf buf;
+    static thread_local std::ostream log(&buf);
+
+    std::call_once(debug_log_opened, open_debug_log);
 
     return log;
 }
+
+void dfai_debug_log_flush()
+{
+    std::lock_guard<std::mutex> lock(debug_log_mutex);
+    debug_log_file.flush();
+}
+
+void dfai_debug_log_close()
+{
+    std::lock_guard<std::mutex> lock(debug_log_mutex);
+    debug_log_closed = true;
+    debug_log_file.close();
+}
@@ -3,6 +3,7 @@
 #include "dfhack_shared.h"
 #include "config.h"
 #include "room.h"
+#include "log_writer.h"
 
 #include <ctime>
 #include <fstream>
@@ -51,14 +52,15 @@ inline std::string maybe_escape(const std::string & str, bool html)
 }
 void ai_version(std::ostream & out, bool html = false);
 class weblegends_handler_v1;
+class DesignationBatch;
 bool ai_weblegends_handler(weblegends_handler_v1 & out, const std::string & url);
 
 class AI
 {
 public:
     std::mt19937 rng;
-    std::ofstream logger;
-    std::ofstream eventsJson;
+    AsyncLogWriter logger;
+    AsyncLogWriter eventsJson;
     Population pop;
     Plan plan;
     Stocks stocks;
@@ -124,6 +126,9 @@ public:
     static std::string describe_furniture(furniture *f, bool html = false);
 
     static void dig_tile(df::coord t, df::tile_dig_designation dig = tile_dig_designation::Default);
+    // designates every tile in the batch; with mark, the tiles are also
+    // flagged as planned (dig_marked) rather than ready to dig.
+    static void dig_tiles(DesignationBatch & tiles, bool mark = false);
 
     df::coord fort_entrance_pos();
     room *find_room(room_type::type type);
@@ -1,4 +1,5 @@
 #include "blueprint.h"
+#include "plan_setup.h"
 
 #include "modules/Filesystem.h"
 
@@ -36,10 +37,9 @@ static T *load_json(const std::string & filename, const std::string & type, cons
     return nullptr;
 }
 
-template<typename T>
-void load_objects(color_ostream & out, const std::string & subtype, std::function<void(const std::string & type, const std::string & name, T *t)> store)
+static std::vector<blueprint_source_t> list_objects(const std::string & subtype)
 {
-    std::string error;
+    std::vector<blueprint_source_t> sources;
     std::vector<std::string> types;
     if (!Filesystem::listdir("df-ai-blueprints/rooms/" + subtype, types))
     {
@@ -62,23 +62,45 @@ void load_objects(color_ostream & out, const std::string & subtype, std::functio
                     }
 
                     std::string path = "df-ai-blueprints/rooms/" + subtype + "/" + type + "/" + name;
-                    std::string base_name = name.substr(0, ext);
-
-                    if (auto t = load_json<T>(path, type, base_name, error))
-                    {
-                        store(type, base_name, t);
-                    }
-                    else
-                    {
-                        out.printerr("%s\n", error.c_str());
-                    }
+                    sources.push_back(blueprint_source_t{ type, name.substr(0, ext), path });
                 }
             }
         }
     }
+    return sources;
+}
+
+// runs fn(0) through fn(count - 1) on the worker pool, or on this thread if
+// there isn't one.
+static void run_jobs(setup_worker_pool *workers, size_t count, const std::function<void(size_t)> & fn)
+{
+    if (workers)
+    {
+        workers->run(count, fn);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        fn(i);
+    }
+}
+
+// parses every file in sources. parsed[i] is null and errors[i] is set if
+// sources[i] could not be loaded.
+template<typename T>
+static void load_objects(setup_worker_pool *workers, const std::vector<blueprint_source_t> & sources, std::vector<T *> & parsed, std::vector<std::string> & errors)
+{
+    parsed.assign(sources.size(), nullptr);
+    errors.assign(sources.size(), std::string());
+    run_jobs(workers, sources.size(), [&sources, &parsed, &errors](size_t i)
+    {
+        auto & source = sources.at(i);
+        parsed.at(i) = load_json<T>(source.path, source.type, source.name, errors.at(i));
+    });
 }
 
-blueprints_t::blueprints_t(color_ostream & out) : is_valid(true)
+blueprints_t::blueprints_t(color_ostream & out, setup_worker_pool *workers) : is_valid(true)
 {
     if (!Filesystem::isdir("df-ai-blueprints"))
     {
@@ -88,64 +110,32 @@ blueprints_t::blueprints_t(color_ostream & out) : is_valid(true)
         return;
     }
 
-    std::map<std::string, std::pair<std::vector<std::pair<std::string, room_template *>>, std::vector<std::pair<std::string, room_instance *>>>> rooms;
+    auto templates = list_objects("templates");
+    auto instances = list_objects("instances");
 
-    load_objects<room_template>(out, "templates", [&rooms](const std::string & type, const std::string & name, room_template *tmpl)
+    std::vector<std::string> paths;
+    for (auto & source : templates)
     {
-        rooms[type].first.push_back(std::make_pair(name, tmpl));
-    });
-    load_objects<room_instance>(out, "instances", [&rooms](const std::string & type, const std::string & name, room_instance *inst)
+        paths.push_back(source.path);
+    }
+    for (auto & source : instances)
     {
-        rooms[type].second.push_back(std::make_pair(name, inst));
-    });
+        paths.push_back(source.path);
+    }
+    uint64_t key = 0;
+    bool have_key = bundle_key(paths, key);
 
-    std::string error;
-    for (auto & type : rooms)
+    if (!have_key || !load_bundle(key))
     {
-        auto & rbs = blueprints[type.first];
-        rbs.reserve(type.second.first.size() * type.second.second.size());
-        if (type.second.first.empty())
-        {
-            is_valid = false;
-            out.printerr("%s: no templates\n", type.first.c_str());
-        }
-        if (type.second.second.empty())
-        {
-            is_valid = false;
-            out.printerr("%s: no instances\n", type.first.c_str());
-        }
-        for (auto tmpl : type.second.first)
-        {
-            for (auto inst : type.second.second)
-            {
-                if (inst.second->blacklist.count(tmpl.first))
-                {
-                    continue;
-                }
-
-                room_blueprint *rb = new room_blueprint(tmpl.second, inst.second);
-                if (!rb->apply(error))
-                {
-                    is_valid = false;
-                    out.printerr("%s + %s: %s\n", tmpl.first.c_str(), inst.first.c_str(), error.c_str());
-                    delete rb;
-                    continue;
-                }
-                if (rb->warn(error))
-                {
-                    is_valid = false;
-                    out.printerr("%s + %s: %s\n", tmpl.first.c_str(), inst.first.c_str(), error.c_str());
-                }
-                rbs.push_back(rb);
-            }
-            delete tmpl.second;
-        }
-        for (auto inst : type.second.second)
+        // only a clean build is cached, so loading the cache never has
+        // errors to repeat.
+        if (load_rooms(out, workers, templates, instances) && have_key)
         {
-            delete inst.second;
+            save_bundle(key);
         }
     }
 
+    std::string error;
     std::vector<std::string> names;
     if (!Filesystem::listdir("df-ai-blueprints/plans", names))
     {
@@ -172,6 +162,126 @@ blueprints_t::blueprints_t(color_ostream & out) : is_valid(true)
     }
 }
 
+bool blueprints_t::load_rooms(color_ostream & out, setup_worker_pool *workers, const std::vector<blueprint_source_t> & templates, const std::vector<blueprint_source_t> & instances)
+{
+    // the files are parsed and the pairs merged on the worker pool, but
+    // everything is printed and stored from this thread afterwards, in the
+    // same order as a serial load.
+    std::vector<room_template *> parsed_templates;
+    std::vector<std::string> template_errors;
+    load_objects(workers, templates, parsed_templates, template_errors);
+    std::vector<room_instance *> parsed_instances;
+    std::vector<std::string> instance_errors;
+    load_objects(workers, instances, parsed_instances, instance_errors);
+
+    bool clean = true;
+    std::map<std::string, std::pair<std::vector<std::pair<std::string, room_template *>>, std::vector<std::pair<std::string, room_instance *>>>> rooms;
+    for (size_t i = 0; i < templates.size(); i++)
+    {
+        if (auto tmpl = parsed_templates.at(i))
+        {
+            rooms[templates.at(i).type].first.push_back(std::make_pair(templates.at(i).name, tmpl));
+        }
+        else
+        {
+            clean = false;
+            out.printerr("%s\n", template_errors.at(i).c_str());
+        }
+    }
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        if (auto inst = parsed_instances.at(i))
+        {
+            rooms[instances.at(i).type].second.push_back(std::make_pair(instances.at(i).name, inst));
+        }
+        else
+        {
+            clean = false;
+            out.printerr("%s\n", instance_errors.at(i).c_str());
+        }
+    }
+
+    struct pair_t
+    {
+        const std::pair<std::string, room_template *> *tmpl;
+        const std::pair<std::string, room_instance *> *inst;
+        room_blueprint *rb;
+        bool applied;
+        bool warned;
+        std::string error;
+    };
+    std::vector<pair_t> pairs;
+    for (auto & type : rooms)
+    {
+        for (auto & tmpl : type.second.first)
+        {
+            for (auto & inst : type.second.second)
+            {
+                if (!inst.second->blacklist.count(tmpl.first))
+                {
+                    pairs.push_back(pair_t{ &tmpl, &inst, nullptr, false, false, std::string() });
+                }
+            }
+        }
+    }
+
+    run_jobs(workers, pairs.size(), [&pairs](size_t i)
+    {
+        auto & pair = pairs.at(i);
+        pair.rb = new room_blueprint(pair.tmpl->second, pair.inst->second);
+        pair.applied = pair.rb->apply(pair.error);
+        if (!pair.applied)
+        {
+            delete pair.rb;
+            pair.rb = nullptr;
+            return;
+        }
+        pair.warned = pair.rb->warn(pair.error);
+    });
+
+    auto next_pair = pairs.begin();
+    for (auto & type : rooms)
+    {
+        auto & rbs = blueprints[type.first];
+        rbs.reserve(type.second.first.size() * type.second.second.size());
+        if (type.second.first.empty())
+        {
+            is_valid = false;
+            clean = false;
+            out.printerr("%s: no templates\n", type.first.c_str());
+        }
+        if (type.second.second.empty())
+        {
+            is_valid = false;
+            clean = false;
+            out.printerr("%s: no instances\n", type.first.c_str());
+        }
+        for (; next_pair != pairs.end() && next_pair->inst->second->type == type.first; next_pair++)
+        {
+            if (!next_pair->applied || next_pair->warned)
+            {
+                is_valid = false;
+                clean = false;
+                out.printerr("%s + %s: %s\n", next_pair->tmpl->first.c_str(), next_pair->inst->first.c_str(), next_pair->error.c_str());
+            }
+            if (next_pair->rb)
+            {
+                rbs.push_back(next_pair->rb);
+            }
+        }
+        for (auto & tmpl : type.second.first)
+        {
+            delete tmpl.second;
+        }
+        for (auto & inst : type.second.second)
+        {
+            delete inst.second;
+        }
+    }
+
+    return clean;
+}
+
 blueprints_t::~blueprints_t()
 {
     for (auto & type : blueprints)
@@ -11,6 +11,7 @@
 #include <functional>
 
 class AI;
+class setup_worker_pool;
 
 struct room_blueprint;
 
@@ -141,11 +142,19 @@ struct room_instance : public room_base
     std::vector<Json::Value *> placeholders;
 };
 
+// Up to 64 tiles of one row: bit i is set if start + (i, 0, 0) is included.
+struct blueprint_tile_run
+{
+    df::coord start;
+    uint64_t bits;
+};
+
 struct room_blueprint
 {
     room_blueprint(const room_template *tmpl, const room_instance *inst);
     room_blueprint(const room_blueprint & rb);
-    room_blueprint(const room_blueprint & rb, df::coord offset, const variable_string::context_t & context);
+    // an empty blueprint to be filled in from df-ai-blueprints.cache.
+    room_blueprint(const std::string & type, const std::string & tmpl_name, const std::string & name);
     ~room_blueprint();
 
     df::coord origin;
@@ -158,10 +167,16 @@ struct room_blueprint
     std::vector<room_base::room_t *> rooms;
 
     int32_t max_noblesuite;
-    std::set<df::coord> corridor;
-    std::set<df::coord> interior;
-    std::set<df::coord> no_room;
-    std::set<df::coord> no_corridor;
+    // sorted, without duplicates.
+    std::vector<df::coord> corridor;
+    std::vector<df::coord> interior;
+    std::vector<df::coord> no_room;
+    std::vector<df::coord> no_corridor;
+    // the same tiles, in z, y, x order.
+    std::vector<blueprint_tile_run> corridor_runs;
+    std::vector<blueprint_tile_run> interior_runs;
+    std::vector<blueprint_tile_run> no_room_runs;
+    std::vector<blueprint_tile_run> no_corridor_runs;
 
     bool apply(std::string & error);
     bool warn(std::string & error);
@@ -169,6 +184,29 @@ struct room_blueprint
     void write_layout(std::ostream & f);
 };
 
+// A room_blueprint at an offset, using the context of the exit it is attached
+// to. Nothing is copied: rooms, furniture, and tiles are read from the base
+// blueprint and shifted by offset, so trying a position does not allocate.
+// PlanSetup::add copies the rooms and furniture once the position is taken.
+struct placed_blueprint
+{
+    placed_blueprint(const room_blueprint & base, df::coord offset, const variable_string::context_t & context) :
+        base(base),
+        offset(offset),
+        context(context)
+    {
+    }
+
+    const room_blueprint & base;
+    const df::coord offset;
+    const variable_string::context_t & context;
+
+    inline df::coord origin() const
+    {
+        return base.origin + offset;
+    }
+};
+
 struct blueprint_plan_template
 {
     blueprint_plan_template(const std::string &, const std::string & name) :
@@ -200,10 +238,18 @@ struct blueprint_plan_template
     bool apply(Json::Value data, std::string & error);
 };
 
+struct blueprint_source_t
+{
+    std::string type;
+    std::string name;
+    std::string path;
+};
+
 class blueprints_t
 {
 public:
-    blueprints_t(color_ostream & out);
+    // workers may be null to load everything on the calling thread.
+    blueprints_t(color_ostream & out, setup_worker_pool *workers = nullptr);
     ~blueprints_t();
 
     bool is_valid;
@@ -213,4 +259,11 @@ private:
     std::map<std::string, std::vector<room_blueprint *>> blueprints;
     std::map<std::string, blueprint_plan_template *> plans;
     friend class PlanSetup;
+
+    // df-ai-blueprints.cache holds the merged room blueprints, keyed by a
+    // hash of the room template and instance files they were built from.
+    bool load_rooms(color_ostream & out, setup_worker_pool *workers, const std::vector<blueprint_source_t> & templates, const std::vector<blueprint_source_t> & instances);
+    static bool bundle_key(const std::vector<std::string> & paths, uint64_t & key);
+    bool load_bundle(uint64_t key);
+    void save_bundle(uint64_t key) const;
 };
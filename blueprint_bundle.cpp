@@ -0,0 +1,609 @@
+#include "blueprint.h"
+#include "plan_binary.h"
+
+#include "df-ai-git-describe.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// df-ai-blueprints.cache format. All integers are little-endian.
+//
+// header:
+//     char magic[8] = "DFAIBPRB"
+//     uint32 version
+//     uint64 source key
+//     uint32 room type count
+// room type table, one entry per room type:
+//     string name
+//     uint32 blueprint count
+// blueprint table, one entry per blueprint, in the same order:
+//     uint64 offset from the start of the file
+//     uint64 size in bytes
+// followed by the blueprint records.
+//
+// Records only refer to each other by index, never by address, so the file
+// can be read (or mapped) anywhere and each blueprint decoded on its own.
+// The source key is a hash of every room template and instance file, the
+// record encoding version, the df-ai commit and build time, and the names
+// of the enums stored in the records. A bundle with a different key is
+// ignored and rebuilt from the JSON files. The build time catches encoder
+// changes that were never committed; the record version must still be
+// bumped whenever encode_blueprint or decode_blueprint change.
+//
+// The bundle is written to a temporary file that replaces the old one only
+// once it was written completely.
+
+const static char blueprint_bundle_magic[8] = { 'D', 'F', 'A', 'I', 'B', 'P', 'R', 'B' };
+const static uint32_t blueprint_bundle_version = 1;
+const static uint32_t blueprint_bundle_record_version = 1;
+const static char *const blueprint_bundle_build = __DATE__ " " __TIME__;
+const static char *const blueprint_bundle_filename = "df-ai-blueprints.cache";
+const static char *const blueprint_bundle_tmp_filename = "df-ai-blueprints.cache.tmp";
+
+// FNV-1a, 64 bit.
+struct blueprint_bundle_hash
+{
+    uint64_t value;
+
+    blueprint_bundle_hash() : value(14695981039346656037ULL) {}
+
+    void add(const char *data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            value ^= uint64_t(uint8_t(data[i]));
+            value *= 1099511628211ULL;
+        }
+    }
+    inline void add(const std::string & s)
+    {
+        plan_binary_writer w;
+        w.put<uint64_t>(uint64_t(s.size()));
+        add(w.data.data(), w.data.size());
+        add(s.data(), s.size());
+    }
+};
+
+template<typename T>
+static void hash_enum_names(blueprint_bundle_hash & h, int32_t count)
+{
+    std::ostringstream stringify;
+    for (int32_t i = 0; i < count; i++)
+    {
+        stringify.str(std::string());
+        stringify.clear();
+        stringify << T(i);
+        h.add(stringify.str());
+    }
+}
+
+template<typename T>
+static void hash_df_enum_names(blueprint_bundle_hash & h)
+{
+    for (int32_t i = int32_t(df::enum_traits<T>::first_item_value); i <= int32_t(df::enum_traits<T>::last_item_value); i++)
+    {
+        h.add(enum_item_key(T(i)));
+    }
+}
+
+bool blueprints_t::bundle_key(const std::vector<std::string> & paths, uint64_t & key)
+{
+    blueprint_bundle_hash h;
+    h.add(std::string(blueprint_bundle_magic, sizeof(blueprint_bundle_magic)));
+    h.add(std::to_string(blueprint_bundle_version));
+    h.add(std::to_string(blueprint_bundle_record_version));
+    h.add(DF_AI_GIT_COMMIT);
+    h.add(blueprint_bundle_build);
+
+    hash_enum_names<room_type::type>(h, room_type::_room_type_count);
+    hash_enum_names<corridor_type::type>(h, corridor_type::_corridor_type_count);
+    hash_enum_names<farm_type::type>(h, farm_type::_farm_type_count);
+    hash_enum_names<stockpile_type::type>(h, stockpile_type::_stockpile_type_count);
+    hash_enum_names<nobleroom_type::type>(h, nobleroom_type::_nobleroom_type_count);
+    hash_enum_names<outpost_type::type>(h, outpost_type::_outpost_type_count);
+    hash_enum_names<location_type::type>(h, location_type::_location_type_count);
+    hash_enum_names<cistern_type::type>(h, cistern_type::_cistern_type_count);
+    hash_enum_names<layout_type::type>(h, layout_type::_layout_type_count);
+    hash_df_enum_names<df::workshop_type>(h);
+    hash_df_enum_names<df::furnace_type>(h);
+    hash_df_enum_names<df::construction_type>(h);
+    hash_df_enum_names<df::tile_dig_designation>(h);
+    hash_df_enum_names<df::stockpile_list>(h);
+
+    // listdir order depends on the filesystem, so hash in a fixed order.
+    std::vector<std::string> sorted(paths);
+    std::sort(sorted.begin(), sorted.end());
+    for (auto & path : sorted)
+    {
+        std::ifstream f(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << f.rdbuf();
+        if (f.bad())
+        {
+            return false;
+        }
+        h.add(path);
+        h.add(contents.str());
+    }
+
+    key = h.value;
+    return true;
+}
+
+static void put_variable_string(plan_binary_writer & w, const variable_string & s)
+{
+    w.put<uint32_t>(uint32_t(s.contents.size()));
+    for (auto & e : s.contents)
+    {
+        w.put_bool(e.variable);
+        w.put_string(e.text);
+    }
+}
+
+static void put_context(plan_binary_writer & w, const variable_string::context_t & context)
+{
+    w.put<uint32_t>(uint32_t(context.variables.size()));
+    for (auto & v : context.variables)
+    {
+        w.put_string(v.first);
+        w.put_string(v.second);
+    }
+}
+
+static void put_coords(plan_binary_writer & w, const std::vector<df::coord> & coords)
+{
+    w.put<uint32_t>(uint32_t(coords.size()));
+    for (auto c : coords)
+    {
+        w.put_coord(c);
+    }
+}
+
+static void put_runs(plan_binary_writer & w, const std::vector<blueprint_tile_run> & runs)
+{
+    w.put<uint32_t>(uint32_t(runs.size()));
+    for (auto & run : runs)
+    {
+        w.put_coord(run.start);
+        w.put<uint64_t>(run.bits);
+    }
+}
+
+static void encode_furniture(plan_binary_writer & w, const room_base::furniture_t *f)
+{
+    w.put_bool(f->has_placeholder);
+    w.put<uint64_t>(uint64_t(f->placeholder));
+    w.put_enum(f->type);
+    w.put_enum(f->construction);
+    w.put_enum(f->dig);
+    w.put_coord(f->pos);
+    w.put_bool(f->has_target);
+    w.put<uint64_t>(uint64_t(f->target));
+    w.put<uint64_t>(uint64_t(f->has_users));
+    w.put_bool(f->ignore);
+    w.put_bool(f->makeroom);
+    w.put_bool(f->internal);
+    w.put_bool(f->stairs_special);
+    put_variable_string(w, f->comment);
+    put_context(w, f->context);
+}
+
+static void encode_room(plan_binary_writer & w, const room_base::room_t *r)
+{
+    w.put_bool(r->has_placeholder);
+    w.put<uint64_t>(uint64_t(r->placeholder));
+    w.put_enum(r->type);
+    w.put_enum(r->corridor_type);
+    w.put_enum(r->farm_type);
+    w.put_enum(r->stockpile_type);
+    w.put_enum(r->nobleroom_type);
+    w.put_enum(r->outpost_type);
+    w.put_enum(r->location_type);
+    w.put_enum(r->cistern_type);
+    w.put_enum(r->workshop_type);
+    w.put_enum(r->furnace_type);
+    put_variable_string(w, r->raw_type);
+    put_variable_string(w, r->comment);
+    w.put_coord(r->min);
+    w.put_coord(r->max);
+    w.put<uint32_t>(uint32_t(r->accesspath.size()));
+    for (auto idx : r->accesspath)
+    {
+        w.put<uint64_t>(uint64_t(idx));
+    }
+    w.put<uint32_t>(uint32_t(r->layout.size()));
+    for (auto idx : r->layout)
+    {
+        w.put<uint64_t>(uint64_t(idx));
+    }
+    w.put<int32_t>(r->level);
+    w.put<int32_t>(r->noblesuite);
+    w.put<int32_t>(r->queue);
+    w.put_bool(r->has_workshop);
+    w.put<uint64_t>(uint64_t(r->workshop));
+    w.put<uint32_t>(uint32_t(r->stock_disable.size()));
+    for (auto sl : r->stock_disable)
+    {
+        w.put_enum(sl);
+    }
+    w.put_bool(r->stock_specific1);
+    w.put_bool(r->stock_specific2);
+    w.put<uint64_t>(uint64_t(r->has_users));
+    w.put_bool(r->temporary);
+    w.put_bool(r->outdoor);
+    w.put_bool(r->single_biome);
+    w.put_bool(r->require_walls);
+    w.put_bool(r->require_floor);
+    w.put<int32_t>(r->require_grass);
+    w.put_bool(r->require_stone);
+    w.put_bool(r->in_corridor);
+    w.put_bool(r->remove_if_unused);
+    w.put_bool(r->build_when_accessible);
+    w.put<uint32_t>(uint32_t(r->exits.size()));
+    for (auto & exit : r->exits)
+    {
+        w.put_coord(exit.first);
+        w.put<uint32_t>(uint32_t(exit.second.size()));
+        for (auto & target : exit.second)
+        {
+            w.put_string(target.first);
+            w.put<uint32_t>(uint32_t(target.second.size()));
+            for (auto & var : target.second)
+            {
+                w.put_string(var.first);
+                put_variable_string(w, var.second);
+            }
+        }
+    }
+    put_context(w, r->context);
+    w.put_string(r->blueprint);
+    w.put_coord(r->channel_enable);
+}
+
+static void encode_blueprint(plan_binary_writer & w, const room_blueprint *rb)
+{
+    w.put_string(rb->type);
+    w.put_string(rb->tmpl_name);
+    w.put_string(rb->name);
+    w.put_coord(rb->origin);
+    w.put<int32_t>(rb->max_noblesuite);
+    w.put<uint32_t>(uint32_t(rb->layout.size()));
+    for (auto f : rb->layout)
+    {
+        encode_furniture(w, f);
+    }
+    w.put<uint32_t>(uint32_t(rb->rooms.size()));
+    for (auto r : rb->rooms)
+    {
+        encode_room(w, r);
+    }
+    put_coords(w, rb->corridor);
+    put_coords(w, rb->interior);
+    put_coords(w, rb->no_room);
+    put_coords(w, rb->no_corridor);
+    put_runs(w, rb->corridor_runs);
+    put_runs(w, rb->interior_runs);
+    put_runs(w, rb->no_room_runs);
+    put_runs(w, rb->no_corridor_runs);
+}
+
+template<typename E>
+static E get_enum(plan_binary_reader & r)
+{
+    return E(r.get<int16_t>());
+}
+
+static void get_variable_string(plan_binary_reader & r, variable_string & s)
+{
+    uint32_t count = r.get_count(1 + 4);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bool variable = r.get_bool();
+        s.contents.push_back(variable_string::element_t(r.get_string(), variable));
+    }
+}
+
+static void get_context(plan_binary_reader & r, variable_string::context_t & context)
+{
+    uint32_t count = r.get_count(4 + 4);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::string key = r.get_string();
+        context.variables[key] = r.get_string();
+    }
+}
+
+static void get_coords(plan_binary_reader & r, std::vector<df::coord> & coords)
+{
+    uint32_t count = r.get_count(6);
+    coords.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        coords.push_back(r.get_coord());
+    }
+}
+
+static void get_runs(plan_binary_reader & r, std::vector<blueprint_tile_run> & runs)
+{
+    uint32_t count = r.get_count(6 + 8);
+    runs.reserve(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        df::coord start = r.get_coord();
+        runs.push_back(blueprint_tile_run{ start, r.get<uint64_t>() });
+    }
+}
+
+static void decode_furniture(plan_binary_reader & r, room_base::furniture_t *f)
+{
+    f->has_placeholder = r.get_bool();
+    f->placeholder = room_base::placeholderindex_t(r.get<uint64_t>());
+    f->type = get_enum<layout_type::type>(r);
+    f->construction = get_enum<df::construction_type>(r);
+    f->dig = get_enum<df::tile_dig_designation>(r);
+    f->pos = r.get_coord();
+    f->has_target = r.get_bool();
+    f->target = room_base::layoutindex_t(r.get<uint64_t>());
+    f->has_users = size_t(r.get<uint64_t>());
+    f->ignore = r.get_bool();
+    f->makeroom = r.get_bool();
+    f->internal = r.get_bool();
+    f->stairs_special = r.get_bool();
+    get_variable_string(r, f->comment);
+    get_context(r, f->context);
+}
+
+static void decode_room(plan_binary_reader & r, room_base::room_t *rr)
+{
+    rr->has_placeholder = r.get_bool();
+    rr->placeholder = room_base::placeholderindex_t(r.get<uint64_t>());
+    rr->type = get_enum<room_type::type>(r);
+    rr->corridor_type = get_enum<corridor_type::type>(r);
+    rr->farm_type = get_enum<farm_type::type>(r);
+    rr->stockpile_type = get_enum<stockpile_type::type>(r);
+    rr->nobleroom_type = get_enum<nobleroom_type::type>(r);
+    rr->outpost_type = get_enum<outpost_type::type>(r);
+    rr->location_type = get_enum<location_type::type>(r);
+    rr->cistern_type = get_enum<cistern_type::type>(r);
+    rr->workshop_type = get_enum<df::workshop_type>(r);
+    rr->furnace_type = get_enum<df::furnace_type>(r);
+    get_variable_string(r, rr->raw_type);
+    get_variable_string(r, rr->comment);
+    rr->min = r.get_coord();
+    rr->max = r.get_coord();
+    uint32_t accesspath_count = r.get_count(8);
+    for (uint32_t i = 0; i < accesspath_count; i++)
+    {
+        rr->accesspath.push_back(room_base::roomindex_t(r.get<uint64_t>()));
+    }
+    uint32_t layout_count = r.get_count(8);
+    for (uint32_t i = 0; i < layout_count; i++)
+    {
+        rr->layout.push_back(room_base::layoutindex_t(r.get<uint64_t>()));
+    }
+    rr->level = r.get<int32_t>();
+    rr->noblesuite = r.get<int32_t>();
+    rr->queue = r.get<int32_t>();
+    rr->has_workshop = r.get_bool();
+    rr->workshop = room_base::roomindex_t(r.get<uint64_t>());
+    uint32_t stock_disable_count = r.get_count(2);
+    for (uint32_t i = 0; i < stock_disable_count; i++)
+    {
+        rr->stock_disable.insert(get_enum<df::stockpile_list>(r));
+    }
+    rr->stock_specific1 = r.get_bool();
+    rr->stock_specific2 = r.get_bool();
+    rr->has_users = size_t(r.get<uint64_t>());
+    rr->temporary = r.get_bool();
+    rr->outdoor = r.get_bool();
+    rr->single_biome = r.get_bool();
+    rr->require_walls = r.get_bool();
+    rr->require_floor = r.get_bool();
+    rr->require_grass = r.get<int32_t>();
+    rr->require_stone = r.get_bool();
+    rr->in_corridor = r.get_bool();
+    rr->remove_if_unused = r.get_bool();
+    rr->build_when_accessible = r.get_bool();
+    uint32_t exit_count = r.get_count(6 + 4);
+    for (uint32_t i = 0; i < exit_count; i++)
+    {
+        auto & exit = rr->exits[r.get_coord()];
+        uint32_t target_count = r.get_count(4 + 4);
+        for (uint32_t j = 0; j < target_count; j++)
+        {
+            auto & target = exit[r.get_string()];
+            uint32_t var_count = r.get_count(4 + 4);
+            for (uint32_t k = 0; k < var_count; k++)
+            {
+                std::string key = r.get_string();
+                get_variable_string(r, target[key]);
+            }
+        }
+    }
+    get_context(r, rr->context);
+    rr->blueprint = r.get_string();
+    rr->channel_enable = r.get_coord();
+}
+
+static room_blueprint *decode_blueprint(plan_binary_reader & r)
+{
+    std::string type = r.get_string();
+    std::string tmpl_name = r.get_string();
+    std::string name = r.get_string();
+    room_blueprint *rb = new room_blueprint(type, tmpl_name, name);
+    rb->origin = r.get_coord();
+    rb->max_noblesuite = r.get<int32_t>();
+    uint32_t layout_count = r.get_count(1);
+    for (uint32_t i = 0; i < layout_count && r.ok; i++)
+    {
+        rb->layout.push_back(new room_base::furniture_t());
+        decode_furniture(r, rb->layout.back());
+    }
+    uint32_t room_count = r.get_count(1);
+    for (uint32_t i = 0; i < room_count && r.ok; i++)
+    {
+        rb->rooms.push_back(new room_base::room_t());
+        decode_room(r, rb->rooms.back());
+    }
+    get_coords(r, rb->corridor);
+    get_coords(r, rb->interior);
+    get_coords(r, rb->no_room);
+    get_coords(r, rb->no_corridor);
+    get_runs(r, rb->corridor_runs);
+    get_runs(r, rb->interior_runs);
+    get_runs(r, rb->no_room_runs);
+    get_runs(r, rb->no_corridor_runs);
+
+    bool ok = r.ok && r.pos == r.end;
+    std::string error;
+    for (auto f : rb->layout)
+    {
+        ok = ok && f->check_indexes(rb->layout.size(), rb->rooms.size(), error);
+    }
+    for (auto rr : rb->rooms)
+    {
+        ok = ok && rr->check_indexes(rb->layout.size(), rb->rooms.size(), error);
+    }
+    if (!ok)
+    {
+        delete rb;
+        return nullptr;
+    }
+    return rb;
+}
+
+bool blueprints_t::load_bundle(uint64_t key)
+{
+    std::ifstream f(blueprint_bundle_filename, std::ios::binary);
+    if (!f.good())
+    {
+        return false;
+    }
+    std::ostringstream contents;
+    contents << f.rdbuf();
+    const std::string data(contents.str());
+
+    if (data.size() < sizeof(blueprint_bundle_magic) || data.compare(0, sizeof(blueprint_bundle_magic), blueprint_bundle_magic, sizeof(blueprint_bundle_magic)))
+    {
+        return false;
+    }
+
+    plan_binary_reader header(data, 0, data.size());
+    header.pos += sizeof(blueprint_bundle_magic);
+    uint32_t version = header.get<uint32_t>();
+    uint64_t stored_key = header.get<uint64_t>();
+    if (!header.ok || version != blueprint_bundle_version || stored_key != key)
+    {
+        return false;
+    }
+
+    std::vector<std::pair<std::string, uint32_t>> types;
+    uint32_t type_count = header.get_count(4 + 4);
+    for (uint32_t i = 0; i < type_count; i++)
+    {
+        std::string type = header.get_string();
+        uint32_t count = header.get_count(8 + 8);
+        types.push_back(std::make_pair(type, count));
+    }
+
+    std::map<std::string, std::vector<room_blueprint *>> loaded;
+    bool ok = header.ok;
+    for (auto & type : types)
+    {
+        auto & rbs = loaded[type.first];
+        rbs.reserve(type.second);
+        for (uint32_t i = 0; i < type.second && ok; i++)
+        {
+            uint64_t offset = header.get<uint64_t>();
+            uint64_t size = header.get<uint64_t>();
+            if (!header.ok || offset > data.size() || size > data.size() - offset)
+            {
+                ok = false;
+                break;
+            }
+
+            plan_binary_reader r(data, size_t(offset), size_t(size));
+            room_blueprint *rb = decode_blueprint(r);
+            if (!rb || rb->type != type.first)
+            {
+                delete rb;
+                ok = false;
+                break;
+            }
+            rbs.push_back(rb);
+        }
+    }
+
+    if (!ok)
+    {
+        for (auto & type : loaded)
+        {
+            for (auto rb : type.second)
+            {
+                delete rb;
+            }
+        }
+        return false;
+    }
+
+    blueprints.swap(loaded);
+    return true;
+}
+
+void blueprints_t::save_bundle(uint64_t key) const
+{
+    std::vector<std::string> records;
+    plan_binary_writer types;
+    types.put<uint32_t>(uint32_t(blueprints.size()));
+    for (auto & type : blueprints)
+    {
+        types.put_string(type.first);
+        types.put<uint32_t>(uint32_t(type.second.size()));
+        for (auto rb : type.second)
+        {
+            plan_binary_writer w;
+            encode_blueprint(w, rb);
+            records.push_back(std::move(w.data));
+        }
+    }
+
+    plan_binary_writer header;
+    header.data.append(blueprint_bundle_magic, sizeof(blueprint_bundle_magic));
+    header.put<uint32_t>(blueprint_bundle_version);
+    header.put<uint64_t>(key);
+    header.data.append(types.data);
+
+    uint64_t offset = uint64_t(header.data.size() + records.size() * (8 + 8));
+    for (auto & record : records)
+    {
+        header.put<uint64_t>(offset);
+        header.put<uint64_t>(uint64_t(record.size()));
+        offset += uint64_t(record.size());
+    }
+
+    {
+        std::ofstream f(blueprint_bundle_tmp_filename, std::ofstream::trunc | std::ofstream::binary);
+        f.write(header.data.data(), std::streamsize(header.data.size()));
+        for (auto & record : records)
+        {
+            f.write(record.data(), std::streamsize(record.size()));
+        }
+        f.close();
+        if (!f)
+        {
+            // a partial bundle would fail its size checks anyway, but don't
+            // replace a good one with it.
+            std::remove(blueprint_bundle_tmp_filename);
+            return;
+        }
+    }
+
+    // rename doesn't replace an existing file on Windows.
+    std::remove(blueprint_bundle_filename);
+    if (std::rename(blueprint_bundle_tmp_filename, blueprint_bundle_filename) != 0)
+    {
+        std::remove(blueprint_bundle_tmp_filename);
+    }
+}
@@ -1,5 +1,27 @@
 #include "blueprint.h"
 
+#include <algorithm>
+#include <tuple>
+
+static void build_runs(const std::vector<df::coord> & tiles, std::vector<blueprint_tile_run> & runs)
+{
+    std::vector<df::coord> sorted(tiles);
+    std::sort(sorted.begin(), sorted.end(), [](df::coord a, df::coord b) -> bool
+    {
+        return std::make_tuple(a.z, a.y, a.x) < std::make_tuple(b.z, b.y, b.x);
+    });
+
+    runs.clear();
+    for (auto t : sorted)
+    {
+        if (runs.empty() || runs.back().start.z != t.z || runs.back().start.y != t.y || t.x - runs.back().start.x >= 64)
+        {
+            runs.push_back(blueprint_tile_run{ t, 0 });
+        }
+        runs.back().bits |= uint64_t(1) << (t.x - runs.back().start.x);
+    }
+}
+
 static bool check_indexes(const std::vector<room_base::furniture_t *> & layout, const std::vector<room_base::room_t *> & rooms, std::string & error)
 {
     room_base::layoutindex_t layout_limit(layout.size());
@@ -189,7 +211,11 @@ room_blueprint::room_blueprint(const room_template *tmpl, const room_instance *i
     corridor(),
     interior(),
     no_room(),
-    no_corridor()
+    no_corridor(),
+    corridor_runs(),
+    interior_runs(),
+    no_room_runs(),
+    no_corridor_runs()
 {
 }
 
@@ -206,7 +232,11 @@ room_blueprint::room_blueprint(const room_blueprint & rb) :
     corridor(),
     interior(),
     no_room(),
-    no_corridor()
+    no_corridor(),
+    corridor_runs(),
+    interior_runs(),
+    no_room_runs(),
+    no_corridor_runs()
 {
     for (auto f : rb.layout)
     {
@@ -221,43 +251,25 @@ room_blueprint::room_blueprint(const room_blueprint & rb) :
     build_cache();
 }
 
-room_blueprint::room_blueprint(const room_blueprint & rb, df::coord offset, const variable_string::context_t & context) :
-    origin(rb.origin + offset),
+room_blueprint::room_blueprint(const std::string & type, const std::string & tmpl_name, const std::string & name) :
+    origin(0, 0, 0),
     tmpl(),
     inst(),
-    type(rb.type),
-    tmpl_name(rb.tmpl_name),
-    name(rb.name),
+    type(type),
+    tmpl_name(tmpl_name),
+    name(name),
     layout(),
     rooms(),
     max_noblesuite(-1),
     corridor(),
     interior(),
     no_room(),
-    no_corridor()
+    no_corridor(),
+    corridor_runs(),
+    interior_runs(),
+    no_room_runs(),
+    no_corridor_runs()
 {
-    for (auto f : rb.layout)
-    {
-        f = new room_base::furniture_t(*f);
-
-        f->context = context;
-
-        layout.push_back(f);
-    }
-
-    for (auto r : rb.rooms)
-    {
-        r = new room_base::room_t(*r);
-
-        r->context = context;
-
-        r->min = r->min + offset;
-        r->max = r->max + offset;
-
-        rooms.push_back(r);
-    }
-
-    build_cache();
 }
 
 room_blueprint::~room_blueprint()
@@ -609,30 +621,30 @@ void room_blueprint::build_cache()
             {
                 if (f->type != layout_type::door)
                 {
-                    interior.insert(r->min + f->pos);
+                    interior.push_back(r->min + f->pos);
                 }
-                no_room.insert(r->min + f->pos);
+                no_room.push_back(r->min + f->pos);
             }
             else if (r->in_corridor || !r->require_walls || r->outdoor)
             {
-                interior.insert(r->min + f->pos);
-                no_room.insert(r->min + f->pos);
+                interior.push_back(r->min + f->pos);
+                no_room.push_back(r->min + f->pos);
             }
             else
             {
                 if (f->type == layout_type::door)
                 {
-                    no_room.insert(r->min + f->pos);
+                    no_room.push_back(r->min + f->pos);
                 }
                 else
                 {
-                    interior.insert(r->min + f->pos);
+                    interior.push_back(r->min + f->pos);
                     for (int16_t dx = -1; dx <= 1; dx++)
                     {
                         for (int16_t dy = -1; dy <= 1; dy++)
                         {
-                            no_corridor.insert(r->min + f->pos + df::coord(dx, dy, 0));
-                            no_room.insert(r->min + f->pos + df::coord(dx, dy, 0));
+                            no_corridor.push_back(r->min + f->pos + df::coord(dx, dy, 0));
+                            no_room.push_back(r->min + f->pos + df::coord(dx, dy, 0));
                         }
                     }
                 }
@@ -641,24 +653,24 @@ void room_blueprint::build_cache()
             {
                 if (!r->exits.count(f->pos + df::coord(0, 0, -1)))
                 {
-                    interior.insert(r->min + f->pos + df::coord(0, 0, -1));
+                    interior.push_back(r->min + f->pos + df::coord(0, 0, -1));
                     for (int16_t dx = -1; dx <= 1; dx++)
                     {
                         for (int16_t dy = -1; dy <= 1; dy++)
                         {
-                            no_room.insert(r->min + f->pos + df::coord(dx, dy, -1));
+                            no_room.push_back(r->min + f->pos + df::coord(dx, dy, -1));
                         }
                     }
                 }
             }
             else if (f->dig == tile_dig_designation::Ramp)
             {
-                interior.insert(r->min + f->pos + df::coord(0, 0, 1));
+                interior.push_back(r->min + f->pos + df::coord(0, 0, 1));
                 for (int16_t dx = -1; dx <= 1; dx++)
                 {
                     for (int16_t dy = -1; dy <= 1; dy++)
                     {
-                        no_room.insert(r->min + f->pos + df::coord(dx, dy, 1));
+                        no_room.push_back(r->min + f->pos + df::coord(dx, dy, 1));
                     }
                 }
             }
@@ -680,35 +692,35 @@ void room_blueprint::build_cache()
                     {
                         if (!r->in_corridor)
                         {
-                            corridor.insert(t);
-                            no_corridor.insert(t);
+                            corridor.push_back(t);
+                            no_corridor.push_back(t);
                         }
                         else
                         {
-                            interior.insert(t);
-                            no_room.insert(t);
+                            interior.push_back(t);
+                            no_room.push_back(t);
                         }
                     }
                     else if (r->in_corridor || !r->require_walls || r->outdoor)
                     {
-                        interior.insert(t);
-                        no_room.insert(t);
+                        interior.push_back(t);
+                        no_room.push_back(t);
                         if (!r->in_corridor)
                         {
-                            no_corridor.insert(t);
+                            no_corridor.push_back(t);
                         }
                     }
                     else
                     {
-                        interior.insert(t);
+                        interior.push_back(t);
                         for (int16_t dx = -1; dx <= 1; dx++)
                         {
                             for (int16_t dy = -1; dy <= 1; dy++)
                             {
                                 if (!r->exits.count(t - r->min + df::coord(dx, dy, 0)))
                                 {
-                                    no_room.insert(t + df::coord(dx, dy, 0));
-                                    no_corridor.insert(t + df::coord(dx, dy, 0));
+                                    no_room.push_back(t + df::coord(dx, dy, 0));
+                                    no_corridor.push_back(t + df::coord(dx, dy, 0));
                                 }
                             }
                         }
@@ -717,12 +729,23 @@ void room_blueprint::build_cache()
             }
         }
     }
+
+    for (auto tiles : { &corridor, &interior, &no_room, &no_corridor })
+    {
+        std::sort(tiles->begin(), tiles->end());
+        tiles->erase(std::unique(tiles->begin(), tiles->end()), tiles->end());
+    }
+
+    build_runs(corridor, corridor_runs);
+    build_runs(interior, interior_runs);
+    build_runs(no_room, no_room_runs);
+    build_runs(no_corridor, no_corridor_runs);
 }
 
 void room_blueprint::write_layout(std::ostream & f)
 {
     df::coord min, max;
-    auto find_minmax = [&](const std::set<df::coord> & coords)
+    auto find_minmax = [&](const std::vector<df::coord> & coords)
     {
         for (df::coord c : coords)
         {
@@ -769,8 +792,8 @@ void room_blueprint::write_layout(std::ostream & f)
             f << " ";
             for (int16_t x = min.x; x <= max.x; x++)
             {
-                f << (corridor.count(df::coord(x, y, z)) ? "c" : " ");
-                f << (no_corridor.count(df::coord(x, y, z)) ? "n" : " ");
+                f << (std::binary_search(corridor.begin(), corridor.end(), df::coord(x, y, z)) ? "c" : " ");
+                f << (std::binary_search(no_corridor.begin(), no_corridor.end(), df::coord(x, y, z)) ? "n" : " ");
                 if (x != max.x)
                 {
                     f << "|";
@@ -779,8 +802,8 @@ void room_blueprint::write_layout(std::ostream & f)
             f << std::endl << " ";
             for (int16_t x = min.x; x <= max.x; x++)
             {
-                f << (interior.count(df::coord(x, y, z)) ? "i" : " ");
-                f << (no_room.count(df::coord(x, y, z)) ? "r" : " ");
+                f << (std::binary_search(interior.begin(), interior.end(), df::coord(x, y, z)) ? "i" : " ");
+                f << (std::binary_search(no_room.begin(), no_room.end(), df::coord(x, y, z)) ? "r" : " ");
                 if (x != max.x)
                 {
                     f << "|";
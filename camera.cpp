@@ -2,6 +2,7 @@
 #include "camera.h"
 #include "hooks.h"
 #include "debug.h"
+#include "unit_index.h"
 
 #include <sstream>
 
@@ -10,16 +11,11 @@
 #include "modules/Screen.h"
 #include "modules/Units.h"
 
-#include "df/activity_event_conflictst.h"
-#include "df/creature_interaction_effect_body_transformationst.h"
-#include "df/creature_raw.h"
 #include "df/graphic.h"
 #include "df/interfacest.h"
 #include "df/job.h"
-#include "df/syndrome.h"
 //#include "df/plotinfo.h"
 #include "df/unit.h"
-#include "df/unit_syndrome.h"
 #include "df/viewscreen_dwarfmodest.h"
 //#include "df/viewscreen_movieplayerst.h"
 #include "df/world.h"
@@ -40,7 +36,8 @@ Camera::Camera(AI & ai) :
     follow_unit(-1),
     follow_item(-1),
     follow_stop(true),
-    movie_started_in_lockstep(false)
+    movie_started_in_lockstep(false),
+    movie()
 {
 }
 
@@ -76,19 +73,14 @@ command_result Camera::onupdate_register(color_ostream &)
 
 void Camera::check_record_status()
 {
-    //if (config.record_movie && gview->supermovie_on == 0)
-    //{
-    //    movie_started_in_lockstep = lockstep_hooked;
-    //    gview->supermovie_on = 1;
-    //    gview->currentblocksize = 0;
-    //    gview->nextfilepos = 0;
-    //    gview->supermovie_pos = 0;
-    //    gview->supermovie_delayrate = 0;
-    //    gview->first_movie_write = 1;
-    //    std::ostringstream filename;
-    //    filename << "data/movies/df-ai-" << std::time(nullptr) << ".cmv";
-    //    gview->movie_file = filename.str();
-    //}
+    // frames are only captured by the lockstep loop.
+    if (config.record_movie && lockstep_hooked && !movie.recording() && !movie.failed())
+    {
+        movie_started_in_lockstep = true;
+        std::ostringstream filename;
+        filename << "data/movies/df-ai-" << std::time(nullptr) << ".cmv";
+        movie.start(filename.str(), gps->dimx, gps->dimy, movie_started_in_lockstep);
+    }
 }
 
 command_result Camera::onupdate_unregister(color_ostream &)
@@ -148,47 +140,14 @@ void Camera::update(color_ostream &)
         df::tile_designation *td = Maps::getTileDesignation(Units::getPosition(u));
         if (u->flags1.bits.inactive || !td || td->bits.hidden)
             continue;
-        df::creature_raw *race = df::creature_raw::find(u->race);
-        if (race &&
-            (race->flags.is_set(creature_raw_flags::HAS_ANY_MEGABEAST) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_SEMIMEGABEAST) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_FEATURE_BEAST) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_TITAN) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_UNIQUE_DEMON) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_DEMON) ||
-                race->flags.is_set(creature_raw_flags::HAS_ANY_NIGHT_CREATURE)))
+        uint16_t flags = unit_index.of(u);
+        if (flags & unit_class::megabeast)
         {
             DFAI_DEBUG(camera, 4, "adding candidate: " << AI::describe_unit(u) << " (primary antagonist)");
             targets0.push_back(u);
         }
-        else if (u->training_level != animal_training_level::Domesticated &&
-            (u->flags1.bits.marauder ||
-            u->flags1.bits.skeleton ||
-            u->flags1.bits.active_invader ||
-            u->flags2.bits.underworld ||
-            u->flags2.bits.visitor_uninvited ||
-            AI::is_in_conflict(u, [](df::activity_event_conflictst *c) -> bool
-            {
-                for (auto s : c->sides)
-                {
-                    for (auto e : s->enemies)
-                    {
-                        if (e->conflict_level > conflict_level::Encounter && e->conflict_level != conflict_level::Training)
-                        {
-                            return true;
-                        }
-                    }
-                }
-                return false;
-            }) ||
-            std::find_if(u->syndromes.active.begin(), u->syndromes.active.end(), [](df::unit_syndrome *us) -> bool
-            {
-                auto & s = df::syndrome::find(us->type)->ce;
-                return std::find_if(s.begin(), s.end(), [](df::creature_interaction_effect *ce) -> bool
-                {
-                    return virtual_cast<df::creature_interaction_effect_body_transformationst>(ce) != nullptr;
-                }) != s.end();
-            }) != u->syndromes.active.end()))
+        else if (!(flags & unit_class::domesticated) &&
+            (flags & (unit_class::hostile | unit_class::fighting | unit_class::transformed)))
         {
             DFAI_DEBUG(camera, 4, "adding candidate: " << AI::describe_unit(u) << " (conflict)");
             targets1.push_back(u);
@@ -198,10 +157,9 @@ void Camera::update(color_ostream &)
     std::random_shuffle(targets0.begin(), targets0.end(), rnd_shuffle);
     std::random_shuffle(targets1.begin(), targets1.end(), rnd_shuffle);
     std::vector<df::unit *> targets2;
-    for (auto it = world->units.active.begin(); it != world->units.active.end(); it++)
+    for (auto u : unit_index.citizen_list())
     {
-        df::unit *u = *it;
-        if (!u->flags1.bits.inactive && Units::isCitizen(u))
+        if (!u->flags1.bits.inactive)
         {
             DFAI_DEBUG(camera, 5, "adding candidate: " << AI::describe_unit(u) << " (citizen)");
             targets2.push_back(u);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "event_manager.h"
+#include "movie_recorder.h"
 
 class AI;
 
@@ -31,4 +32,5 @@ public:
     int32_t follow_item;
     bool follow_stop;
     bool movie_started_in_lockstep;
+    MovieRecorder movie;
 };
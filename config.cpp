@@ -26,7 +26,10 @@ Config::Config() :
     manage_nobles(true),
     cancel_announce(0),
     lockstep(false),
-    allow_pause(true)
+    allow_pause(true),
+    plan_setup_threads(0),
+    plan_task_budget_us(1000),
+    log_rotate_mb(0)
 {
     for (int32_t & opt : embark_options)
     {
@@ -135,6 +138,18 @@ void Config::load(color_ostream & out)
             {
                 allow_pause = v["allow_pause"].asBool();
             }
+            if (v.isMember("plan_setup_threads"))
+            {
+                plan_setup_threads = std::max(int32_t(v["plan_setup_threads"].asInt()), 0);
+            }
+            if (v.isMember("plan_task_budget_us"))
+            {
+                plan_task_budget_us = std::max(int32_t(v["plan_task_budget_us"].asInt()), 0);
+            }
+            if (v.isMember("log_rotate_mb"))
+            {
+                log_rotate_mb = std::max(int32_t(v["log_rotate_mb"].asInt()), 0);
+            }
             if (v.isMember("plan_verbosity"))
             {
                 debug_category_config.blueprint = v["plan_verbosity"].asInt();
@@ -205,6 +220,9 @@ void Config::save(color_ostream & out)
     setComment(v["cancel_announce"], Json::Int(cancel_announce), "// how many job cancellation notices to show. 0: none, 1: some, 2: most, 3: all");
     setComment(v["lockstep"], lockstep, "// true or false: should the AI make Dwarf Fortress think it's running at 100 simulation ticks, 50 graphical frames per second? this option is most useful when recording as lag will not affect animation speeds in the CMV files. the game will not accept input if this is set to true. does not work in TEXT mode.");
     setComment(v["allow_pause"], allow_pause, "// true or false: should df-ai allow the game to be paused?");
+    setComment(v["plan_setup_threads"], Json::Int(plan_setup_threads), "// how many threads to use when laying out a new fortress. 0: one per CPU core, 1: only the main thread");
+    setComment(v["plan_task_budget_us"], Json::Int(plan_task_budget_us), "// microseconds per game tick that the floor plan may spend on its task list. at least one task is checked each tick. 0: one task per tick");
+    setComment(v["log_rotate_mb"], Json::Int(log_rotate_mb), "// megabytes df-ai.log and df-ai-events.json may grow to before they are compressed and started over. 0: never");
 
 #define DFAI_DEBUG_CATEGORY(x) \
     if (!DFAI_IS_RELEASE || debug_category_config.x) \
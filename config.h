@@ -44,6 +44,9 @@ struct Config
     uint8_t cancel_announce;
     volatile bool lockstep;
     bool allow_pause;
+    int32_t plan_setup_threads;
+    int32_t plan_task_budget_us;
+    int32_t log_rotate_mb;
 };
 
 extern Config config;
@@ -39,6 +39,10 @@ extern DebugCategoryConfig debug_category_config;
 #endif
 
 extern BOOST_NOINLINE std::ostream & dfai_debug_log();
+// lines are written as they are finished, so this only flushes the file.
+extern void dfai_debug_log_flush();
+// closes the file at shutdown. Anything logged afterwards is dropped.
+extern void dfai_debug_log_close();
 
 // Get base filename (without directory) as a constexpr so it gets run at compile time. Arguments should be __FILE__, __FILE__.
 static inline constexpr const char *dfai_debug_basename(const char *lastSlash, const char *lastChar) noexcept
@@ -57,6 +61,7 @@ static inline constexpr const char *dfai_debug_basename(const char *lastSlash, c
             dfai_debug_log() << "Assertion failed on " << dfai_debug_basename(filename, filename) << " line " << lineno << ": " << BOOST_STRINGIZE(ok) << std::endl; \
             dfai_debug_log() << message << std::endl; \
             dfai_debug_log() << std::endl; \
+            dfai_debug_log_flush(); \
             DFAI_BREAKPOINT(); \
         } \
     } while (false)
@@ -0,0 +1,106 @@
+#include "designation_batch.h"
+
+#include <algorithm>
+#include <bitset>
+
+bool DesignationBatch::block_t::any() const
+{
+    for (auto row : rows)
+    {
+        if (row)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+DesignationBatch::DesignationBatch() :
+    blocks(),
+    block_index()
+{
+}
+
+DesignationBatch::block_t & DesignationBatch::block_for(df::coord t)
+{
+    df::coord origin(t.x & ~0xf, t.y & ~0xf, t.z);
+    auto it = block_index.find(origin);
+    if (it != block_index.end())
+    {
+        return blocks.at(it->second);
+    }
+
+    block_index[origin] = blocks.size();
+    blocks.emplace_back();
+    block_t & b = blocks.back();
+    b.origin = origin;
+    b.rows.fill(0);
+    b.dig.fill(tile_dig_designation::No);
+    return b;
+}
+
+void DesignationBatch::add(df::coord t, df::tile_dig_designation dig)
+{
+    block_t & b = block_for(t);
+    b.rows[t.x & 0xf] |= uint16_t(1 << (t.y & 0xf));
+    b.dig[(t.x & 0xf) * 16 + (t.y & 0xf)] = dig;
+}
+
+void DesignationBatch::add_box(df::coord min, df::coord max, df::tile_dig_designation dig)
+{
+    for (int16_t z = min.z; z <= max.z; z++)
+    {
+        for (int16_t bx = min.x & ~0xf; bx <= max.x; bx += 16)
+        {
+            for (int16_t by = min.y & ~0xf; by <= max.y; by += 16)
+            {
+                block_t & b = block_for(df::coord(bx, by, z));
+                int16_t x0 = std::max(min.x, bx) & 0xf, x1 = std::min(max.x, int16_t(bx + 15)) & 0xf;
+                int16_t y0 = std::max(min.y, by) & 0xf, y1 = std::min(max.y, int16_t(by + 15)) & 0xf;
+                uint16_t mask = uint16_t(((uint32_t(1) << (y1 - y0 + 1)) - 1) << y0);
+                for (int16_t x = x0; x <= x1; x++)
+                {
+                    b.rows[x] |= mask;
+                    for (int16_t y = y0; y <= y1; y++)
+                    {
+                        b.dig[x * 16 + y] = dig;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DesignationBatch::remove(df::coord t)
+{
+    auto it = block_index.find(df::coord(t.x & ~0xf, t.y & ~0xf, t.z));
+    if (it != block_index.end())
+    {
+        blocks.at(it->second).reset(t.x & 0xf, t.y & 0xf);
+    }
+}
+
+bool DesignationBatch::empty() const
+{
+    for (auto & b : blocks)
+    {
+        if (b.any())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t DesignationBatch::size() const
+{
+    size_t count = 0;
+    for (auto & b : blocks)
+    {
+        for (auto row : b.rows)
+        {
+            count += std::bitset<16>(row).count();
+        }
+    }
+    return count;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "dfhack_shared.h"
+
+#include <array>
+#include <map>
+#include <vector>
+
+#include "df/coord.h"
+#include "df/tile_dig_designation.h"
+
+// A set of map tiles to designate, stored as a 16x16 bitmask per map block
+// (bit y of rows[x]) plus the dig designation for each tile. Adding a box of
+// tiles sets whole rows of bits at a time, and whoever applies the batch can
+// read and write each map_block's tile arrays directly instead of looking
+// the block up again for every tile.
+class DesignationBatch
+{
+public:
+    struct block_t
+    {
+        df::coord origin;
+        std::array<uint16_t, 16> rows;
+        std::array<df::tile_dig_designation, 256> dig;
+
+        inline bool test(int16_t x, int16_t y) const
+        {
+            return (rows[x] >> y) & 1;
+        }
+        inline void reset(int16_t x, int16_t y)
+        {
+            rows[x] &= uint16_t(~(1 << y));
+        }
+        bool any() const;
+    };
+
+private:
+    std::vector<block_t> blocks;
+    std::map<df::coord, size_t> block_index;
+
+    block_t & block_for(df::coord t);
+
+public:
+    DesignationBatch();
+
+    void add(df::coord t, df::tile_dig_designation dig = tile_dig_designation::Default);
+    // every tile with min <= t <= max.
+    void add_box(df::coord min, df::coord max, df::tile_dig_designation dig = tile_dig_designation::Default);
+    void remove(df::coord t);
+    bool empty() const;
+    size_t size() const;
+
+    // calls f(block) for every block with at least one tile, in the order
+    // the blocks were first added to.
+    template<typename F>
+    void each(F f)
+    {
+        for (auto & b : blocks)
+        {
+            if (b.any())
+            {
+                f(b);
+            }
+        }
+    }
+};
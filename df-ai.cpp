@@ -2,8 +2,10 @@
 
 #include "ai.h"
 #include "blueprint.h"
+#include "debug.h"
 #include "event_manager.h"
 #include "hooks.h"
+#include "profiler.h"
 
 #include <fstream>
 
@@ -105,6 +107,14 @@ DFhackCExport command_result plugin_init(color_ostream & out, std::vector<Plugin
         "  Shows information that uniquely identifies this build of df-ai.\n"
         "ai report\n"
         "  Writes a more detailed status report to df-ai-report.log\n"
+        "ai export-plan [filename]\n"
+        "  Writes the current plan in JSON format to df-ai-plan.json or the given file.\n"
+        "ai profile\n"
+        "  Shows how much time each update callback and plan task has taken.\n"
+        "ai profile reset\n"
+        "  Clears the collected timings.\n"
+        "ai profile json [filename]\n"
+        "  Writes the collected timings in JSON format to df-ai-profile.json or the given file.\n"
         "ai enable events\n"
         "  Write events in JSON format to df-ai-events.json\n"
         "ai disable events\n"
@@ -145,6 +155,9 @@ DFhackCExport command_result plugin_shutdown(color_ostream & out)
 
     enabled = false;
     check_enabled(out); // delete the AI if it was enabled.
+    // close the debug log here rather than in a static destructor while the
+    // plugin is unloaded.
+    dfai_debug_log_close();
     return CR_OK;
 }
 
@@ -235,6 +248,38 @@ command_result ai_command(color_ostream & out, std::vector<std::string> & args)
         return blueprints.is_valid ? CR_OK : CR_FAILURE;
     }
 
+    if (!args.empty() && args[0] == "profile")
+    {
+        if (args.size() == 1)
+        {
+            std::ostringstream str;
+            profiler.report(str, false);
+            out << str.str();
+            return CR_OK;
+        }
+        if (args.size() == 2 && args[1] == "reset")
+        {
+            profiler.reset();
+            out << "profile reset" << std::endl;
+            return CR_OK;
+        }
+        if ((args.size() == 2 || args.size() == 3) && args[1] == "json")
+        {
+            std::string filename = args.size() == 3 ? args[2] : "df-ai-profile.json";
+            std::ofstream f(filename, std::ofstream::trunc);
+            profiler.write_json(f);
+            f.close();
+            if (!f)
+            {
+                out.printerr("could not write profile to %s\n", filename.c_str());
+                return CR_FAILURE;
+            }
+            out << "profile written to " << filename << std::endl;
+            return CR_OK;
+        }
+        return CR_WRONG_USAGE;
+    }
+
     if (!check_enabled(out))
     {
         out << "The AI is currently not running. Use enable df-ai to enable the AI." << std::endl;
@@ -262,6 +307,26 @@ command_result ai_command(color_ostream & out, std::vector<std::string> & args)
         out << "report written to df-ai-report.log" << std::endl;
         return CR_OK;
     }
+    if ((args.size() == 1 || args.size() == 2) && args[0] == "export-plan")
+    {
+        if (dwarfAI->is_embarking())
+        {
+            out << "cannot export plan during embark" << std::endl;
+            return CR_OK;
+        }
+
+        std::string filename = args.size() == 2 ? args[1] : "df-ai-plan.json";
+        std::ofstream f(filename, std::ofstream::trunc);
+        dwarfAI->plan.save_json(f);
+        f.close();
+        if (!f)
+        {
+            out.printerr("could not write plan to %s\n", filename.c_str());
+            return CR_FAILURE;
+        }
+        out << "plan written to " << filename << std::endl;
+        return CR_OK;
+    }
     if (args.size() == 1 && args[0] == "abandon")
     {
         if (!Core::getInstance().isWorldLoaded())
@@ -288,7 +353,7 @@ command_result ai_command(color_ostream & out, std::vector<std::string> & args)
 
             if (enable)
             {
-                dwarfAI->eventsJson.open("df-ai-events.json", std::ofstream::out | std::ofstream::app);
+                dwarfAI->eventsJson.open("df-ai-events.json", size_t(config.log_rotate_mb) << 20);
             }
             else
             {
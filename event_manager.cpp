@@ -7,6 +7,9 @@
 #include "embark.h"
 #include "exclusive_callback.h"
 #include "debug.h"
+#include "job_index.h"
+#include "unit_index.h"
+#include "profiler.h"
 
 //#include "df/viewscreen_movieplayerst.h"
 //#include "df/viewscreen_textviewerst.h"
@@ -28,7 +31,10 @@ OnupdateCallback::OnupdateCallback(const std::string & descr, std::function<bool
     minyear(0),
     minyeartick(0),
     description(descr),
-    hasTickLimit(false)
+    hasTickLimit(false),
+    bucket(nullptr),
+    bucket_pos(),
+    profile(&profiler.for_onupdate(descr))
 {
 }
 
@@ -38,35 +44,34 @@ OnupdateCallback::OnupdateCallback(const std::string & descr, std::function<bool
     minyear(*cur_year),
     minyeartick(*cur_year_tick + initdelay),
     description(descr),
-    hasTickLimit(true)
+    hasTickLimit(true),
+    bucket(nullptr),
+    bucket_pos(),
+    profile(&profiler.for_onupdate(descr))
 {
 }
 
 const int32_t yearlen = 12 * 28 * 1200;
 
-bool OnupdateCallback::check_run(color_ostream & out, int32_t year, int32_t yeartick)
+static inline int64_t absolute_tick(int32_t year, int32_t yeartick)
 {
-    if (hasTickLimit)
-    {
-        if (year < minyear || (year == minyear && yeartick < minyeartick))
-        {
-            return false;
-        }
-        minyear = year;
-        minyeartick = yeartick + ticklimit;
-        while (minyeartick > yearlen)
-        {
-            minyear++;
-            minyeartick -= yearlen;
-        }
-    }
+    return int64_t(year) * yearlen + yeartick;
+}
 
-    if (callback(out))
+int64_t OnupdateCallback::due() const
+{
+    return absolute_tick(minyear, minyeartick);
+}
+
+void OnupdateCallback::advance(int32_t year, int32_t yeartick)
+{
+    minyear = year;
+    minyeartick = yeartick + ticklimit;
+    while (minyeartick > yearlen)
     {
-        OnupdateCallback *tmp = this;
-        events.onupdate_unregister(tmp);
+        minyear++;
+        minyeartick -= yearlen;
     }
-    return true;
 }
 
 OnstatechangeCallback::OnstatechangeCallback(const std::string & descr, std::function<bool(color_ostream &, state_change_event)> cb) :
@@ -79,7 +84,11 @@ EventManager::EventManager() :
     exclusive{},
     delay_delete_exclusive{},
     exclusive_queue{},
-    onupdate_list{},
+    onupdate_every_tick{},
+    onupdate_overdue{},
+    onupdate_wheel(onupdate_wheel_size),
+    onupdate_running{},
+    onupdate_cursor(-1),
     onstatechange_list{},
     dfplex_client{}
 {
@@ -110,12 +119,19 @@ void EventManager::clear()
     }
     exclusive_queue.clear();
     DFAI_DEBUG(tick, 1, "clearing event listeners");
-    for (auto it : onupdate_list)
+    onupdate_each([](OnupdateCallback *it)
     {
         DFAI_DEBUG(tick, 1, "clearing onupdate: " << it->description);
         delete it;
+    });
+    onupdate_every_tick.clear();
+    onupdate_overdue.clear();
+    for (auto & slot : onupdate_wheel)
+    {
+        slot.clear();
     }
-    onupdate_list.clear();
+    onupdate_running.clear();
+    onupdate_cursor = -1;
     for (auto it : onstatechange_list)
     {
         DFAI_DEBUG(tick, 1, "clearing onstatechange: " << it->description);
@@ -137,8 +153,7 @@ OnupdateCallback *EventManager::onupdate_register(const std::string & descr, int
 {
     DFAI_DEBUG(tick, 1, "onupdate_register: " << descr << " tick limit " << ticklimit << " initial delay " << initialtickdelay);
     OnupdateCallback *h = new OnupdateCallback(descr, [b](color_ostream & out) -> bool { b(out); return false; }, ticklimit, initialtickdelay);
-    onupdate_list.push_back(h);
-    std::sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+    onupdate_schedule(h);
     return h;
 }
 
@@ -146,8 +161,7 @@ OnupdateCallback *EventManager::onupdate_register_once(const std::string & descr
 {
     DFAI_DEBUG(tick, 1, "onupdate_register_once: " << descr);
     OnupdateCallback *h = new OnupdateCallback(descr, b);
-    onupdate_list.push_back(h);
-    std::sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+    onupdate_schedule(h);
     return h;
 }
 
@@ -155,8 +169,7 @@ OnupdateCallback *EventManager::onupdate_register_once(const std::string & descr
 {
     DFAI_DEBUG(tick, 1, "onupdate_register_once: " << descr << " tick limit " << ticklimit);
     OnupdateCallback *h = new OnupdateCallback(descr, b, ticklimit, ticklimit);
-    onupdate_list.push_back(h);
-    std::sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+    onupdate_schedule(h);
     return h;
 }
 
@@ -164,19 +177,69 @@ OnupdateCallback *EventManager::onupdate_register_once(const std::string & descr
 {
     DFAI_DEBUG(tick, 1, "onupdate_register_once: " << descr << " tick limit " << ticklimit << " initial delay " << initialtickdelay);
     OnupdateCallback *h = new OnupdateCallback(descr, b, ticklimit, initialtickdelay);
-    onupdate_list.push_back(h);
-    std::sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+    onupdate_schedule(h);
     return h;
 }
 
 void EventManager::onupdate_unregister(OnupdateCallback *&b)
 {
     DFAI_DEBUG(tick, 1, "onupdate_unregister: " << b->description);
-    onupdate_list.erase(std::remove(onupdate_list.begin(), onupdate_list.end(), b), onupdate_list.end());
+    if (b->bucket)
+    {
+        b->bucket->erase(b->bucket_pos);
+    }
     delete b;
     b = nullptr;
 }
 
+void EventManager::onupdate_link(std::list<OnupdateCallback *> & list, OnupdateCallback *cb)
+{
+    cb->bucket = &list;
+    cb->bucket_pos = list.insert(list.end(), cb);
+}
+
+void EventManager::onupdate_schedule(OnupdateCallback *cb)
+{
+    if (!cb->hasTickLimit)
+    {
+        onupdate_link(onupdate_every_tick, cb);
+        return;
+    }
+
+    int64_t due = cb->due();
+    if (onupdate_cursor < 0 || due <= onupdate_cursor)
+    {
+        // the wheel has already passed this tick; run on the next update.
+        onupdate_link(onupdate_overdue, cb);
+        return;
+    }
+
+    onupdate_link(onupdate_wheel.at(size_t(due) % onupdate_wheel_size), cb);
+}
+
+void EventManager::onupdate_each(std::function<void(OnupdateCallback *)> fn) const
+{
+    for (auto cb : onupdate_every_tick)
+    {
+        fn(cb);
+    }
+    for (auto cb : onupdate_running)
+    {
+        fn(cb);
+    }
+    for (auto cb : onupdate_overdue)
+    {
+        fn(cb);
+    }
+    for (auto & slot : onupdate_wheel)
+    {
+        for (auto cb : slot)
+        {
+            fn(cb);
+        }
+    }
+}
+
 OnstatechangeCallback *EventManager::onstatechange_register(const std::string & descr, std::function<void(color_ostream &, state_change_event)> b)
 {
     DFAI_DEBUG(tick, 1, "onstatechange_register: " << descr);
@@ -395,6 +458,10 @@ std::string EventManager::status()
 }
 void EventManager::report(std::ostream & out, bool html)
 {
+    std::vector<OnupdateCallback *> onupdate_list;
+    onupdate_each([&onupdate_list](OnupdateCallback *u) { onupdate_list.push_back(u); });
+    std::stable_sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+
     if (html)
     {
         if (onupdate_list.empty() && onstatechange_list.empty())
@@ -538,7 +605,12 @@ void EventManager::onupdate(color_ostream & out, const std::function<void(std::v
 
     if (exclusive)
     {
-        if (exclusive->run(out, send_keys))
+        bool done;
+        {
+            tick_profile_scope timer(profiler.for_exclusive(exclusive->description));
+            done = exclusive->run(out, send_keys);
+        }
+        if (done)
         {
             DFAI_DEBUG(tick, 1, "onupdate: exclusive completed: " << exclusive->description);
             exclusive = nullptr;
@@ -550,21 +622,93 @@ void EventManager::onupdate(color_ostream & out, const std::function<void(std::v
         return;
     }
 
-    // make a copy
-    std::vector<OnupdateCallback *> list{ onupdate_list.cbegin(), onupdate_list.cend() };
+    int64_t now = absolute_tick(*cur_year, *cur_year_tick);
+    if (now < onupdate_cursor)
+    {
+        // time went backwards (a different save was loaded). Everything in the
+        // wheel is due after the old cursor, so it can stay where it is.
+        onupdate_cursor = now;
+    }
 
-    for (auto it = list.begin(); it != list.end(); it++)
+    // every-tick callbacks run first, followed by the timed callbacks that
+    // are due in the order they became due.
+    std::list<OnupdateCallback *> timed;
+    for (auto it = onupdate_overdue.begin(); it != onupdate_overdue.end(); )
     {
-        DFAI_DEBUG(tick, 1, "onupdate: checking: " << (*it)->description);
-        if (!(*it)->check_run(out, *cur_year, *cur_year_tick))
+        auto cur = it++;
+        if ((*cur)->due() <= now)
         {
-            DFAI_DEBUG(tick, 1, "onupdate: stopped iteration at: " << (*it)->description);
-            break;
+            timed.splice(timed.end(), onupdate_overdue, cur);
         }
-        DFAI_DEBUG(tick, 1, "onupdate: called: " << (*it)->description);
     }
+    if (onupdate_cursor >= 0 && onupdate_cursor < now)
+    {
+        int64_t first = onupdate_cursor + 1;
+        int64_t last = std::min(now, onupdate_cursor + int64_t(onupdate_wheel_size));
+        for (int64_t tick = first; tick <= last; tick++)
+        {
+            auto & slot = onupdate_wheel.at(size_t(tick) % onupdate_wheel_size);
+            for (auto it = slot.begin(); it != slot.end(); )
+            {
+                auto cur = it++;
+                if ((*cur)->due() <= now)
+                {
+                    timed.splice(timed.end(), slot, cur);
+                }
+            }
+        }
+    }
+    timed.sort([](const OnupdateCallback *a, const OnupdateCallback *b) -> bool { return a->due() < b->due(); });
+
+    onupdate_running.splice(onupdate_running.end(), onupdate_every_tick);
+    onupdate_running.splice(onupdate_running.end(), timed);
+    for (auto it = onupdate_running.begin(); it != onupdate_running.end(); it++)
+    {
+        (*it)->bucket = &onupdate_running;
+        (*it)->bucket_pos = it;
+    }
+
+    // anything still waiting (registered before the first update, or before
+    // time went backwards) can go in the wheel now that the cursor is known.
+    onupdate_cursor = now;
+    std::list<OnupdateCallback *> pending;
+    pending.swap(onupdate_overdue);
+    for (auto cb : pending)
+    {
+        onupdate_schedule(cb);
+    }
+
+    // the game can't touch the job or unit lists until we return, so the
+    // callbacks can share one job index and one unit table.
+    job_index.begin_frame();
+    unit_index.begin_frame();
+    while (!onupdate_running.empty())
+    {
+        OnupdateCallback *cb = onupdate_running.front();
+        onupdate_running.pop_front();
 
-    std::sort(onupdate_list.begin(), onupdate_list.end(), update_cmp);
+        // reschedule before running so that the callback can unregister
+        // itself (or any other callback) safely.
+        if (cb->hasTickLimit)
+        {
+            cb->advance(*cur_year, *cur_year_tick);
+        }
+        onupdate_schedule(cb);
+
+        DFAI_DEBUG(tick, 1, "onupdate: calling: " << cb->description);
+        bool done;
+        {
+            // the callback may unregister (and delete) itself.
+            tick_profile_scope timer(*cb->profile);
+            done = cb->callback(out);
+        }
+        if (done)
+        {
+            onupdate_unregister(cb);
+        }
+    }
+    job_index.end_frame();
+    unit_index.end_frame();
 }
 void EventManager::onstatechange(color_ostream & out, state_change_event event)
 {
@@ -3,6 +3,7 @@
 #include "dfhack_shared.h"
 
 #include <functional>
+#include <list>
 
 #include "df/interface_key.h"
 
@@ -10,6 +11,8 @@
 struct Client;
 struct ClientUpdateInfo;
 
+struct tick_profile_t;
+
 struct OnupdateCallback
 {
     std::function<bool(color_ostream &)> callback;
@@ -19,10 +22,16 @@ struct OnupdateCallback
     std::string description;
     bool hasTickLimit;
 
+    // the scheduler list this callback is currently linked into.
+    std::list<OnupdateCallback *> *bucket;
+    std::list<OnupdateCallback *>::iterator bucket_pos;
+    tick_profile_t *profile;
+
     OnupdateCallback(const std::string & descr, std::function<bool(color_ostream &)> cb);
     OnupdateCallback(const std::string & descr, std::function<bool(color_ostream &)> cb, int32_t tl, int32_t initdelay = 0);
 
-    bool check_run(color_ostream & out, int32_t year, int32_t yeartick);
+    int64_t due() const;
+    void advance(int32_t year, int32_t yeartick);
 };
 
 struct OnstatechangeCallback
@@ -104,7 +113,19 @@ private:
     std::unique_ptr<ExclusiveCallback> exclusive;
     std::unique_ptr<ExclusiveCallback> delay_delete_exclusive;
     std::list<std::unique_ptr<ExclusiveCallback>> exclusive_queue;
-    std::vector<OnupdateCallback *> onupdate_list;
+    // Callbacks with a tick limit are kept in a hashed timer wheel indexed by
+    // the absolute tick they are next due on, so each update only looks at
+    // the slots for the ticks that have passed since the previous update.
+    static const size_t onupdate_wheel_size = 4096;
+    void onupdate_schedule(OnupdateCallback *cb);
+    void onupdate_link(std::list<OnupdateCallback *> & list, OnupdateCallback *cb);
+    void onupdate_each(std::function<void(OnupdateCallback *)> fn) const;
+
+    std::list<OnupdateCallback *> onupdate_every_tick;
+    std::list<OnupdateCallback *> onupdate_overdue;
+    std::vector<std::list<OnupdateCallback *>> onupdate_wheel;
+    std::list<OnupdateCallback *> onupdate_running;
+    int64_t onupdate_cursor;
     std::vector<OnstatechangeCallback *> onstatechange_list;
     Client *dfplex_client;
 };
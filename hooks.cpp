@@ -17,8 +17,6 @@
 #include "df/renderer.h"
 //#include "df/viewscreen_movieplayerst.h"
 
-#include <zlib.h>
-
 #ifdef _WIN32
 #include <Windows.h>
 #else
@@ -198,224 +196,32 @@ static void lockstep_remove_to_first()
     }
 }
 
-//static constexpr int32_t MOVIEBUFFSIZE = sizeof(df::interfacest::supermoviebuffer) / sizeof(df::interfacest::supermoviebuffer[0]);
-//static constexpr int32_t COMPMOVIEBUFFSIZE = sizeof(df::interfacest::supermoviebuffer_comp) / sizeof(df::interfacest::supermoviebuffer_comp[0]);
-
-static BOOST_NOINLINE bool zlibError(int err, const char* msg)
-{
-    //std::cerr << "zlib error (CMV \"" << gview->movie_file << "\" is probably corrupted): " << msg << ": " << zError(err) << std::endl;
-    return false;
-}
-
-#define CHECK_ERR(err, msg) BOOST_UNLIKELY(((err) != Z_OK) && zlibError(err, msg))
-
-static int32_t lockstep_write_movie_chunk()
-{
-    //int32_t inputsize = gview->supermovie_pos;
-    //if (BOOST_UNLIKELY(inputsize > MOVIEBUFFSIZE))
-    //{
-    //    inputsize = MOVIEBUFFSIZE;
-    //}
-
-    ////DUMP CURRENT BUFFER INTO A COMPRESSION STREAM
-    //z_stream c_stream;
-    //int err;
-
-    //c_stream.zalloc = (alloc_func)0;
-    //c_stream.zfree = (free_func)0;
-    //c_stream.opaque = (voidpf)0;
-
-    //err = deflateInit(&c_stream, Z_BEST_COMPRESSION);
-    //if (CHECK_ERR(err, "deflateInit"))
-    //{
-    //    return 5000001;
-    //}
-
-    //c_stream.next_out = (Bytef*)gview->supermoviebuffer_comp;
-    //c_stream.avail_out = COMPMOVIEBUFFSIZE;
-
-    //c_stream.next_in = (Bytef*)gview->supermoviebuffer;
-    //c_stream.avail_in = inputsize;
-
-    //while (int32_t(c_stream.total_in) != inputsize && c_stream.total_out < COMPMOVIEBUFFSIZE)
-    //{
-    //    //c_stream.avail_in = c_stream.avail_out = 1; // force small buffers
-    //    err = deflate(&c_stream, Z_NO_FLUSH);
-    //    if (CHECK_ERR(err, "deflate"))
-    //    {
-    //        return 5000001;
-    //    }
-    //}
-
-    //// Finish the stream, still forcing small buffers:
-    //for (;;)
-    //{
-    //    err = deflate(&c_stream, Z_FINISH);
-    //    if (err == Z_STREAM_END)
-    //    {
-    //        break;
-    //    }
-    //    if (CHECK_ERR(err, "deflate"))
-    //    {
-    //        return 5000001;
-    //    }
-    //}
-
-    //err = deflateEnd(&c_stream);
-    //if (CHECK_ERR(err, "deflateEnd"))
-    //{
-    //    return 5000001;
-    //}
-
-    int length = 0;
-
-    //if (c_stream.total_out > 0)
-    //{
-    //    if (BOOST_UNLIKELY(gview->first_movie_write))
-    //    {
-    //        //GET RID OF ANY EXISTING MOVIES IF THIS IS THE FIRST TIME THROUGH
-    //        unlink(gview->movie_file.c_str());
-    //    }
-
-    //    //OPEN UP THE MOVIE FILE AND APPEND
-    //    std::ofstream f(gview->movie_file, std::ios::out | std::ios::binary | std::ios::app);
-
-    //    if (BOOST_LIKELY(f.is_open()))
-    //    {
-    //        //WRITE A HEADER
-    //        if (BOOST_UNLIKELY(gview->first_movie_write))
-    //        {
-    //            const int32_t movie_version = 10000;
-    //            f.write((const char *)&movie_version, sizeof(int32_t));
-
-    //            int32_t header[3];
-    //            header[0] = init->display.grid_x;
-    //            header[1] = init->display.grid_y;
-    //            extern std::unique_ptr<AI> dwarfAI;
-    //            if (BOOST_LIKELY(dwarfAI->camera.movie_started_in_lockstep))
-    //            {
-    //                header[1] *= 2;
-    //            }
-    //            header[2] = gview->supermovie_delayrate;
-    //            f.write((const char *)&header, sizeof(header));
-    //        }
-
-    //        //WRITE IT
-    //        uint32_t compsize = c_stream.total_out;
-    //        f.write((const char *)&compsize, sizeof(uint32_t));
-    //        f.write((const char *)gview->supermoviebuffer_comp, c_stream.total_out);
-
-    //        f.seekp(0, std::ios::end);
-    //        length = f.tellp();
-    //    }
-    //    else
-    //    {
-    //        gview->supermovie_on = 0;
-    //    }
-
-    //    gview->first_movie_write = 0;
-    //}
-
-    return length;
-}
-
-static void lockstep_finish_movie()
-{
-    //gview->supermovie_on = 0;
-    //gview->currentblocksize = 0;
-    //gview->nextfilepos = 0;
-    //gview->supermovie_pos = 0;
-    extern std::unique_ptr<AI> dwarfAI;
-    dwarfAI->camera.check_record_status();
-}
-
 static void lockstep_handlemovie(bool flushall)
 {
-    //SAVE A MOVIE FRAME INTO THE CURRENT MOVIE BUFFER
-    //if (gview->supermovie_on == 1)
-    //{
-    //    if (BOOST_UNLIKELY(gview->supermovie_delaystep > 0 && !flushall))
-    //    {
-    //        gview->supermovie_delaystep--;
-    //    }
-    //    else
-    //    {
-    //        if (BOOST_LIKELY(!flushall))
-    //        {
-    //            gview->supermovie_delaystep = gview->supermovie_delayrate;
-    //        }
+    extern std::unique_ptr<AI> dwarfAI;
+    if (BOOST_UNLIKELY(!dwarfAI))
+    {
+        return;
+    }
 
-    //        if (!flushall || gview->supermovie_delaystep == 0)
-    //        {
-    //            extern std::unique_ptr<AI> dwarfAI;
-    //            //SAVING CHARACTERS, THEN COLORS
-    //            short x2, y2;
-    //            for (x2 = 0; x2 < init->display.grid_x; x2++)
-    //            {
-    //                for (y2 = 0; y2 < init->display.grid_y; y2++)
-    //                {
-    //                    gview->supermoviebuffer[gview->supermovie_pos] = gps->screen[x2 * gps->dimy * 4 + y2 * 4 + 0];
-
-    //                    gview->supermovie_pos++;
-    //                }
-    //                if (BOOST_LIKELY(dwarfAI && dwarfAI->camera.movie_started_in_lockstep))
-    //                {
-    //                    for (y2 = 0; y2 < init->display.grid_y; y2++)
-    //                    {
-    //                        gview->supermoviebuffer[gview->supermovie_pos] = x2 < 80 && y2 < 25 ? dwarfAI->lockstep_log_buffer[y2][x2] : ' ';
-
-    //                        gview->supermovie_pos++;
-    //                    }
-    //                }
-    //            }
-    //            char frame_col;
-    //            for (x2 = 0; x2 < init->display.grid_x; x2++)
-    //            {
-    //                for (y2 = 0; y2 < init->display.grid_y; y2++)
-    //                {
-    //                    frame_col = gps->screen[x2 * gps->dimy * 4 + y2 * 4 + 1];
-    //                    frame_col |= (gps->screen[x2 * gps->dimy * 4 + y2 * 4 + 2] << 3);
-    //                    if (gps->screen[x2 * gps->dimy * 4 + y2 * 4 + 3])
-    //                    {
-    //                        frame_col |= 64;
-    //                    }
-    //                    gview->supermoviebuffer[gview->supermovie_pos] = frame_col;
-
-    //                    gview->supermovie_pos++;
-    //                }
-    //                if (BOOST_LIKELY(dwarfAI && dwarfAI->camera.movie_started_in_lockstep))
-    //                {
-    //                    for (y2 = 0; y2 < init->display.grid_y; y2++)
-    //                    {
-    //                        gview->supermoviebuffer[gview->supermovie_pos] = y2 < 25 ? dwarfAI->lockstep_log_color[y2] : 7;
-
-    //                        gview->supermovie_pos++;
-    //                    }
-    //                }
-    //            }
-    //        }
+    Camera & camera = dwarfAI->camera;
+    if (BOOST_UNLIKELY(flushall))
+    {
+        camera.movie.finish(true);
+        return;
+    }
 
-    //        int frame_size = init->display.grid_x * init->display.grid_y * 2;
-    //        extern std::unique_ptr<AI> dwarfAI;
-    //        if (BOOST_LIKELY(dwarfAI->camera.movie_started_in_lockstep))
-    //        {
-    //            frame_size *= 2;
-    //        }
-    //        if (BOOST_UNLIKELY(gview->supermovie_pos + frame_size >= MOVIEBUFFSIZE || flushall || !dwarfAI || !dwarfAI->camera.movie_started_in_lockstep))
-    //        {
-    //            int length = lockstep_write_movie_chunk();
+    if (BOOST_UNLIKELY(camera.movie.full()))
+    {
+        camera.movie.finish();
+    }
+    if (BOOST_UNLIKELY(!camera.movie.recording()))
+    {
+        camera.check_record_status();
+    }
 
-    //            if (length > 5000000 || dwarfAI == nullptr || !dwarfAI->camera.movie_started_in_lockstep)
-    //            {
-    //                lockstep_finish_movie();
-    //            }
-    //            else
-    //            {
-    //                gview->supermovie_pos = 0;
-    //            }
-    //        }
-    //    }
-    //}
+    //SAVE A MOVIE FRAME INTO THE CURRENT MOVIE BUFFER
+    camera.movie.capture(gps->screen, gps->dimx, gps->dimy, dwarfAI->lockstep_log_buffer, dwarfAI->lockstep_log_color);
 }
 
 static bool lockstep_mainloop()
@@ -434,11 +240,8 @@ static bool lockstep_mainloop()
     {
         currentscreen->logic();
 
-        //if (currentscreen->movies_okay())
-        //{
-        //    //HANDLE MOVIES
-        //    lockstep_handlemovie(false);
-        //}
+        //HANDLE MOVIES
+        lockstep_handlemovie(false);
 
         // df-ai: don't process input
         break;
@@ -450,11 +253,8 @@ static bool lockstep_mainloop()
     }
     case interface_breakdown_types::STOPSCREEN:
     {
-        //if (currentscreen->movies_okay())
-        //{
-        //    //HANDLE MOVIES
-        //    lockstep_handlemovie(false);
-        //}
+        //HANDLE MOVIES
+        lockstep_handlemovie(false);
 
         lockstep_removescreen(currentscreen);
 
@@ -462,11 +262,8 @@ static bool lockstep_mainloop()
     }
     case interface_breakdown_types::TOFIRST:
     {
-        //if (currentscreen->movies_okay())
-        //{
-        //    //HANDLE MOVIES
-        //    lockstep_handlemovie(false);
-        //}
+        //HANDLE MOVIES
+        lockstep_handlemovie(false);
 
         lockstep_remove_to_first();
 
@@ -0,0 +1,235 @@
+#include "ai.h"
+#include "item_matcher.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "modules/Materials.h"
+
+#include "df/item.h"
+#include "df/job_item.h"
+//#include "df/plotinfo.h"
+#include "df/world.h"
+
+REQUIRE_GLOBAL(plotinfo);
+REQUIRE_GLOBAL(world);
+
+// the items_other list that holds exactly the items of each type, or IN_PLAY
+// if there is none.
+const static struct items_other_by_type_t
+{
+    std::vector<df::items_other_id> list;
+
+    items_other_by_type_t() :
+        list(size_t(ENUM_LAST_ITEM(item_type) + 1), items_other_id::IN_PLAY)
+    {
+        FOR_ENUM_ITEMS(items_other_id, id)
+        {
+            df::item_type type = ENUM_ATTR(items_other_id, item, id);
+            if (type != item_type::NONE && list.at(size_t(type)) == items_other_id::IN_PLAY)
+            {
+                list.at(size_t(type)) = id;
+            }
+        }
+    }
+
+    df::items_other_id operator[](df::item_type type) const
+    {
+        return type == item_type::NONE ? items_other_id::IN_PLAY : list.at(size_t(type));
+    }
+} items_other_by_type;
+
+namespace
+{
+    struct bucket_t
+    {
+        std::vector<df::item *> items;
+        std::vector<bool> claimed;
+    };
+
+    typedef std::map<std::pair<df::item_type, int16_t>, bucket_t> buckets_t;
+}
+
+ItemMatcher::ItemMatcher() :
+    filters(),
+    shortages()
+{
+}
+
+void ItemMatcher::add(const df::job_item *filter)
+{
+    filters.push_back(filter_t{ filter, filter->item_type, filter->item_subtype, filter->quantity, false, false, ItemTypeInfo(filter->item_type, filter->item_subtype).toString() });
+}
+
+void ItemMatcher::add(df::item_type item_type, const std::string & name, bool fire_safe, bool non_economic, int32_t quantity)
+{
+    filters.push_back(filter_t{ nullptr, item_type, -1, quantity, fire_safe, non_economic, name });
+}
+
+bool ItemMatcher::match(std::vector<df::item *> & items)
+{
+    shortages.clear();
+
+    // one walk over IN_PLAY if any filter needs it, since it holds every
+    // other list. otherwise each type list, which are disjoint.
+    std::set<df::items_other_id> sources;
+    std::vector<bool> wanted(size_t(ENUM_LAST_ITEM(item_type) + 1), false);
+    bool want_any = false;
+    for (auto & f : filters)
+    {
+        sources.insert(items_other_by_type[f.item_type]);
+        if (f.item_type == item_type::NONE)
+        {
+            want_any = true;
+        }
+        else
+        {
+            wanted.at(size_t(f.item_type)) = true;
+        }
+    }
+    if (sources.count(items_other_id::IN_PLAY))
+    {
+        sources.clear();
+        sources.insert(items_other_id::IN_PLAY);
+    }
+
+    buckets_t buckets;
+    for (auto source : sources)
+    {
+        for (auto i : world->items.other[source])
+        {
+            df::item_type type = i->getType();
+            if (!want_any && !wanted.at(size_t(type)))
+            {
+                continue;
+            }
+            if (!Stocks::is_item_free(i))
+            {
+                continue;
+            }
+            buckets[std::make_pair(type, int16_t(i->getSubtype()))].items.push_back(i);
+        }
+    }
+    for (auto & b : buckets)
+    {
+        b.second.claimed.resize(b.second.items.size(), false);
+    }
+
+    auto bucket_range = [&buckets](const filter_t & f) -> std::pair<buckets_t::iterator, buckets_t::iterator>
+    {
+        if (f.item_type == item_type::NONE)
+        {
+            return std::make_pair(buckets.begin(), buckets.end());
+        }
+        if (f.item_subtype == -1)
+        {
+            return std::make_pair(buckets.lower_bound(std::make_pair(f.item_type, std::numeric_limits<int16_t>::min())), buckets.upper_bound(std::make_pair(f.item_type, std::numeric_limits<int16_t>::max())));
+        }
+        auto key = std::make_pair(f.item_type, f.item_subtype);
+        return std::make_pair(buckets.lower_bound(key), buckets.upper_bound(key));
+    };
+
+    std::vector<size_t> order;
+    std::vector<size_t> candidates;
+    for (size_t n = 0; n < filters.size(); n++)
+    {
+        auto range = bucket_range(filters.at(n));
+        size_t count = 0;
+        for (auto it = range.first; it != range.second; it++)
+        {
+            count += it->second.items.size();
+        }
+        order.push_back(n);
+        candidates.push_back(count);
+    }
+    std::stable_sort(order.begin(), order.end(), [&candidates](size_t a, size_t b) -> bool
+    {
+        return candidates.at(a) < candidates.at(b);
+    });
+
+    std::vector<std::vector<df::item *>> chosen(filters.size());
+    for (size_t n : order)
+    {
+        const filter_t & f = filters.at(n);
+        auto range = bucket_range(f);
+        int32_t found = 0;
+        for (auto it = range.first; it != range.second && found < f.quantity; it++)
+        {
+            bucket_t & b = it->second;
+            for (size_t idx = 0; idx < b.items.size() && found < f.quantity; idx++)
+            {
+                if (b.claimed.at(idx))
+                {
+                    continue;
+                }
+
+                df::item *i = b.items.at(idx);
+                if (f.fire_safe && !i->isTemperatureSafe(1))
+                {
+                    continue;
+                }
+                if (f.non_economic && i->getType() == item_type::BOULDER && i->getMaterial() == 0 && plotinfo->economic_stone[i->getMaterialIndex()])
+                {
+                    continue;
+                }
+                if (f.job_item)
+                {
+                    ItemTypeInfo iinfo(i);
+                    MaterialInfo minfo(i);
+                    if (!iinfo.matches(*f.job_item, &minfo, true))
+                    {
+                        continue;
+                    }
+                }
+
+                b.claimed.at(idx) = true;
+                chosen.at(n).push_back(i);
+                found++;
+            }
+        }
+
+        if (found < f.quantity)
+        {
+            shortages.push_back(item_shortage_t{ n, f.item_type, f.item_subtype, f.name, f.quantity, found });
+        }
+    }
+
+    if (!shortages.empty())
+    {
+        std::sort(shortages.begin(), shortages.end(), [](const item_shortage_t & a, const item_shortage_t & b) -> bool
+        {
+            return a.filter < b.filter;
+        });
+        return false;
+    }
+
+    for (auto & c : chosen)
+    {
+        items.insert(items.end(), c.begin(), c.end());
+    }
+    return true;
+}
+
+void ItemMatcher::describe_shortage(std::ostream & out) const
+{
+    bool first = true;
+    for (auto & s : shortages)
+    {
+        if (!first)
+        {
+            out << ", ";
+        }
+        first = false;
+        out << s.name;
+    }
+}
+
+std::vector<df::item_type> ItemMatcher::item_types() const
+{
+    std::vector<df::item_type> types;
+    for (auto & filter : filters)
+    {
+        types.push_back(filter.item_type);
+    }
+    return types;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "dfhack_shared.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "df/item_type.h"
+
+namespace df
+{
+    struct item;
+    struct job_item;
+}
+
+// A filter that matched fewer free items than it asked for.
+struct item_shortage_t
+{
+    size_t filter;
+    df::item_type item_type;
+    int16_t item_subtype;
+    std::string name;
+    int32_t wanted;
+    int32_t found;
+};
+
+// Finds free items for every filter of a building at once. Each match pass
+// buckets the candidate items by (item type, subtype) in a single walk over
+// the item lists, then hands items to the filters with the fewest candidates
+// first so a general filter cannot take the only item a specific one could
+// use. An item is claimed by at most one filter.
+//
+// Filters are not owned by the matcher and must outlive it.
+class ItemMatcher
+{
+    struct filter_t
+    {
+        const df::job_item *job_item;
+        df::item_type item_type;
+        int16_t item_subtype;
+        int32_t quantity;
+        bool fire_safe;
+        bool non_economic;
+        std::string name;
+    };
+
+    std::vector<filter_t> filters;
+    std::vector<item_shortage_t> shortages;
+
+public:
+    ItemMatcher();
+
+    void add(const df::job_item *filter);
+    void add(df::item_type item_type, const std::string & name, bool fire_safe = false, bool non_economic = false, int32_t quantity = 1);
+
+    // on success, appends the chosen items to items, grouped in filter order.
+    // on failure, items is unchanged and shortage() says what was missing.
+    bool match(std::vector<df::item *> & items);
+
+    inline const std::vector<item_shortage_t> & shortage() const
+    {
+        return shortages;
+    }
+    // comma-separated names of the missing items.
+    void describe_shortage(std::ostream & out) const;
+    // the item type of each filter, NONE for filters that take any type.
+    std::vector<df::item_type> item_types() const;
+};
@@ -0,0 +1,119 @@
+#include "ai.h"
+#include "job_index.h"
+
+#include <algorithm>
+
+#include "df/job.h"
+#include "df/job_list_link.h"
+#include "df/world.h"
+
+REQUIRE_GLOBAL(world);
+
+JobIndex job_index;
+
+JobIndex::JobIndex() :
+    valid(false),
+    in_frame(false),
+    by_pos(),
+    by_type(),
+    by_skill(),
+    empty()
+{
+}
+
+void JobIndex::begin_frame()
+{
+    in_frame = true;
+    valid = false;
+}
+
+void JobIndex::end_frame()
+{
+    in_frame = false;
+    valid = false;
+}
+
+void JobIndex::refresh()
+{
+    if (valid)
+    {
+        return;
+    }
+
+    // the vectors keep their capacity, so after the first few updates
+    // rebuilding the index doesn't allocate.
+    by_pos.clear();
+    by_type.resize(size_t(df::enum_traits<df::job_type>::last_item_value + 1));
+    by_skill.resize(size_t(df::enum_traits<df::job_skill>::last_item_value + 1));
+    for (auto & list : by_type)
+    {
+        list.clear();
+    }
+    for (auto & list : by_skill)
+    {
+        list.clear();
+    }
+
+    for (auto link = world->jobs.list.next; link; link = link->next)
+    {
+        df::job *job = link->item;
+        if (job->pos.isValid())
+        {
+            by_pos.push_back(std::make_pair(pos_key(job->pos), job));
+        }
+        if (size_t(job->job_type) < by_type.size())
+        {
+            by_type.at(size_t(job->job_type)).push_back(job);
+        }
+        df::job_skill skill = ENUM_ATTR(job_type, skill, job->job_type);
+        if (size_t(skill) < by_skill.size())
+        {
+            by_skill.at(size_t(skill)).push_back(job);
+        }
+    }
+    std::stable_sort(by_pos.begin(), by_pos.end(), [](const std::pair<uint64_t, df::job *> & a, const std::pair<uint64_t, df::job *> & b) -> bool
+    {
+        return a.first < b.first;
+    });
+
+    valid = in_frame;
+}
+
+JobIndex::jobs_at JobIndex::at(df::coord pos)
+{
+    refresh();
+
+    uint64_t key = pos_key(pos);
+    pos_list::const_iterator first = std::lower_bound(by_pos.cbegin(), by_pos.cend(), key, [](const std::pair<uint64_t, df::job *> & a, uint64_t b) -> bool
+    {
+        return a.first < b;
+    });
+    pos_list::const_iterator last = first;
+    while (last != by_pos.cend() && last->first == key)
+    {
+        ++last;
+    }
+    return jobs_at(first, last);
+}
+
+const std::vector<df::job *> & JobIndex::of_type(df::job_type type)
+{
+    refresh();
+
+    if (size_t(type) >= by_type.size())
+    {
+        return empty;
+    }
+    return by_type.at(size_t(type));
+}
+
+const std::vector<df::job *> & JobIndex::of_skill(df::job_skill skill)
+{
+    refresh();
+
+    if (size_t(skill) >= by_skill.size())
+    {
+        return empty;
+    }
+    return by_skill.at(size_t(skill));
+}
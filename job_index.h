@@ -0,0 +1,83 @@
+#pragma once
+
+#include "dfhack_shared.h"
+
+#include <vector>
+
+#include "df/coord.h"
+#include "df/job_skill.h"
+#include "df/job_type.h"
+
+namespace df
+{
+    struct job;
+}
+
+// The jobs in world->jobs.list, grouped by position, job type, and skill.
+// During an update pass the index is built at most once and then shared by
+// every module; outside of one (console commands, reports) it is rebuilt for
+// each query, since the game may have changed the job list in between.
+//
+// Anything that adds or removes a job during an update pass must call
+// invalidate().
+class JobIndex
+{
+    typedef std::vector<std::pair<uint64_t, df::job *>> pos_list;
+
+    bool valid;
+    bool in_frame;
+    pos_list by_pos;
+    std::vector<std::vector<df::job *>> by_type;
+    std::vector<std::vector<df::job *>> by_skill;
+    std::vector<df::job *> empty;
+
+    static inline uint64_t pos_key(df::coord pos)
+    {
+        return (uint64_t(uint16_t(pos.z)) << 32) | (uint64_t(uint16_t(pos.x)) << 16) | uint64_t(uint16_t(pos.y));
+    }
+
+    void refresh();
+
+public:
+    // the jobs at one position, as a range over the index. like the lists
+    // returned by of_type, it is only good until the index is next rebuilt.
+    class jobs_at
+    {
+    public:
+        class iterator
+        {
+            pos_list::const_iterator it;
+
+        public:
+            explicit iterator(pos_list::const_iterator it) : it(it) {}
+
+            inline df::job *operator*() const { return it->second; }
+            inline iterator & operator++() { ++it; return *this; }
+            inline bool operator==(const iterator & other) const { return it == other.it; }
+            inline bool operator!=(const iterator & other) const { return it != other.it; }
+        };
+
+        jobs_at(pos_list::const_iterator first, pos_list::const_iterator last) : first(first), last(last) {}
+
+        inline iterator begin() const { return iterator(first); }
+        inline iterator end() const { return iterator(last); }
+        inline bool empty() const { return first == last; }
+
+    private:
+        pos_list::const_iterator first;
+        pos_list::const_iterator last;
+    };
+
+    JobIndex();
+
+    void begin_frame();
+    void end_frame();
+    inline void invalidate() { valid = false; }
+
+    // jobs at this exact position (usually zero or one).
+    jobs_at at(df::coord pos);
+    const std::vector<df::job *> & of_type(df::job_type type);
+    const std::vector<df::job *> & of_skill(df::job_skill skill);
+};
+
+extern JobIndex job_index;
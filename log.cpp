@@ -3,6 +3,7 @@
 #include "embark.h"
 #include "plan.h"
 #include "population.h"
+#include "profiler.h"
 
 #include "modules/Gui.h"
 #include "modules/Translation.h"
@@ -286,7 +287,9 @@ void AI::debug(color_ostream & out, const std::string & str)
     }
     if (config.write_log)
     {
-        write_df(logger, ts + " " + str, "\n                 ");
+        std::ostringstream line;
+        write_df(line, ts + " " + str, "\n                 ");
+        logger.write(line.str());
     }
 }
 
@@ -303,7 +306,9 @@ void AI::event(const std::string & name, const Json::Value & payload)
     wrapper["tick"] = Json::Int(*cur_year_tick);
     wrapper["name"] = name;
     wrapper["payload"] = payload;
-    eventsJson << wrapper << std::endl;
+    std::ostringstream line;
+    line << wrapper << "\n";
+    eventsJson.write(line.str());
 }
 
 std::string AI::status()
@@ -356,6 +361,7 @@ std::string AI::report(bool html)
     report_section(str, "Population", pop, html);
     report_section(str, "Stocks", stocks, html);
     report_section(str, "Events", events, html);
+    report_section(str, "Profile", profiler, html);
     return str.str();
 }
 
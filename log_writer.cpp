@@ -0,0 +1,244 @@
+#include "log_writer.h"
+
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+#include <vector>
+
+#include <zlib.h>
+
+constexpr std::chrono::milliseconds AsyncLogWriter::flush_interval;
+
+AsyncLogWriter::AsyncLogWriter() :
+    pending(nullptr),
+    pending_bytes(0),
+    pushed(0),
+    running(false),
+    worker(),
+    mutex(),
+    wake(),
+    drained(),
+    written(0),
+    stopping(false),
+    flush_requested(false),
+    filename(),
+    rotate_bytes(0),
+    rotate_at(0),
+    file()
+{
+}
+
+AsyncLogWriter::AsyncLogWriter(const std::string & filename, size_t rotate_bytes) :
+    AsyncLogWriter()
+{
+    open(filename, rotate_bytes);
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+    close();
+}
+
+void AsyncLogWriter::open(const std::string & filename, size_t rotate_bytes)
+{
+    close();
+
+    file.clear();
+    file.open(filename, std::ios::out | std::ios::app | std::ios::binary);
+    if (!file.is_open())
+    {
+        return;
+    }
+
+    this->filename = filename;
+    this->rotate_bytes = rotate_bytes;
+    rotate_at = rotate_bytes;
+    stopping = false;
+    flush_requested = false;
+    running.store(true, std::memory_order_release);
+    worker = std::thread(&AsyncLogWriter::work, this);
+}
+
+void AsyncLogWriter::close()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running.store(false, std::memory_order_release);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+
+    // write() can no longer push, but it may have pushed after the worker's
+    // last pass.
+    written += write_pending();
+    file.close();
+}
+
+void AsyncLogWriter::write(std::string text)
+{
+    if (!is_open())
+    {
+        return;
+    }
+
+    size_t size = text.size();
+    record_t *record = new record_t{ nullptr, std::move(text) };
+    {
+        // close() checks for leftover records once it holds this lock, so
+        // the push must not race with it.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!is_open())
+        {
+            delete record;
+            return;
+        }
+        record->next = pending.load(std::memory_order_relaxed);
+        while (!pending.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+        pushed.fetch_add(1, std::memory_order_release);
+    }
+
+    if (pending_bytes.fetch_add(size, std::memory_order_relaxed) + size >= batch_bytes)
+    {
+        wake.notify_one();
+    }
+}
+
+void AsyncLogWriter::flush()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+
+    uint64_t target = pushed.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mutex);
+    flush_requested = true;
+    wake.notify_one();
+    drained.wait(lock, [this, target]() -> bool { return written >= target || stopping; });
+}
+
+// writes everything pushed so far, oldest first, and returns how many
+// records that was.
+size_t AsyncLogWriter::write_pending()
+{
+    record_t *list = pending.exchange(nullptr, std::memory_order_acquire);
+
+    // the list is newest first.
+    record_t *ordered = nullptr;
+    while (list)
+    {
+        record_t *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    size_t count = 0;
+    std::string batch;
+    while (ordered)
+    {
+        record_t *next = ordered->next;
+        batch += ordered->text;
+        pending_bytes.fetch_sub(ordered->text.size(), std::memory_order_relaxed);
+        delete ordered;
+        ordered = next;
+        count++;
+    }
+
+    if (count)
+    {
+        file.write(batch.data(), std::streamsize(batch.size()));
+        file.flush();
+
+        if (rotate_bytes && size_t(file.tellp()) >= rotate_at)
+        {
+            rotate();
+        }
+    }
+
+    return count;
+}
+
+void AsyncLogWriter::rotate()
+{
+    file.close();
+
+    // more than one rotation a second gets a counter so nothing is overwritten.
+    std::time_t now = std::time(nullptr);
+    std::ostringstream segment;
+    segment << filename << "." << now << ".gz";
+    for (int n = 1; std::ifstream(segment.str()).good(); n++)
+    {
+        segment.str(std::string());
+        segment << filename << "." << now << "." << n << ".gz";
+    }
+
+    bool compressed = false;
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if (gzFile out = gzopen(segment.str().c_str(), "wb"))
+    {
+        compressed = true;
+        std::vector<char> buf(64 * 1024);
+        while (in.read(buf.data(), std::streamsize(buf.size())) || in.gcount() > 0)
+        {
+            if (gzwrite(out, buf.data(), unsigned(in.gcount())) <= 0)
+            {
+                compressed = false;
+                break;
+            }
+        }
+        if (gzclose(out) != Z_OK)
+        {
+            compressed = false;
+        }
+    }
+    in.close();
+
+    // if compressing failed, keep the old segment rather than lose it, and
+    // don't compress the whole file again on every batch.
+    file.clear();
+    file.open(filename, std::ios::out | (compressed ? std::ios::trunc : std::ios::app) | std::ios::binary);
+    if (compressed)
+    {
+        rotate_at = rotate_bytes;
+    }
+    else
+    {
+        std::remove(segment.str().c_str());
+        rotate_at = size_t(file.tellp()) + rotate_bytes;
+    }
+}
+
+void AsyncLogWriter::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait_for(lock, flush_interval, [this]() -> bool
+        {
+            return stopping || flush_requested || pending_bytes.load(std::memory_order_relaxed) >= batch_bytes;
+        });
+        bool stop = stopping;
+        lock.unlock();
+
+        size_t count = write_pending();
+
+        lock.lock();
+        written += count;
+        flush_requested = false;
+        drained.notify_all();
+
+        if (stop && !pending.load(std::memory_order_acquire))
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Appends preformatted records to a log file from a background thread.
+// write() pushes the record onto a list and returns; the writer thread takes
+// everything pending at once and writes it as one batch, either every
+// flush_interval or as soon as batch_bytes are waiting. The push holds the
+// same lock as close() so no record is left behind after the last batch.
+//
+// With rotate_bytes set, a file that grows past that size is compressed to
+// <filename>.<unix time>.gz and started over. If compressing fails, the file
+// is kept and the next try waits until it has grown by another rotate_bytes.
+//
+// close() and the destructor write everything still pending. flush() waits
+// until everything written so far is on disk, for code that is about to
+// crash on purpose.
+class AsyncLogWriter
+{
+    struct record_t
+    {
+        record_t *next;
+        std::string text;
+    };
+
+    static const size_t batch_bytes = 64 * 1024;
+    static constexpr std::chrono::milliseconds flush_interval = std::chrono::milliseconds(250);
+
+    std::atomic<record_t *> pending;
+    std::atomic<size_t> pending_bytes;
+    std::atomic<uint64_t> pushed;
+    std::atomic<bool> running;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    uint64_t written;
+    bool stopping;
+    bool flush_requested;
+    std::string filename;
+    size_t rotate_bytes;
+    size_t rotate_at;
+    std::ofstream file;
+
+    void work();
+    size_t write_pending();
+    void rotate();
+
+public:
+    AsyncLogWriter();
+    explicit AsyncLogWriter(const std::string & filename, size_t rotate_bytes = 0);
+    AsyncLogWriter(const AsyncLogWriter &) = delete;
+    AsyncLogWriter & operator=(const AsyncLogWriter &) = delete;
+    ~AsyncLogWriter();
+
+    void open(const std::string & filename, size_t rotate_bytes = 0);
+    void close();
+    inline bool is_open() const { return running.load(std::memory_order_acquire); }
+
+    // safe to call from any thread. dropped if the log is not open.
+    void write(std::string text);
+    void flush();
+};
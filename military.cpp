@@ -1,5 +1,6 @@
 #include "ai.h"
 #include "population.h"
+#include "unit_index.h"
 
 #include "df/activity_entry.h"
 #include "df/activity_event_conflictst.h"
@@ -30,7 +31,7 @@ bool AI::tag_enemies(color_ostream & out)
                 for (auto unit_id : kill->units)
                 {
                     auto unit = df::unit::find(unit_id);
-                    if (unit && std::find(world->units.active.begin(), world->units.active.end(), unit) == world->units.active.end())
+                    if (unit && !unit_index.is(unit, unit_class::active))
                     {
                         found = pop.military_cancel_attack_order(out, unit, "unit no longer active on map") || found;
                     }
@@ -132,7 +133,7 @@ df::unit *AI::is_attacking_citizen(df::unit *u)
                 {
                     if (auto enemy = df::unit::find(enemy_id))
                     {
-                        if (Units::isSane(enemy) && Units::isCitizen(enemy))
+                        if (Units::isSane(enemy) && unit_index.is(enemy, unit_class::citizen))
                         {
                             citizen = enemy;
                             return true;
@@ -150,9 +151,9 @@ df::unit *AI::is_attacking_citizen(df::unit *u)
 
 df::unit *AI::is_hunting_target(df::unit *u)
 {
-    for (auto c : world->units.active)
+    for (auto c : unit_index.citizen_list())
     {
-        if (Units::isSane(c) && Units::isCitizen(c) && u->job.current_job && u->job.current_job->job_type == job_type::Hunt && c->job.hunt_target == u)
+        if (Units::isSane(c) && u->job.current_job && u->job.current_job->job_type == job_type::Hunt && c->job.hunt_target == u)
         {
             return c;
         }
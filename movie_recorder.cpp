@@ -0,0 +1,312 @@
+#include "movie_recorder.h"
+
+#include <fstream>
+
+#include <zlib.h>
+
+MovieRecorder::MovieRecorder() :
+    worker(),
+    mutex(),
+    wake(),
+    space(),
+    ring(ring_size),
+    first(0),
+    queued(0),
+    stopping(false),
+    is_recording(false),
+    cols(0),
+    rows(0),
+    side_panel(false),
+    is_full(false),
+    is_failed(false),
+    dropped(0)
+{
+}
+
+MovieRecorder::~MovieRecorder()
+{
+    if (!worker.joinable())
+    {
+        return;
+    }
+
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+// waits for a free slot. only used for opening and closing files, which
+// must not be dropped.
+MovieRecorder::slot_t & MovieRecorder::claim()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    space.wait(lock, [this]() -> bool { return queued < ring.size(); });
+    return ring.at((first + queued) % ring.size());
+}
+
+void MovieRecorder::push()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+void MovieRecorder::start(const std::string & filename, int32_t cols, int32_t rows, bool side_panel)
+{
+    if (!worker.joinable())
+    {
+        worker = std::thread(&MovieRecorder::work, this);
+    }
+    if (recording())
+    {
+        finish();
+    }
+
+    slot_t & slot = claim();
+    slot.kind = slot_open;
+    slot.filename = filename;
+    slot.header[0] = cols;
+    slot.header[1] = side_panel ? rows * 2 : rows;
+    slot.header[2] = 0; // delay rate
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_recording = true;
+        this->cols = cols;
+        this->rows = rows;
+        this->side_panel = side_panel;
+        is_full = false;
+        is_failed = false;
+    }
+    push();
+}
+
+bool MovieRecorder::capture(const uint8_t *screen, int32_t dimx, int32_t dimy, const char (*log)[80], const uint8_t *log_color)
+{
+    slot_t *slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!is_recording)
+        {
+            return false;
+        }
+        if (dimx != cols || dimy != rows)
+        {
+            // a CMV can't change size partway through.
+            is_full = true;
+            return false;
+        }
+        if (queued == ring.size())
+        {
+            dropped++;
+            return false;
+        }
+        // the worker won't look at this slot until push().
+        slot = &ring.at((first + queued) % ring.size());
+    }
+
+    // characters, then colors, column by column. with the side panel, each
+    // column of the screen is followed by the same column of the log.
+    size_t height = size_t(side_panel ? rows * 2 : rows);
+    slot->kind = slot_frame;
+    slot->data.resize(size_t(cols) * height * 2);
+    uint8_t *chars = slot->data.data();
+    uint8_t *colors = chars + size_t(cols) * height;
+    for (int32_t x = 0; x < cols; x++)
+    {
+        for (int32_t y = 0; y < rows; y++)
+        {
+            const uint8_t *tile = screen + (x * dimy + y) * 4;
+            *chars++ = tile[0];
+            *colors++ = uint8_t((tile[1] & 7) | ((tile[2] & 7) << 3) | (tile[3] ? 64 : 0));
+        }
+        if (side_panel)
+        {
+            for (int32_t y = 0; y < rows; y++)
+            {
+                *chars++ = x < 80 && y < 25 ? uint8_t(log[y][x]) : uint8_t(' ');
+                *colors++ = y < 25 ? log_color[y] : 7;
+            }
+        }
+    }
+
+    push();
+    return true;
+}
+
+void MovieRecorder::finish(bool wait)
+{
+    if (!recording())
+    {
+        return;
+    }
+
+    slot_t & slot = claim();
+    slot.kind = slot_close;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_recording = false;
+    }
+    push();
+
+    if (wait)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [this]() -> bool { return queued == 0; });
+    }
+}
+
+void MovieRecorder::work()
+{
+    std::ofstream file;
+    z_stream stream;
+    bool in_chunk = false;
+    size_t chunk_frames = 0;
+    std::vector<uint8_t> compressed;
+
+    auto run_deflate = [&](int flush) -> bool
+    {
+        for (;;)
+        {
+            if (stream.avail_out == 0)
+            {
+                size_t used = compressed.size();
+                compressed.resize(used + 65536);
+                stream.next_out = compressed.data() + used;
+                stream.avail_out = 65536;
+            }
+            int err = deflate(&stream, flush);
+            if (err == Z_STREAM_END)
+            {
+                return true;
+            }
+            if (err != Z_OK && err != Z_BUF_ERROR)
+            {
+                return false;
+            }
+            if (stream.avail_in == 0 && stream.avail_out != 0 && flush == Z_NO_FLUSH)
+            {
+                return true;
+            }
+        }
+    };
+    auto fail = [&]()
+    {
+        if (in_chunk)
+        {
+            deflateEnd(&stream);
+            in_chunk = false;
+        }
+        file.close();
+        is_failed = true;
+        is_full = true;
+    };
+    auto end_chunk = [&]()
+    {
+        if (!in_chunk)
+        {
+            return;
+        }
+        if (!run_deflate(Z_FINISH))
+        {
+            fail();
+            return;
+        }
+        uint32_t size = uint32_t(stream.total_out);
+        deflateEnd(&stream);
+        in_chunk = false;
+        chunk_frames = 0;
+
+        file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char *>(compressed.data()), size);
+        file.flush();
+        if (!file.good())
+        {
+            fail();
+        }
+        else if (int64_t(file.tellp()) > max_file_size)
+        {
+            is_full = true;
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait(lock, [this]() -> bool { return stopping || queued != 0; });
+        if (queued == 0)
+        {
+            return;
+        }
+        slot_t & slot = ring.at(first);
+        lock.unlock();
+
+        switch (slot.kind)
+        {
+        case slot_open:
+            end_chunk();
+            file.close();
+            file.clear();
+            file.open(slot.filename, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (file.is_open())
+            {
+                const int32_t movie_version = 10000;
+                file.write(reinterpret_cast<const char *>(&movie_version), sizeof(movie_version));
+                file.write(reinterpret_cast<const char *>(slot.header), sizeof(slot.header));
+            }
+            else
+            {
+                fail();
+            }
+            break;
+        case slot_frame:
+            if (!file.is_open())
+            {
+                break;
+            }
+            if (!in_chunk)
+            {
+                stream.zalloc = Z_NULL;
+                stream.zfree = Z_NULL;
+                stream.opaque = Z_NULL;
+                // the default window is already the largest zlib allows, so
+                // larger frames are compressed on their own.
+                if (deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK)
+                {
+                    fail();
+                    break;
+                }
+                in_chunk = true;
+                compressed.clear();
+                stream.next_out = Z_NULL;
+                stream.avail_out = 0;
+            }
+            stream.next_in = slot.data.data();
+            stream.avail_in = uInt(slot.data.size());
+            if (!run_deflate(Z_NO_FLUSH))
+            {
+                fail();
+                break;
+            }
+            if (++chunk_frames == frames_per_chunk)
+            {
+                end_chunk();
+            }
+            break;
+        case slot_close:
+            end_chunk();
+            file.close();
+            break;
+        }
+
+        lock.lock();
+        first = (first + 1) % ring.size();
+        queued--;
+        space.notify_all();
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records CMV movies without making the caller wait for zlib or the disk.
+// capture() copies the screen (and optionally the lockstep log panel) into
+// one of a ring of preallocated frame buffers and returns; a worker thread
+// compresses the frames and appends them to the file. If the worker falls
+// behind and the ring is full, frames are dropped rather than blocking.
+//
+// Frames in a chunk are compressed as one deflate stream, so unchanged parts
+// of the screen can be stored as back-references to the previous frame, but
+// only while a frame fits in deflate's 32 KiB window. A frame is two bytes
+// per tile (twice the rows with the side panel), so that stops working past
+// about 16000 tiles, or 8000 with the side panel. Frames are not delta
+// encoded because CMV players expect every frame stored whole.
+class MovieRecorder
+{
+    enum slot_kind
+    {
+        slot_frame,
+        slot_open,
+        slot_close,
+    };
+    struct slot_t
+    {
+        slot_kind kind;
+        std::vector<uint8_t> data;
+        std::string filename;
+        int32_t header[3];
+    };
+
+    static const size_t ring_size = 64;
+    static const size_t frames_per_chunk = 100;
+    static const int64_t max_file_size = 5000000;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable space;
+    std::vector<slot_t> ring;
+    size_t first;
+    size_t queued;
+    bool stopping;
+    bool is_recording;
+    int32_t cols;
+    int32_t rows;
+    bool side_panel;
+    std::atomic<bool> is_full;
+    std::atomic<bool> is_failed;
+    std::atomic<uint64_t> dropped;
+
+    slot_t & claim();
+    void push();
+    void work();
+
+public:
+    MovieRecorder();
+    ~MovieRecorder();
+
+    // side_panel doubles the height of the movie to make room for the
+    // lockstep log below the screen.
+    void start(const std::string & filename, int32_t cols, int32_t rows, bool side_panel);
+    // screen is gps->screen (four bytes per tile, column-major). log and
+    // log_color are only read when recording with a side panel.
+    bool capture(const uint8_t *screen, int32_t dimx, int32_t dimy, const char (*log)[80], const uint8_t *log_color);
+    // queues the end of the movie; with wait, returns once it is written.
+    void finish(bool wait = false);
+
+    inline bool recording()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return is_recording;
+    }
+    // the file has reached its size limit (or the screen was resized), so
+    // it should be finished and a new one started.
+    inline bool full() const { return is_full.load(); }
+    // the last movie could not be written, so there is no point starting
+    // another one.
+    inline bool failed() const { return is_failed.load(); }
+    inline uint64_t dropped_frames() const { return dropped.load(); }
+};
@@ -1,6 +1,8 @@
 #include "ai.h"
 #include "plan.h"
 #include "debug.h"
+#include "designation_batch.h"
+#include "job_index.h"
 #include "plan_setup.h"
 
 #include <VTableInterpose.h>
@@ -39,6 +41,10 @@ Plan::Plan(AI & ai) :
     ai(ai),
     onupdate_handle(nullptr),
     nrdig(),
+    task_count(),
+    current_task(nullptr),
+    task_reason_buf(),
+    task_reason(&task_reason_buf),
     tasks_generic(),
     tasks_furniture(),
     bg_idx_generic(tasks_generic.end()),
@@ -47,8 +53,10 @@ Plan::Plan(AI & ai) :
     priorities(),
     room_category(),
     room_by_z(),
+    room_by_block(),
     cache_nofurnish(),
     fort_entrance(nullptr),
+    journal(),
     map_veins(),
     important_workshops(),
     important_workshops2(),
@@ -112,18 +120,30 @@ command_result Plan::startup(color_ostream & out)
 {
     if (Core::getInstance().isMapLoaded())
     {
-        std::ifstream active_persist("data/save/current/df-ai-plan.dat");
+        std::ifstream active_persist("data/save/current/df-ai-plan.dat", std::ifstream::binary);
         if (active_persist.good())
         {
-            load(active_persist);
+            std::ifstream active_journal("data/save/current/df-ai-plan.journal", std::ifstream::binary);
+            std::string error;
+            if (!load(active_persist, active_journal.good() ? &active_journal : nullptr, error))
+            {
+                ai.debug(out, "[ERROR] could not load df-ai-plan.dat: " + error);
+                return CR_FAILURE;
+            }
             return CR_OK;
         }
     }
 
-    std::ifstream persist(("data/save/" + World::ReadWorldFolder() + "/df-ai-plan.dat").c_str());
+    std::ifstream persist(("data/save/" + World::ReadWorldFolder() + "/df-ai-plan.dat").c_str(), std::ifstream::binary);
     if (persist.good())
     {
-        load(persist);
+        std::ifstream persist_journal(("data/save/" + World::ReadWorldFolder() + "/df-ai-plan.journal").c_str(), std::ifstream::binary);
+        std::string error;
+        if (!load(persist, persist_journal.good() ? &persist_journal : nullptr, error))
+        {
+            ai.debug(out, "[ERROR] could not load df-ai-plan.dat: " + error);
+            return CR_FAILURE;
+        }
         return CR_OK;
     }
 
@@ -168,21 +188,21 @@ uint16_t Maps::getTileWalkable(df::coord t)
     return 0;
 }
 
-void AI::dig_tile(df::coord t, df::tile_dig_designation dig)
+static void dig_block_tile(df::map_block *block, df::coord t, df::tile_dig_designation dig)
 {
-    DFAI_ASSERT_VALID_TILE(t, " (designation: " << enum_item_key(dig) << ")");
-    if (BOOST_UNLIKELY(ENUM_ATTR(tiletype, material, *Maps::getTileType(t)) == tiletype_material::TREE && dig != tile_dig_designation::No))
+    if (BOOST_UNLIKELY(ENUM_ATTR(tiletype, material, block->tiletype[t.x & 0xf][t.y & 0xf]) == tiletype_material::TREE && dig != tile_dig_designation::No))
     {
         dig = tile_dig_designation::Default;
         t = Plan::find_tree_base(t);
+        block = Maps::getTileBlock(t);
     }
 
-    df::tile_designation *des = Maps::getTileDesignation(t);
-    if (dig != tile_dig_designation::No && des->bits.dig == tile_dig_designation::No)
+    df::tile_designation & des = block->designation[t.x & 0xf][t.y & 0xf];
+    if (dig != tile_dig_designation::No && des.bits.dig == tile_dig_designation::No)
     {
-        for (auto job : world->jobs.list)
+        for (auto job : job_index.at(t))
         {
-            if ((ENUM_ATTR(job_type, type, job->job_type) == job_type_class::Digging || ENUM_ATTR(job_type, type, job->job_type) == job_type_class::Gathering) && job->pos == t)
+            if (ENUM_ATTR(job_type, type, job->job_type) == job_type_class::Digging || ENUM_ATTR(job_type, type, job->job_type) == job_type_class::Gathering)
             {
                 // someone already enroute to dig here, avoid 'Inappropriate
                 // dig square' spam
@@ -191,16 +211,50 @@ void AI::dig_tile(df::coord t, df::tile_dig_designation dig)
         }
     }
 
-    des->bits.dig = dig;
-    Maps::getTileOccupancy(t)->bits.dig_marked = 0;
+    des.bits.dig = dig;
+    block->occupancy[t.x & 0xf][t.y & 0xf].bits.dig_marked = 0;
     if (dig != tile_dig_designation::No)
     {
-        auto block = Maps::getTileBlock(t);
         block->flags.bits.designated = true;
         block->dsgn_check_cooldown = 0;
     }
 }
 
+void AI::dig_tile(df::coord t, df::tile_dig_designation dig)
+{
+    DFAI_ASSERT_VALID_TILE(t, " (designation: " << enum_item_key(dig) << ")");
+    dig_block_tile(Maps::getTileBlock(t), t, dig);
+}
+
+void AI::dig_tiles(DesignationBatch & tiles, bool mark)
+{
+    tiles.each([mark](DesignationBatch::block_t & b)
+    {
+        df::map_block *block = Maps::getTileBlock(b.origin);
+        if (!block)
+        {
+            return;
+        }
+
+        for (int16_t x = 0; x < 16; x++)
+        {
+            for (int16_t y = 0; b.rows[x] >> y; y++)
+            {
+                if (!b.test(x, y))
+                {
+                    continue;
+                }
+
+                dig_block_tile(block, b.origin + df::coord(x, y, 0), b.dig[x * 16 + y]);
+                if (mark)
+                {
+                    block->occupancy[x][y].bits.dig_marked = 1;
+                }
+            }
+        }
+    });
+}
+
 // marks all items in room and its access for dumping
 // return true if any item is found
 bool Plan::dump_items_access(color_ostream & out, room *r)
@@ -390,8 +444,7 @@ static int32_t count_tile_bitmask(const df::tile_bitmask & mask)
     return count;
 }
 
-// scan the map, list all map veins in @map_veins (mat_index => [block coords],
-// sorted by z)
+// scan the map, list all map veins in @map_veins (mat_index => [block coords])
 command_result Plan::list_map_veins(color_ostream &)
 {
     map_veins.clear();
@@ -410,7 +463,7 @@ command_result Plan::list_map_veins(color_ostream &)
                 {
                     if (auto vein = virtual_cast<df::block_square_event_mineralst>(event))
                     {
-                        map_veins[vein->inorganic_mat].push_back(std::make_pair(block->map_pos, count_tile_bitmask(vein->tile_bitmask)));
+                        map_veins.add(vein->inorganic_mat, block->map_pos, count_tile_bitmask(vein->tile_bitmask));
                     }
                 }
             }
@@ -435,6 +488,178 @@ static int32_t mat_index_vein(const df::map_block *block, df::coord t)
     return -1;
 }
 
+void vein_index::clear()
+{
+    by_mat.clear();
+}
+
+int32_t vein_index::distance(df::coord block) const
+{
+    // distance from the center of the block.
+    df::coord d = block + df::coord(8, 8, 0) - basis;
+    return d.x * d.x + d.y * d.y + d.z * d.z;
+}
+
+void vein_index::set_count(material_t & m, vein_t & v, int32_t count)
+{
+    m.total += count - v.count;
+    v.count = count;
+}
+
+void vein_index::add(int32_t mat, df::coord block, int32_t count)
+{
+    material_t & m = by_mat[mat];
+    if (m.veins.empty())
+    {
+        m.total = 0;
+    }
+
+    auto it = m.veins.find(block);
+    if (it != m.veins.end())
+    {
+        set_count(m, it->second, it->second.count + count);
+        return;
+    }
+
+    vein_t v;
+    v.count = 0;
+    v.distance = distance(block);
+    set_count(m, v, count);
+    m.veins[block] = v;
+    m.nearest.insert(std::make_pair(v.distance, block));
+}
+
+void vein_index::remove(int32_t mat, df::coord block)
+{
+    auto m = by_mat.find(mat);
+    if (m == by_mat.end())
+    {
+        return;
+    }
+
+    auto it = m->second.veins.find(block);
+    if (it == m->second.veins.end())
+    {
+        return;
+    }
+
+    m->second.total -= it->second.count;
+    m->second.nearest.erase(std::make_pair(it->second.distance, block));
+    m->second.veins.erase(it);
+    if (m->second.veins.empty())
+    {
+        by_mat.erase(m);
+    }
+}
+
+void vein_index::set_basis(df::coord t)
+{
+    basis = t;
+    for (auto & m : by_mat)
+    {
+        m.second.nearest.clear();
+        for (auto & v : m.second.veins)
+        {
+            v.second.distance = distance(v.first);
+            m.second.nearest.insert(std::make_pair(v.second.distance, v.first));
+        }
+    }
+}
+
+int32_t vein_index::total(int32_t mat) const
+{
+    auto m = by_mat.find(mat);
+    if (m == by_mat.end())
+    {
+        return 0;
+    }
+    return m->second.total;
+}
+
+std::vector<int32_t> vein_index::materials() const
+{
+    std::vector<int32_t> mats;
+    for (auto & m : by_mat)
+    {
+        mats.push_back(m.first);
+    }
+    return mats;
+}
+
+bool vein_index::pick(int32_t mat, const std::set<df::coord> & near, df::coord & block)
+{
+    while (has(mat))
+    {
+        material_t & m = by_mat.at(mat);
+
+        // try to find a vein close to one we already dug
+        auto best = m.nearest.end();
+        for (auto & dug : near)
+        {
+            for (int16_t vx = -1; vx <= 1; vx++)
+            {
+                for (int16_t vy = -1; vy <= 1; vy++)
+                {
+                    auto v = m.veins.find(dug + df::coord(16 * vx, 16 * vy, 0));
+                    if (v == m.veins.end())
+                    {
+                        continue;
+                    }
+                    auto it = m.nearest.find(std::make_pair(v->second.distance, v->first));
+                    if (best == m.nearest.end() || *it < *best)
+                    {
+                        best = it;
+                    }
+                }
+            }
+        }
+        if (best == m.nearest.end())
+        {
+            best = m.nearest.begin();
+        }
+
+        df::coord pos = best->second;
+        int32_t count = 0;
+        df::map_block *b = Maps::getTileBlock(pos);
+        if (b)
+        {
+            for (auto event : b->block_events)
+            {
+                auto vein = virtual_cast<df::block_square_event_mineralst>(event);
+                if (!vein || vein->inorganic_mat != mat)
+                {
+                    continue;
+                }
+                for (int16_t x = 0; x < 16; x++)
+                {
+                    for (int16_t y = 0; y < 16; y++)
+                    {
+                        df::tiletype tt = b->tiletype[x][y];
+                        if (vein->getassignment(x, y) &&
+                            ENUM_ATTR(tiletype, material, tt) == tiletype_material::MINERAL &&
+                            ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) == tiletype_shape_basic::Wall)
+                        {
+                            count++;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (count == 0)
+        {
+            // mined out since the map was scanned.
+            remove(mat, pos);
+            continue;
+        }
+
+        set_count(m, m.veins.at(pos), count);
+        block = pos;
+        return true;
+    }
+    return false;
+}
+
 int32_t Plan::can_dig_vein(int32_t mat)
 {
     int32_t count = 0;
@@ -458,13 +683,7 @@ int32_t Plan::can_dig_vein(int32_t mat)
         }
     }
 
-    if (map_veins.count(mat))
-    {
-        for (auto vein : map_veins.at(mat))
-        {
-            count += vein.second;
-        }
-    }
+    count += map_veins.total(mat);
 
     return count / 4;
 }
@@ -528,7 +747,7 @@ int32_t Plan::dig_vein(color_ostream & out, int32_t mat, int32_t want_boulders)
         }
     }
 
-    if (!map_veins.count(mat))
+    if (!map_veins.has(mat))
     {
         return count / 4;
     }
@@ -537,7 +756,6 @@ int32_t Plan::dig_vein(color_ostream & out, int32_t mat, int32_t want_boulders)
     // delete it from map_veins
     // discard tiles that would dig into a plan room/corridor, or into a cavern
     // (hidden + !wall)
-    // try to find a vein close to one we already dug
     for (size_t i = 0; i < 16; i++)
     {
         if (count / 4 >= want_boulders && (want_boulders || i))
@@ -545,43 +763,27 @@ int32_t Plan::dig_vein(color_ostream & out, int32_t mat, int32_t want_boulders)
             break;
         }
 
-        auto & veins = map_veins.at(mat);
-        auto it = std::find_if(veins.begin(), veins.end(), [this](std::pair<df::coord, int32_t> c) -> bool
+        df::coord v;
+        if (!map_veins.pick(mat, dug_veins, v))
         {
-            for (int16_t vx = -1; vx <= 1; vx++)
-            {
-                for (int16_t vy = -1; vy <= 1; vy++)
-                {
-                    if (dug_veins.count(c.first + df::coord(16 * vx, 16 * vy, 0)))
-                    {
-                        return true;
-                    }
-                }
-            }
-            return false;
-        });
-        if (it == veins.end())
-        {
-            it--;
+            break;
         }
 
-        auto v = *it;
         if (want_boulders)
         {
-            map_veins.at(mat).erase(it);
+            map_veins.remove(mat, v);
         }
 
-        int32_t cnt = do_dig_vein(out, mat, v.first, !want_boulders);
+        int32_t cnt = do_dig_vein(out, mat, v, !want_boulders);
         if (cnt > 0 && want_boulders)
         {
-            dug_veins.insert(v.first);
+            dug_veins.insert(v);
         }
 
         count += cnt;
 
-        if (map_veins.at(mat).empty())
+        if (!map_veins.has(mat))
         {
-            map_veins.erase(mat);
             break;
         }
     }
@@ -713,11 +915,13 @@ int32_t Plan::do_dig_vein(color_ostream & out, int32_t mat, df::coord b, bool pl
     }
     if (!plan_only)
     {
+        DesignationBatch tiles;
         for (auto d : todo)
         {
             q.push_back(d);
-            AI::dig_tile(d.first, d.second);
+            tiles.add(d.first, d.second);
         }
+        AI::dig_tiles(tiles);
     }
 
     if (need_shaft)
@@ -1184,9 +1388,16 @@ void Plan::categorize_all()
 
     room_category.clear();
     room_by_z.clear();
+    room_by_block.clear();
+    journal.dirty_order = true;
+    for (auto & priority : priorities)
+    {
+        priority.counted = false;
+    }
     for (auto r : rooms_and_corridors)
     {
         room_category[r->type].push_back(r);
+        room_by_block.add(r);
         for (int32_t z = r->min.z; z <= r->max.z; z++)
         {
             room_by_z[z].insert(r);
@@ -1219,6 +1430,15 @@ void Plan::categorize_all()
     }
 }
 
+void Plan::room_changed(room *r)
+{
+    room_dirty(r);
+    for (auto & priority : priorities)
+    {
+        priority.room_changed(r);
+    }
+}
+
 void Plan::fixup_open(color_ostream & out, room *r)
 {
     if (r->type == room_type::pasture)
@@ -1344,6 +1564,8 @@ void Plan::fixup_open_helper(color_ostream & out, room *r, df::coord t, df::cons
         add_task(task_type::furnish, r, f);
     }
     f->construction = c;
+    room_dirty(r);
+    furniture_dirty(f);
 }
 
 command_result Plan::setup_blueprint(color_ostream &)
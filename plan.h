@@ -5,8 +5,11 @@
 #include "stocks.h"
 #include "plan_priorities.h"
 
+#include <array>
 #include <functional>
 #include <list>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "df/coord.h"
 #include "df/furnace_type.h"
@@ -24,6 +27,77 @@ namespace df
 }
 
 class AI;
+class DesignationBatch;
+
+// What a blocked task is waiting for. Until the condition changes (or
+// task_wait_t::max_ticks pass), the task is skipped without running its
+// handler.
+struct task_wait_t
+{
+    enum kind_t
+    {
+        none,
+        // the free or total count of a stock key changes. the key is
+        // counted on every stock update while a task waits on it.
+        stock,
+        // an item of one of item_types changes (any item if it is empty).
+        items,
+        // a building is finished or removed.
+        building,
+        // a tile is no longer a wall.
+        dig,
+    };
+
+    static const int64_t max_ticks = 1200 * 28;
+
+    kind_t kind;
+    stock_item::item item;
+    std::vector<df::item_type> item_types;
+    uint32_t serial;
+    int32_t bld_id;
+    df::coord pos;
+    int64_t since;
+
+    task_wait_t() :
+        kind(none),
+        item(),
+        item_types(),
+        serial(0),
+        bld_id(-1),
+        pos(),
+        since(0)
+    {
+    }
+};
+
+// Collects what a task handler writes to its reason stream. The buffer is
+// kept from one task to the next, so after the first few tasks evaluating a
+// task doesn't allocate.
+class reason_buffer : public std::streambuf
+{
+    std::string text;
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            text.push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        text.append(s, size_t(n));
+        return n;
+    }
+
+public:
+    reason_buffer() : std::streambuf(), text() {}
+
+    inline void clear() { text.clear(); }
+    inline const std::string & str() const { return text; }
+};
 
 struct task
 {
@@ -32,18 +106,130 @@ struct task
     furniture *f;
     std::string last_status;
     int32_t item_id;
+    // what this task added to Plan::nrdig when it was queued.
+    int32_t dig_queue;
+    size_t dig_weight;
+    task_wait_t wait;
 
     task(task_type::type type, room *r = nullptr, furniture *f = nullptr, int32_t item_id = -1) :
-        type(type), r(r), f(f), last_status(), item_id(item_id)
+        type(type), r(r), f(f), last_status(), item_id(item_id), dig_queue(0), dig_weight(0), wait()
+    {
+    }
+};
+
+// Buckets rooms by the 16x16 map block (per z-level) their tiles, walls, and
+// furniture touch, so point queries only have to look at nearby rooms.
+class room_spatial_index
+{
+    std::unordered_map<uint64_t, std::vector<room *>> cells;
+    size_t count;
+
+public:
+    room_spatial_index() : cells(), count(0) {}
+
+    inline bool empty() const { return count == 0; }
+    void clear();
+    void add(room *r);
+    room *find(df::coord t) const;
+
+private:
+    static inline uint64_t cell_key(int16_t x, int16_t y, int16_t z)
     {
+        return (uint64_t(uint16_t(z)) << 32) | (uint64_t(uint16_t(x >> 4)) << 16) | uint64_t(uint16_t(y >> 4));
     }
+    template<typename F>
+    static void each_cell(const room *r, F f);
+};
+
+// Mineral veins by material. Each vein is one map block's share of a
+// block_square_event_mineralst, and each material keeps its veins ordered by
+// distance from a basis point (the fort entrance or the vein shaft), so the
+// nearest one can be found without scanning the list. Tile counts start out
+// as the size of the vein's bitmask and are recounted from the map when a
+// vein is picked, which drops veins that have since been mined out.
+class vein_index
+{
+    struct vein_t
+    {
+        int32_t count;
+        int32_t distance;
+    };
+    struct material_t
+    {
+        std::map<df::coord, vein_t> veins;
+        std::set<std::pair<int32_t, df::coord>> nearest;
+        int32_t total;
+    };
+
+    std::map<int32_t, material_t> by_mat;
+    df::coord basis;
+
+    int32_t distance(df::coord block) const;
+    void set_count(material_t & m, vein_t & v, int32_t count);
+
+public:
+    vein_index() : by_mat(), basis(0, 0, 0) {}
+
+    void clear();
+    void add(int32_t mat, df::coord block, int32_t count);
+    void remove(int32_t mat, df::coord block);
+    void set_basis(df::coord t);
+
+    inline bool has(int32_t mat) const { return by_mat.count(mat) != 0; }
+    int32_t total(int32_t mat) const;
+    // copied, so callers can dig veins (and remove them) while iterating.
+    std::vector<int32_t> materials() const;
+    // the nearest vein of mat that still has unmined tiles, preferring veins
+    // in or next to one of the blocks in near.
+    bool pick(int32_t mat, const std::set<df::coord> & near, df::coord & block);
+};
+
+// What the last save wrote to df-ai-plan.dat and its journal. Rooms and
+// furniture keep the record slot they were given until the next full
+// snapshot, so a save only has to append the records whose encoding changed.
+// Only the rooms, furniture, and tasks marked dirty since the last save are
+// encoded again.
+struct plan_journal_t
+{
+    bool valid;
+    uint64_t snapshot_id;
+    uint64_t snapshot_size;
+    uint64_t journal_size;
+    uint32_t batches;
+    std::unordered_map<room *, uint32_t> room_slot;
+    std::unordered_map<furniture *, uint32_t> furniture_slot;
+    std::vector<std::string> room_records;
+    std::vector<std::string> furniture_records;
+    std::vector<uint32_t> room_order;
+    std::string tasks;
+    std::string fort;
+    std::string priorities;
+    std::string watch;
+
+    std::unordered_set<room *> dirty_rooms;
+    std::unordered_set<furniture *> dirty_furniture;
+    bool dirty_tasks;
+    // rooms were added, removed, or reordered.
+    bool dirty_order;
+
+    plan_journal_t();
+    void clear();
+    bool needs_compaction() const;
 };
 
 class Plan
 {
     AI & ai;
     OnupdateCallback *onupdate_handle;
+    // dig slots in use per dig queue, and the number of tasks of each type in
+    // both task lists. Kept up to date by task_added and task_removed.
     std::map<int32_t, size_t> nrdig;
+    std::array<size_t, task_type::_task_type_count> task_count;
+    // the task whose handler is running, for wait_for_*. Null while running
+    // handlers that also work on other rooms, see task_can_wait.
+    task *current_task;
+    reason_buffer task_reason_buf;
+    std::ostream task_reason;
     std::list<task *> tasks_generic;
     std::list<task *> tasks_furniture;
     std::list<task *>::iterator bg_idx_generic;
@@ -52,10 +238,12 @@ class Plan
     std::vector<plan_priority_t> priorities;
     std::map<room_type::type, std::vector<room *>> room_category;
     std::map<int32_t, std::set<room *>> room_by_z;
+    room_spatial_index room_by_block;
     std::set<stock_item::item> cache_nofurnish;
     room *fort_entrance;
+    plan_journal_t journal;
 public:
-    std::map<int32_t, std::vector<std::pair<df::coord, int32_t>>> map_veins;
+    vein_index map_veins;
 private:
     std::vector<df::workshop_type> important_workshops;
     std::vector<df::furnace_type> important_workshops2;
@@ -95,8 +283,11 @@ public:
 
     void update(color_ostream & out);
 
+    // binary format, see plan_persist_binary.cpp.
     void save(std::ostream & out);
-    void load(std::istream & in);
+    // debug export; load() also accepts this format.
+    void save_json(std::ostream & out);
+    bool load(std::istream & in, std::istream *journal_in, std::string & error);
 
     task *is_digging();
     bool is_idle();
@@ -162,7 +353,7 @@ public:
     bool dump_items_access(color_ostream & out, room *r);
     void room_items(color_ostream & out, room *r, std::function<void(df::item *)> f);
     bool smooth_xyz(df::coord min, df::coord max, bool engrave = false);
-    bool smooth(std::set<df::coord> tiles, bool engrave = false);
+    bool smooth(DesignationBatch & tiles, bool engrave = false);
     bool is_smooth(df::coord t, bool engrave = false);
 
     bool try_digcistern(color_ostream & out, room *r);
@@ -205,16 +396,49 @@ public:
     void report(std::ostream & out, bool html);
 
     void categorize_all();
+    // call after changing a room's status or furnished flag so that the
+    // priority room counts stay current.
+    void room_changed(room *r);
+    // call after changing anything a save records about a room or piece of
+    // furniture, so the next save journals it.
+    void room_dirty(room *r);
+    void furniture_dirty(furniture *f);
 
     friend class AI;
 
     void weblegends_write_svg(std::ostream & out);
     bool find_building(df::building *bld, room * & r, furniture * & f);
     void add_task(task_type::type type, room* r = nullptr, furniture* f = nullptr, int32_t item_id = -1);
+    // adds the stock keys that parked tasks are waiting on, so that the
+    // stock update counts them even if nothing else watches them.
+    void stock_wait_keys(std::set<stock_item::item> & keys) const;
 
     static df::coord find_tree_base(df::coord t, df::plant **ptree = nullptr);
 
 private:
+    void update_generic_task(color_ostream & out);
+    void update_furniture_task(color_ostream & out);
+    void wait_for_stock(stock_item::item item);
+    void wait_for_items(const std::vector<df::item_type> & item_types);
+    void wait_for_building(int32_t bld_id);
+    void wait_for_dig(df::coord pos);
+    void wait_for_furniture_item(stock_item::item item);
+    bool still_waiting(task & t);
+    void task_added(task *t);
+    void task_removed(task *t);
+    void recount_tasks();
+    void clear_persisted();
+    void load_json(std::istream & in);
+    static bool is_binary_plan(const std::string & data);
+    bool load_binary(const std::string & data, const std::string & journal_data, std::string & error);
+    void write_snapshot(std::ostream & out, plan_journal_t & state);
+    void write_journal_header(std::ostream & out, plan_journal_t & state);
+    void write_journal(std::ostream & out, plan_journal_t & state);
+    void assign_journal_slots(plan_journal_t & state, std::vector<uint32_t> & order);
+    void assign_furniture_slots(plan_journal_t & state, room *r);
+    // call before deleting a room that was in the plan.
+    void journal_room_deleted(room *r);
+
     void fixup_open(color_ostream & out, room *r);
     void fixup_open_tile(color_ostream & out, room *r, df::coord t, df::tile_dig_designation d, furniture *f = nullptr);
     void fixup_open_helper(color_ostream & out, room *r, df::coord t, df::construction_type c, furniture *f, df::tiletype tt);
@@ -1,4 +1,5 @@
 #include "ai.h"
+#include "job_index.h"
 #include "plan.h"
 
 #include "modules/Buildings.h"
@@ -43,6 +44,7 @@ void Plan::new_citizen(color_ostream & out, int32_t uid)
                 else
                 {
                     f->ignore = false;
+                    furniture_dirty(f);
                     required_jail_cells--;
                     if (r->status == room_status::finished)
                     {
@@ -108,6 +110,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
     {
         wantdig(out, r, -3);
         r->users.insert(id);
+        room_dirty(r);
     }
 
     if (room *r = ai.find_room(room_type::farmplot, [](room *r_) -> bool
@@ -119,6 +122,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
     {
         wantdig(out, r, -3);
         r->users.insert(id);
+        room_dirty(r);
     }
 
     if (room *r = ai.find_room(room_type::farmplot, [](room *r_) -> bool
@@ -130,6 +134,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
     {
         wantdig(out, r, -3);
         r->users.insert(id);
+        room_dirty(r);
     }
 
     if (room *r = ai.find_room(room_type::farmplot, [](room *r_) -> bool
@@ -141,6 +146,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
     {
         wantdig(out, r, -3);
         r->users.insert(id);
+        room_dirty(r);
     }
 
     if (room *r = ai.find_room(room_type::dininghall, [](room *r_) -> bool
@@ -162,6 +168,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
             {
                 f->ignore = false;
                 f->users.insert(id);
+                furniture_dirty(f);
                 break;
             }
         }
@@ -172,6 +179,7 @@ void Plan::getdiningroom(color_ostream & out, int32_t id)
             {
                 f->ignore = false;
                 f->users.insert(id);
+                furniture_dirty(f);
                 break;
             }
         }
@@ -188,6 +196,7 @@ void Plan::attribute_noblerooms(color_ostream & out, const std::set<int32_t> & i
     while (room *old = ai.find_room(room_type::nobleroom, [id_list](room *r) -> bool { return r->owner != -1 && !id_list.count(r->owner); }))
     {
         old->required_value = 0;
+        room_dirty(old);
         set_owner(out, old, -1);
     }
 
@@ -210,6 +219,7 @@ void Plan::attribute_noblerooms(color_ostream & out, const std::set<int32_t> & i
                 { \
                     r->required_value = r->required_value > np.position->required_ ## req ? r->required_value : np.position->required_ ## req; \
                 } \
+                room_dirty(r); \
                 wantdig(out, r, -2); \
             }
             DIG_ROOM_IF(tomb, tomb);
@@ -240,6 +250,7 @@ void Plan::getsoldierbarrack(color_ostream & out, int32_t id)
             return;
         }
         r->squad_id = squad_id;
+        room_dirty(r);
         ai.debug(out, stl_sprintf("squad %d assign %s", squad_id, AI::describe_room(r).c_str()));
         wantdig(out, r, -2);
         if (df::building *bld = r->dfbuilding())
@@ -248,13 +259,14 @@ void Plan::getsoldierbarrack(color_ostream & out, int32_t id)
         }
     }
 
-    auto find_furniture = [id, r](layout_type::type type)
+    auto find_furniture = [this, id, r](layout_type::type type)
     {
         for (auto f : r->layout)
         {
             if (f->type == type && f->users.count(id))
             {
                 f->ignore = false;
+                furniture_dirty(f);
                 return;
             }
         }
@@ -264,6 +276,7 @@ void Plan::getsoldierbarrack(color_ostream & out, int32_t id)
             {
                 f->users.insert(id);
                 f->ignore = false;
+                furniture_dirty(f);
                 return;
             }
         }
@@ -325,6 +338,7 @@ void Plan::getcoffin(color_ostream & out)
             {
                 f->users.insert(-1);
                 f->ignore = false;
+                furniture_dirty(f);
                 break;
             }
         }
@@ -352,10 +366,13 @@ void Plan::freebedroom(color_ostream & out, int32_t id)
             if (df::building *bld = df::building::find(f->bld_id))
             {
                 Buildings::deconstruct(bld);
+                job_index.invalidate();
             }
             f->bld_id = -1;
+            furniture_dirty(f);
         }
         r->bld_id = -1;
+        room_dirty(r);
     }
 }
 
@@ -373,9 +390,12 @@ void Plan::freecommonrooms(color_ostream & out, int32_t id, room_type::type subt
 {
     if (subtype == room_type::farmplot)
     {
-        ai.find_room(subtype, [id](room *r) -> bool
+        ai.find_room(subtype, [this, id](room *r) -> bool
         {
-            r->users.erase(id);
+            if (r->users.erase(id))
+            {
+                room_dirty(r);
+            }
             return false;
         });
     }
@@ -390,7 +410,10 @@ void Plan::freecommonrooms(color_ostream & out, int32_t id, room_type::type subt
                     continue;
                 if (f->ignore)
                     continue;
-                if (f->users.erase(id) && f->users.empty() && !past_initial_phase)
+                if (!f->users.erase(id))
+                    continue;
+                furniture_dirty(f);
+                if (f->users.empty() && !past_initial_phase)
                 {
                     // delete the specific table/chair/bed/etc for the dwarf
                     if (f->bld_id != -1 && f->bld_id != r->bld_id)
@@ -398,6 +421,7 @@ void Plan::freecommonrooms(color_ostream & out, int32_t id, room_type::type subt
                         if (df::building *bld = df::building::find(f->bld_id))
                         {
                             Buildings::deconstruct(bld);
+                            job_index.invalidate();
                         }
                         f->bld_id = -1;
                         f->ignore = true;
@@ -409,8 +433,10 @@ void Plan::freecommonrooms(color_ostream & out, int32_t id, room_type::type subt
                         if (df::building *bld = r->dfbuilding())
                         {
                             Buildings::deconstruct(bld);
+                            job_index.invalidate();
                         }
                         r->bld_id = -1;
+                        room_dirty(r);
 
                         if (r->squad_id != -1)
                         {
@@ -443,6 +469,7 @@ df::building *Plan::getpasture(color_ostream & out, int32_t pet_id)
             if (r->low_grass())
             {
                 r->users.erase(pet->id);
+                room_dirty(r);
                 bld = nullptr;
             }
         }
@@ -471,6 +498,7 @@ df::building *Plan::getpasture(color_ostream & out, int32_t pet_id)
     }))
     {
         r->users.insert(pet_id);
+        room_dirty(r);
         if (r->bld_id == -1)
             construct_room(out, r);
         return r->dfbuilding();
@@ -483,6 +511,7 @@ void Plan::freepasture(color_ostream &, int32_t pet_id)
     if (room *r = ai.find_room(room_type::pasture, [pet_id](room *r_) -> bool { return r_->users.count(pet_id); }))
     {
         r->users.erase(pet_id);
+        room_dirty(r);
     }
 }
 
@@ -496,6 +525,7 @@ bool Plan::pastures_ready(color_ostream & out)
         if (r->status == room_status::plan)
         {
             r->queue = -4;
+            room_dirty(r);
             digroom(out, r);
             return true;
         }
@@ -507,6 +537,7 @@ bool Plan::pastures_ready(color_ostream & out)
 void Plan::set_owner(color_ostream &, room *r, int32_t uid)
 {
     r->owner = uid;
+    room_dirty(r);
     if (r->bld_id != -1)
     {
         df::unit *u = df::unit::find(uid);
@@ -535,19 +566,27 @@ void Plan::move_dininghall_fromtemp(color_ostream &, room *r, room *t)
                 {
                     of->ignore = false;
                 }
+                furniture_dirty(of);
                 if (df::building *bld = df::building::find(f->bld_id))
                 {
                     Buildings::deconstruct(bld);
+                    job_index.invalidate();
                 }
                 break;
             }
         }
     }
     rooms_and_corridors.erase(std::remove(rooms_and_corridors.begin(), rooms_and_corridors.end(), t), rooms_and_corridors.end());
+    journal_room_deleted(t);
+    for (auto & priority : priorities)
+    {
+        priority.counted = false;
+    }
     for (auto it = tasks_generic.begin(); it != tasks_generic.end(); )
     {
         if ((*it)->r == t)
         {
+            task_removed(*it);
             delete *it;
             if (bg_idx_generic == it)
             {
@@ -564,6 +603,7 @@ void Plan::move_dininghall_fromtemp(color_ostream &, room *r, room *t)
     {
         if ((*it)->r == t)
         {
+            task_removed(*it);
             delete *it;
             if (bg_idx_furniture == it)
             {
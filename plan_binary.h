@@ -0,0 +1,136 @@
+#pragma once
+
+#include "dfhack_shared.h"
+
+#include "df/coord.h"
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Little-endian encoding shared by df-ai-plan.dat and df-ai-blueprints.cache.
+// Readers never read past the end of their range; a short read clears ok and
+// returns a default value, so callers only need to check ok once at the end
+// of a record.
+
+const static uint32_t plan_binary_none = 0xffffffff;
+
+struct plan_binary_writer
+{
+    std::string data;
+
+    template<typename T>
+    void put(T value)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        U bits = U(value);
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            data.push_back(char(uint8_t(bits >> (8 * i))));
+        }
+    }
+    template<typename E>
+    inline void put_enum(E value)
+    {
+        put<int16_t>(int16_t(value));
+    }
+    inline void put_bool(bool value)
+    {
+        put<uint8_t>(value ? 1 : 0);
+    }
+    inline void put_coord(df::coord c)
+    {
+        put<int16_t>(c.x);
+        put<int16_t>(c.y);
+        put<int16_t>(c.z);
+    }
+    inline void put_string(const std::string & s)
+    {
+        put<uint32_t>(uint32_t(s.size()));
+        data.append(s);
+    }
+};
+
+struct plan_binary_reader
+{
+    const char *pos;
+    const char *end;
+    bool ok;
+
+    plan_binary_reader(const std::string & data, size_t offset, size_t size) :
+        pos(data.data() + offset),
+        end(data.data() + offset + size),
+        ok(true)
+    {
+    }
+
+    template<typename T>
+    T get()
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        if (!ok || size_t(end - pos) < sizeof(T))
+        {
+            ok = false;
+            return T();
+        }
+        U bits = 0;
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            bits = U(bits | (U(uint8_t(pos[i])) << (8 * i)));
+        }
+        pos += sizeof(T);
+        return T(bits);
+    }
+    inline bool get_bool()
+    {
+        return get<uint8_t>() != 0;
+    }
+    inline df::coord get_coord()
+    {
+        int16_t x = get<int16_t>();
+        int16_t y = get<int16_t>();
+        int16_t z = get<int16_t>();
+        return df::coord(x, y, z);
+    }
+    std::string get_string()
+    {
+        uint32_t size = get<uint32_t>();
+        if (!ok || size_t(end - pos) < size)
+        {
+            ok = false;
+            return std::string();
+        }
+        std::string s(pos, size);
+        pos += size;
+        return s;
+    }
+    // number of following entries, each at least min_size bytes. Fails
+    // instead of returning a count that could not fit in the section.
+    uint32_t get_count(size_t min_size)
+    {
+        uint32_t count = get<uint32_t>();
+        if (ok && size_t(end - pos) / min_size < count)
+        {
+            ok = false;
+            return 0;
+        }
+        return count;
+    }
+    template<typename T>
+    bool get_index(const std::vector<T *> & all, T * & ptr)
+    {
+        uint32_t idx = get<uint32_t>();
+        if (idx == plan_binary_none)
+        {
+            ptr = nullptr;
+            return ok;
+        }
+        if (idx >= all.size())
+        {
+            ok = false;
+            return false;
+        }
+        ptr = all.at(idx);
+        return ok;
+    }
+};
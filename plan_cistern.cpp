@@ -1,4 +1,6 @@
 #include "ai.h"
+#include "designation_batch.h"
+#include "job_index.h"
 #include "plan.h"
 
 #include "modules/Items.h"
@@ -43,7 +45,7 @@ void Plan::smooth_cistern(color_ostream & out, room *r)
         smooth_cistern_access(out, it);
     }
 
-    std::set<df::coord> tiles;
+    DesignationBatch tiles;
     for (auto f : r->layout)
     {
         for (int16_t dx = -1; dx <= 1; dx++)
@@ -53,25 +55,19 @@ void Plan::smooth_cistern(color_ostream & out, room *r)
                 df::coord c = r->min + f->pos + df::coord(dx, dy, 0);
                 if (c.x < r->min.x || c.x > r->max.x || c.y < r->min.y || c.y > r->max.y || c.z < r->min.z || c.z > r->max.z)
                 {
-                    tiles.insert(c);
+                    tiles.add(c);
                 }
             }
         }
     }
-    for (int16_t z = r->min.z; z <= r->max.z; z++)
+    // the whole floor, and only the walls above it.
+    tiles.add_box(df::coord(r->min.x - 1, r->min.y - 1, r->min.z), df::coord(r->max.x + 1, r->max.y + 1, r->min.z));
+    if (r->min.z < r->max.z)
     {
-        for (int16_t x = r->min.x - 1; x <= r->max.x + 1; x++)
-        {
-            for (int16_t y = r->min.y - 1; y <= r->max.y + 1; y++)
-            {
-                if (z != r->min.z &&
-                    r->min.x <= x && x <= r->max.x &&
-                    r->min.y <= y && y <= r->max.y)
-                    continue;
-
-                tiles.insert(df::coord(x, y, z));
-            }
-        }
+        tiles.add_box(df::coord(r->min.x - 1, r->min.y - 1, r->min.z + 1), df::coord(r->min.x - 1, r->max.y + 1, r->max.z));
+        tiles.add_box(df::coord(r->max.x + 1, r->min.y - 1, r->min.z + 1), df::coord(r->max.x + 1, r->max.y + 1, r->max.z));
+        tiles.add_box(df::coord(r->min.x, r->min.y - 1, r->min.z + 1), df::coord(r->max.x, r->min.y - 1, r->max.z));
+        tiles.add_box(df::coord(r->min.x, r->max.y + 1, r->min.z + 1), df::coord(r->max.x, r->max.y + 1, r->max.z));
     }
     smooth(tiles);
 }
@@ -84,7 +80,7 @@ void Plan::smooth_cistern_access(color_ostream & out, room *r)
         return;
     }
 
-    std::set<df::coord> tiles;
+    DesignationBatch tiles;
     for (int16_t x = r->min.x - 1; x <= r->max.x + 1; x++)
     {
         for (int16_t y = r->min.y - 1; y <= r->max.y + 1; y++)
@@ -98,7 +94,7 @@ void Plan::smooth_cistern_access(color_ostream & out, room *r)
                         continue;
                     }
                 }
-                tiles.insert(df::coord(x, y, z));
+                tiles.add(df::coord(x, y, z));
             }
         }
     }
@@ -112,7 +108,7 @@ void Plan::smooth_cistern_access(color_ostream & out, room *r)
 // check smoothing progress, channel intermediate floors when done
 bool Plan::try_digcistern(color_ostream & out, room *r)
 {
-    auto dig_channel = [r](df::coord t)
+    auto dig_channel = [this, r](df::coord t)
     {
         if (std::find_if(r->layout.begin(), r->layout.end(), [r, t](furniture *f) -> bool
         {
@@ -124,6 +120,7 @@ bool Plan::try_digcistern(color_ostream & out, room *r)
             f->dig = tile_dig_designation::Channel;
             f->pos = t - r->min;
             r->layout.push_back(f);
+            room_dirty(r);
         }
         AI::dig_tile(t, tile_dig_designation::Channel);
     };
@@ -198,6 +195,7 @@ bool Plan::try_digcistern(color_ostream & out, room *r)
     if (cnt == size.x * size.y * (size.z - 1))
     {
         r->channeled = true;
+        room_dirty(r);
         return true;
     }
     return false;
@@ -257,6 +255,7 @@ void Plan::monitor_cistern(color_ostream & out, std::ostream & reason)
         for (auto l = m_c_reserve->layout.begin(); l != m_c_reserve->layout.end(); l++)
         {
             (*l)->ignore = false;
+            furniture_dirty(*l);
         }
         furnish_room(out, m_c_reserve);
     }
@@ -284,6 +283,7 @@ void Plan::monitor_cistern(color_ostream & out, std::ostream & reason)
         if ((*f)->ignore)
         {
             (*f)->ignore = false;
+            furniture_dirty(*f);
             furnish_entrance = true;
         }
     }
@@ -596,6 +596,7 @@ bool Plan::pull_lever(color_ostream &, furniture *f, std::ostream & reason)
     job->general_refs.push_back(ref);
     bld->jobs.push_back(job);
     Job::linkIntoWorld(job);
+    job_index.invalidate();
 
     reason << "waiting for someone to pull " << AI::describe_furniture(f);
 
@@ -1,6 +1,9 @@
 #include "ai.h"
 #include "plan.h"
 #include "debug.h"
+#include "designation_batch.h"
+#include "item_matcher.h"
+#include "job_index.h"
 
 #include "modules/Buildings.h"
 #include "modules/Job.h"
@@ -56,80 +59,6 @@ static bool find_item(df::items_other_id idx, df::item *&item, bool fire_safe =
     return false;
 }
 
-static bool find_items(df::items_other_id idx, std::vector<df::item *> & items, size_t n, bool fire_safe = false, bool non_economic = false)
-{
-    size_t j = 0;
-    for (auto it = world->items.other[idx].begin(); it != world->items.other[idx].end(); it++)
-    {
-        df::item *i = *it;
-        if (Stocks::is_item_free(i) &&
-            (!fire_safe || i->isTemperatureSafe(1)) &&
-            (!non_economic || virtual_cast<df::item_boulderst>(i)->mat_type != 0 || !plotinfo->economic_stone[virtual_cast<df::item_boulderst>(i)->mat_index]))
-        {
-            items.push_back(i);
-            j++;
-            if (j == n)
-                return true;
-        }
-    }
-    return false;
-}
-
-// Not perfect, but it should at least cut down on cancellation spam.
-static bool find_items(const std::vector<df::job_item *> & filters, std::vector<df::item *> & items, std::ostream & reason)
-{
-    bool found_all = true;
-
-    for (auto filter : filters)
-    {
-        int32_t found = 0;
-
-        for (auto i : world->items.other[items_other_id::IN_PLAY])
-        {
-            if (std::find(items.begin(), items.end(), i) != items.end())
-            {
-                continue;
-            }
-
-            ItemTypeInfo iinfo(i);
-            MaterialInfo minfo(i);
-            if (!iinfo.matches(*filter, &minfo, true) || (filter->item_type != item_type::NONE && i->getType() != filter->item_type))
-            {
-                continue;
-            }
-
-            if (!Stocks::is_item_free(i))
-            {
-                continue;
-            }
-
-            items.push_back(i);
-            found++;
-
-            if (filter->quantity <= found)
-            {
-                break;
-            }
-        }
-
-        if (filter->quantity > found)
-        {
-            if (found_all)
-            {
-                reason << "could not find ";
-                found_all = false;
-            }
-            else
-            {
-                reason << " or ";
-            }
-
-            reason << ItemTypeInfo(filter->item_type, filter->item_subtype).toString();
-        }
-    }
-    return found_all;
-}
-
 template<typename T>
 static df::job_item *make_job_item(T *t)
 {
@@ -216,8 +145,7 @@ bool Plan::construct_room(color_ostream & out, room *r)
     if (r->type == room_type::infirmary || r->type == room_type::pasture || r->type == room_type::pitcage || r->type == room_type::pond || r->type == room_type::location || r->type == room_type::garbagedump)
     {
         furnish_room(out, r);
-        std::ostringstream discard;
-        if (try_construct_activityzone(out, r, discard))
+        if (try_construct_activityzone(out, r, null_reason()))
             return true;
         add_task(task_type::construct_activityzone, r);
         return true;
@@ -246,6 +174,7 @@ bool Plan::furnish_room(color_ostream &, room *r)
         add_task(task_type::furnish, r, f);
     }
     r->status = room_status::finished;
+    room_changed(r);
     return true;
 }
 
@@ -260,6 +189,20 @@ const static struct traptypes
     }
 } traptypes;
 
+// a free item may exist that find_free_item doesn't accept, in which case
+// the count won't change when one that it does accept shows up.
+void Plan::wait_for_furniture_item(stock_item::item item)
+{
+    if (ai.stocks.count_free[item] > 0)
+    {
+        wait_for_items({ Stocks::item_type_of(ai.stocks.find_item_helper(item).oidx) });
+    }
+    else
+    {
+        wait_for_stock(item);
+    }
+}
+
 bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream & reason)
 {
     if (f->bld_id != -1)
@@ -286,6 +229,7 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
 
     if (ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) == tiletype_shape_basic::Wall)
     {
+        wait_for_dig(tgtile);
         reason << "waiting for wall to be excavated";
         return false;
     }
@@ -325,6 +269,7 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
         if (ai.stocks.count_free[stock_item::cage] < 1)
         {
             // avoid too much spam
+            wait_for_stock(stock_item::cage);
             reason << "no empty cages available";
             return false;
         }
@@ -365,8 +310,8 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
         // because we can't smooth a floor under an open floodgate.
         if (!is_smooth(tgtile))
         {
-            std::set<df::coord> tiles;
-            tiles.insert(tgtile);
+            DesignationBatch tiles;
+            tiles.add(tgtile);
             smooth(tiles);
             reason << "floor under floodgate is not smooth";
             return false;
@@ -443,6 +388,7 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
 
     if (cache_nofurnish.count(stocks_furniture_type))
     {
+        wait_for_furniture_item(stocks_furniture_type);
         reason << "no " << stocks_furniture_type << " available";
         return false;
     }
@@ -470,13 +416,10 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
 
     if (f->type == layout_type::cage_trap)
     {
-        for (auto t : tasks_generic)
+        if (task_count.at(task_type::rescue_caged) != 0)
         {
-            if (t->type == task_type::rescue_caged)
-            {
-                reason << "reserving mechanisms for rescue_caged task";
-                return false;
-            }
+            reason << "reserving mechanisms for rescue_caged task";
+            return false;
         }
         for (auto t : tasks_furniture)
         {
@@ -537,72 +480,46 @@ bool Plan::try_furnish(color_ostream & out, room *r, furniture *f, std::ostream
         std::vector<df::item *> item;
         item.push_back(itm);
         Buildings::constructWithItems(bld, item);
+        job_index.invalidate();
         if (f->makeroom)
         {
             r->bld_id = bld->id;
+            room_dirty(r);
         }
         f->bld_id = bld->id;
+        furniture_dirty(f);
         add_task(task_type::check_furnish, r, f);
         return true;
     }
 
     cache_nofurnish.insert(stocks_furniture_type);
+    wait_for_furniture_item(stocks_furniture_type);
     reason << "no " << stocks_furniture_type << " available";
     return false;
 }
 
 bool Plan::try_furnish_well(color_ostream &, room *r, furniture *f, df::coord t, std::ostream & reason)
 {
-    df::item *block = nullptr;
-    df::item *mecha = nullptr;
-    df::item *buckt = nullptr;
-    df::item *chain = nullptr;
-    if (find_item(items_other_id::BLOCKS, block) &&
-        find_item(items_other_id::TRAPPARTS, mecha) &&
-        find_item(items_other_id::BUCKET, buckt) &&
-        find_item(items_other_id::CHAIN, chain))
+    ItemMatcher matcher;
+    matcher.add(item_type::BLOCKS, "block");
+    matcher.add(item_type::TRAPPARTS, "mechanisms");
+    matcher.add(item_type::BUCKET, "bucket");
+    matcher.add(item_type::CHAIN, "rope/chain");
+    std::vector<df::item *> items;
+    if (matcher.match(items))
     {
         df::building *bld = Buildings::allocInstance(t, building_type::Well);
         Buildings::setSize(bld, df::coord(1, 1, 1));
-        std::vector<df::item *> items;
-        items.push_back(block);
-        items.push_back(mecha);
-        items.push_back(buckt);
-        items.push_back(chain);
         Buildings::constructWithItems(bld, items);
+        job_index.invalidate();
         f->bld_id = bld->id;
+        furniture_dirty(f);
         add_task(task_type::check_furnish, r, f);
         return true;
     }
+    wait_for_items(matcher.item_types());
     reason << "missing: ";
-    if (!block)
-    {
-        reason << "block";
-    }
-    if (!mecha)
-    {
-        if (!block)
-        {
-            reason << ", ";
-        }
-        reason << "mechanisms";
-    }
-    if (!buckt)
-    {
-        if (!block || !mecha)
-        {
-            reason << ", ";
-        }
-        reason << "bucket";
-    }
-    if (!chain)
-    {
-        if (!block || !mecha || !buckt)
-        {
-            reason << ", ";
-        }
-        reason << "rope/chain";
-    }
+    matcher.describe_shortage(reason);
     return false;
 }
 
@@ -611,6 +528,7 @@ bool Plan::try_furnish_archerytarget(color_ostream &, room *r, furniture *f, df:
     df::item *bould = nullptr;
     if (!find_item(items_other_id::BOULDER, bould, false, true))
     {
+        wait_for_items({ item_type::BOULDER });
         reason << "no boulder available";
         return false;
     }
@@ -621,7 +539,9 @@ bool Plan::try_furnish_archerytarget(color_ostream &, room *r, furniture *f, df:
     std::vector<df::item *> item;
     item.push_back(bould);
     Buildings::constructWithItems(bld, item);
+    job_index.invalidate();
     f->bld_id = bld->id;
+    furniture_dirty(f);
     add_task(task_type::check_furnish, r, f);
     return true;
 }
@@ -835,11 +755,13 @@ bool Plan::try_furnish_construction(color_ostream &, df::construction_type ctype
         if (ai.find_room(room_type::workshop, [](room *r) -> bool { return r->workshop_type == workshop_type::Masons && r->status == room_status::finished && r->dfbuilding() != nullptr; }) != nullptr)
         {
             // we don't have blocks but we can make them.
+            wait_for_items({ item_type::BLOCKS });
             reason << "waiting for blocks to become available";
             return false;
         }
         if (!find_item(items_other_id::BOULDER, mat, false, true))
         {
+            wait_for_items({ item_type::BLOCKS, item_type::BOULDER });
             reason << "no building materials available";
             return false;
         }
@@ -850,6 +772,7 @@ bool Plan::try_furnish_construction(color_ostream &, df::construction_type ctype
     std::vector<df::item *> item;
     item.push_back(mat);
     Buildings::constructWithItems(bld, item);
+    job_index.invalidate();
     return true;
 }
 
@@ -863,50 +786,54 @@ bool Plan::try_construct_windmill(color_ostream &, room *r, std::ostream & reaso
         return false;
     }
 
+    ItemMatcher matcher;
+    matcher.add(item_type::WOOD, "logs", false, false, 4);
     std::vector<df::item *> mat;
-    if (!find_items(items_other_id::WOOD, mat, 4))
+    if (!matcher.match(mat))
     {
-        reason << "have " << mat.size() << "/4 logs";
+        wait_for_items(matcher.item_types());
+        reason << "have " << matcher.shortage().front().found << "/4 logs";
         return false;
     }
 
     df::building *bld = Buildings::allocInstance(t - df::coord(1, 1, 0), building_type::Windmill);
     Buildings::setSize(bld, df::coord(3, 3, 1));
     Buildings::constructWithItems(bld, mat);
+    job_index.invalidate();
     r->bld_id = bld->id;
+    room_dirty(r);
     add_task(task_type::check_construct, r);
     return true;
 }
 
 bool Plan::try_furnish_roller(color_ostream &, room *r, furniture *f, df::coord t, std::ostream & reason)
 {
-    df::item *mecha = nullptr;
-    df::item *chain = nullptr;
-    if (find_item(items_other_id::TRAPPARTS, mecha) &&
-        find_item(items_other_id::CHAIN, chain))
+    ItemMatcher matcher;
+    matcher.add(item_type::TRAPPARTS, "mechanisms");
+    matcher.add(item_type::CHAIN, "rope or chain");
+    std::vector<df::item *> items;
+    if (matcher.match(items))
     {
         df::building *bld = Buildings::allocInstance(t, building_type::Rollers);
         Buildings::setSize(bld, df::coord(1, 1, 1));
-        std::vector<df::item *> items;
-        items.push_back(mecha);
-        items.push_back(chain);
         Buildings::constructWithItems(bld, items);
+        job_index.invalidate();
         r->bld_id = bld->id;
+        room_dirty(r);
         f->bld_id = bld->id;
+        furniture_dirty(f);
         add_task(task_type::check_furnish, r, f);
         return true;
     }
-    if (mecha)
+    wait_for_items(matcher.item_types());
+    reason << "need ";
+    for (auto & shortage : matcher.shortage())
     {
-        reason << "need rope or chain";
-    }
-    else if (chain)
-    {
-        reason << "need mechanisms";
-    }
-    else
-    {
-        reason << "need mechanisms and rope or chain";
+        if (shortage.filter != matcher.shortage().front().filter)
+        {
+            reason << " and ";
+        }
+        reason << shortage.name;
     }
     return false;
 }
@@ -929,17 +856,22 @@ static void init_managed_workshop(color_ostream &, room *, df::building *bld)
 
 bool Plan::try_construct_tradedepot(color_ostream &, room *r, std::ostream & reason)
 {
+    ItemMatcher matcher;
+    matcher.add(item_type::BLOCKS, "blocks", false, false, 3);
     std::vector<df::item *> blocks;
-    if (find_items(items_other_id::BLOCKS, blocks, 3))
+    if (matcher.match(blocks))
     {
         df::building *bld = Buildings::allocInstance(r->min, building_type::TradeDepot);
         Buildings::setSize(bld, r->size());
         Buildings::constructWithItems(bld, blocks);
+        job_index.invalidate();
         r->bld_id = bld->id;
+        room_dirty(r);
         add_task(task_type::check_construct, r);
         return true;
     }
-    reason << "have " << blocks.size() << "/3 blocks";
+    wait_for_items(matcher.item_types());
+    reason << "have " << matcher.shortage().front().found << "/3 blocks";
     return false;
 }
 
@@ -948,119 +880,41 @@ bool Plan::try_construct_workshop(color_ostream & out, room *r, std::ostream & r
     if (!r->constructions_done(reason))
         return false;
 
-    if (r->workshop_type == workshop_type::Dyers)
+    if (r->workshop_type == workshop_type::Dyers ||
+        r->workshop_type == workshop_type::Ashery ||
+        r->workshop_type == workshop_type::MetalsmithsForge)
     {
-        df::item *barrel = nullptr, *bucket = nullptr;
-        if (find_item(items_other_id::BARREL, barrel) &&
-            find_item(items_other_id::BUCKET, bucket))
-        {
-            df::building *bld = Buildings::allocInstance(r->min, building_type::Workshop, workshop_type::Dyers);
-            Buildings::setSize(bld, r->size());
-            std::vector<df::item *> items;
-            items.push_back(barrel);
-            items.push_back(bucket);
-            Buildings::constructWithItems(bld, items);
-            r->bld_id = bld->id;
-            init_managed_workshop(out, r, bld);
-            add_task(task_type::check_construct, r);
-            return true;
-        }
-        reason << "could not find ";
-        if (!barrel)
+        ItemMatcher matcher;
+        if (r->workshop_type == workshop_type::Ashery)
         {
-            reason << "barrel";
+            matcher.add(item_type::BLOCKS, "blocks");
         }
-        if (!bucket)
+        if (r->workshop_type == workshop_type::MetalsmithsForge)
         {
-            if (!barrel)
-            {
-                reason << " or ";
-            }
-            reason << "bucket";
+            matcher.add(item_type::ANVIL, "anvil", true);
+            matcher.add(item_type::BOULDER, "fire-safe boulder", true, true);
         }
-    }
-    else if (r->workshop_type == workshop_type::Ashery)
-    {
-        df::item *block = nullptr, *barrel = nullptr, *bucket = nullptr;
-        if (find_item(items_other_id::BLOCKS, block) &&
-            find_item(items_other_id::BARREL, barrel) &&
-            find_item(items_other_id::BUCKET, bucket))
-        {
-            df::building *bld = Buildings::allocInstance(r->min, building_type::Workshop, workshop_type::Ashery);
-            Buildings::setSize(bld, r->size());
-            std::vector<df::item *> items;
-            items.push_back(block);
-            items.push_back(barrel);
-            items.push_back(bucket);
-            Buildings::constructWithItems(bld, items);
-            r->bld_id = bld->id;
-            init_managed_workshop(out, r, bld);
-            add_task(task_type::check_construct, r);
-            return true;
-        }
-        reason << "could not find ";
-        if (!block)
+        else
         {
-            reason << "blocks";
+            matcher.add(item_type::BARREL, "barrel");
+            matcher.add(item_type::BUCKET, "bucket");
         }
-        if (!barrel)
-        {
-            if (!block)
-            {
-                if (!bucket)
-                {
-                    reason << ", ";
-                }
-                else
-                {
-                    reason << " or ";
-                }
-            }
-            reason << "barrel";
-        }
-        if (!bucket)
-        {
-            if (!block || !barrel)
-            {
-                if (!block && !barrel)
-                {
-                    reason << ", ";
-                }
-                reason << " or ";
-            }
-            reason << "bucket";
-        }
-    }
-    else if (r->workshop_type == workshop_type::MetalsmithsForge)
-    {
-        df::item *anvil = nullptr, *bould = nullptr;
-        if (find_item(items_other_id::ANVIL, anvil, true) &&
-            find_item(items_other_id::BOULDER, bould, true, true))
+        std::vector<df::item *> items;
+        if (matcher.match(items))
         {
-            df::building *bld = Buildings::allocInstance(r->min, building_type::Workshop, workshop_type::MetalsmithsForge);
+            df::building *bld = Buildings::allocInstance(r->min, building_type::Workshop, r->workshop_type);
             Buildings::setSize(bld, r->size());
-            std::vector<df::item *> items;
-            items.push_back(anvil);
-            items.push_back(bould);
             Buildings::constructWithItems(bld, items);
+            job_index.invalidate();
             r->bld_id = bld->id;
+            room_dirty(r);
             init_managed_workshop(out, r, bld);
             add_task(task_type::check_construct, r);
             return true;
         }
+        wait_for_items(matcher.item_types());
         reason << "could not find ";
-        if (!anvil)
-        {
-            reason << "anvil";
-        }
-        if (!bould)
-        {
-            if (!anvil)
-            {
-                reason << " or ";
-            }
-            reason << "fire-safe boulder";
-        }
+        matcher.describe_shortage(reason);
     }
     else if (r->workshop_type == workshop_type::Quern)
     {
@@ -1072,11 +926,14 @@ bool Plan::try_construct_workshop(color_ostream & out, room *r, std::ostream & r
             std::vector<df::item *> item;
             item.push_back(quern);
             Buildings::constructWithItems(bld, item);
+            job_index.invalidate();
             r->bld_id = bld->id;
+            room_dirty(r);
             init_managed_workshop(out, r, bld);
             add_task(task_type::check_construct, r);
             return true;
         }
+        wait_for_items({ item_type::QUERN });
         reason << "could not find quern";
     }
     else if (r->workshop_type == workshop_type::Custom)
@@ -1093,9 +950,16 @@ bool Plan::try_construct_workshop(color_ostream & out, room *r, std::ostream & r
         {
             filters.push_back(make_job_item(*it));
         }
+        ItemMatcher matcher;
+        for (auto filter : filters)
+        {
+            matcher.add(filter);
+        }
         std::vector<df::item *> items;
-        if (!find_items(filters, items, reason))
+        if (!matcher.match(items))
         {
+            reason << "could not find ";
+            matcher.describe_shortage(reason);
             for (auto it = filters.begin(); it != filters.end(); it++)
             {
                 delete *it;
@@ -1105,7 +969,9 @@ bool Plan::try_construct_workshop(color_ostream & out, room *r, std::ostream & r
         df::building *bld = Buildings::allocInstance(r->min, building_type::Workshop, workshop_type::Custom, def->id);
         Buildings::setSize(bld, r->size());
         Buildings::constructWithFilters(bld, filters);
+        job_index.invalidate();
         r->bld_id = bld->id;
+        room_dirty(r);
         init_managed_workshop(out, r, bld);
         add_task(task_type::check_construct, r);
         return true;
@@ -1124,12 +990,15 @@ bool Plan::try_construct_workshop(color_ostream & out, room *r, std::ostream & r
             std::vector<df::item *> item;
             item.push_back(bould);
             Buildings::constructWithItems(bld, item);
+            job_index.invalidate();
             r->bld_id = bld->id;
+            room_dirty(r);
             init_managed_workshop(out, r, bld);
             add_task(task_type::check_construct, r);
             return true;
             // XXX else quarry?
         }
+        wait_for_items({ item_type::BLOCKS, item_type::BOULDER, item_type::WOOD });
         reason << "could not find building material";
     }
     return false;
@@ -1154,9 +1023,16 @@ bool Plan::try_construct_furnace(color_ostream & out, room *r, std::ostream & re
         {
             filters.push_back(make_job_item(*it));
         }
+        ItemMatcher matcher;
+        for (auto filter : filters)
+        {
+            matcher.add(filter);
+        }
         std::vector<df::item *> items;
-        if (!find_items(filters, items, reason))
+        if (!matcher.match(items))
         {
+            reason << "could not find ";
+            matcher.describe_shortage(reason);
             for (auto it = filters.begin(); it != filters.end(); it++)
             {
                 delete *it;
@@ -1166,7 +1042,9 @@ bool Plan::try_construct_furnace(color_ostream & out, room *r, std::ostream & re
         df::building *bld = Buildings::allocInstance(r->min, building_type::Furnace, furnace_type::Custom, def->id);
         Buildings::setSize(bld, r->size());
         Buildings::constructWithFilters(bld, filters);
+        job_index.invalidate();
         r->bld_id = bld->id;
+        room_dirty(r);
         init_managed_workshop(out, r, bld);
         add_task(task_type::check_construct, r);
         return true;
@@ -1181,11 +1059,14 @@ bool Plan::try_construct_furnace(color_ostream & out, room *r, std::ostream & re
             std::vector<df::item *> item;
             item.push_back(bould);
             Buildings::constructWithItems(bld, item);
+            job_index.invalidate();
             r->bld_id = bld->id;
+            room_dirty(r);
             init_managed_workshop(out, r, bld);
             add_task(task_type::check_construct, r);
             return true;
         }
+        wait_for_items({ item_type::BOULDER });
         reason << "could not find fire-safe boulder";
         return false;
     }
@@ -1376,6 +1257,7 @@ protected:
         }
 
         r->bld_id = bld->id;
+        ai.plan.room_dirty(r);
         ai.plan.furnish_room(out, r);
 
         if (r->workshop && r->stockpile_type == stockpile_type::stone)
@@ -1509,6 +1391,7 @@ protected:
         auto bld = virtual_cast<df::building_civzonest>(world->buildings.all.back());
         DFAI_ASSERT(bld, "newly created civzone is missing!");
         r->bld_id = bld->id;
+        ai.plan.room_dirty(r);
 
         //if (bld->zone_flags.bits.active != 1)
         //{
@@ -1764,7 +1647,9 @@ bool Plan::try_construct_farmplot(color_ostream & out, room *r, std::ostream & r
     df::building *bld = Buildings::allocInstance(r->min, building_type::FarmPlot);
     Buildings::setSize(bld, r->size());
     Buildings::constructWithItems(bld, std::vector<df::item *>());
+    job_index.invalidate();
     r->bld_id = bld->id;
+    room_dirty(r);
     furnish_room(out, r);
     if (room *st = ai.find_room(room_type::stockpile, [r](room *o) -> bool { return o->workshop == r; }))
     {
@@ -1807,6 +1692,7 @@ bool Plan::try_endfurnish(color_ostream & out, room *r, furniture *f, std::ostre
     }
     if (bld->getBuildStage() < bld->getMaxBuildStage())
     {
+        wait_for_building(bld->id);
         reason << "waiting for construction (" << bld->getBuildStage() << "/" << bld->getMaxBuildStage() << ")";
         return false;
     }
@@ -1814,6 +1700,7 @@ bool Plan::try_endfurnish(color_ostream & out, room *r, furniture *f, std::ostre
     if (f->type == layout_type::archery_target)
     {
         f->makeroom = true;
+        furniture_dirty(f);
     }
     else if (f->type == layout_type::coffin)
     {
@@ -1985,6 +1872,7 @@ bool Plan::try_endconstruct(color_ostream & out, room *r, std::ostream & reason)
     df::building *bld = r->dfbuilding();
     if (bld && bld->getBuildStage() < bld->getMaxBuildStage())
     {
+        wait_for_building(bld->id);
         reason << "waiting for construction (" << bld->getBuildStage() << "/" << bld->getMaxBuildStage() << ")";
         return false;
     }
@@ -2042,10 +1930,12 @@ bool Plan::link_lever(color_ostream &, furniture *src, furniture *dst, std::ostr
         return false;
     }
 
+    ItemMatcher matcher;
+    matcher.add(item_type::TRAPPARTS, "mechanisms", false, false, 2);
     std::vector<df::item *> mechas;
-    if (!find_items(items_other_id::TRAPPARTS, mechas, 2))
+    if (!matcher.match(mechas))
     {
-        reason << "need 2 mechanisms, but have " << mechas.size();
+        reason << "need 2 mechanisms, but have " << matcher.shortage().front().found;
         return false;
     }
 
@@ -2060,6 +1950,7 @@ bool Plan::link_lever(color_ostream &, furniture *src, furniture *dst, std::ostr
     job->general_refs.push_back(refhold);
     bld->jobs.push_back(job);
     Job::linkIntoWorld(job);
+    job_index.invalidate();
 
     Job::attachJobItem(job, mechas[0], df::job_item_ref::LinkToTarget);
     Job::attachJobItem(job, mechas[1], df::job_item_ref::LinkToTrigger);
@@ -73,7 +73,7 @@ room *AI::find_room(room_type::type type, std::function<bool(room *)> b)
 
 room *AI::find_room_at(df::coord t)
 {
-    if (plan.room_by_z.empty())
+    if (plan.room_by_block.empty())
     {
         for (auto r : plan.rooms_and_corridors)
         {
@@ -85,18 +85,72 @@ room *AI::find_room_at(df::coord t)
         return nullptr;
     }
 
-    auto by_z = plan.room_by_z.find(t.z);
-    if (by_z == plan.room_by_z.end())
+    return plan.room_by_block.find(t);
+}
+
+template<typename F>
+void room_spatial_index::each_cell(const room *r, F f)
+{
+    // matches the area checked by room::safe_include
+    for (int16_t z = r->min.z; z <= r->max.z; z++)
+    {
+        for (int16_t x = (r->min.x - 1) & ~0xf; x <= r->max.x + 1; x += 16)
+        {
+            for (int16_t y = (r->min.y - 1) & ~0xf; y <= r->max.y + 1; y += 16)
+            {
+                f(cell_key(x, y, z));
+            }
+        }
+    }
+
+    for (auto furn : r->layout)
+    {
+        df::coord ft = r->min + furn->pos;
+        for (int16_t x = (ft.x - 1) & ~0xf; x <= ft.x + 1; x += 16)
+        {
+            for (int16_t y = (ft.y - 1) & ~0xf; y <= ft.y + 1; y += 16)
+            {
+                f(cell_key(x, y, ft.z));
+            }
+        }
+    }
+}
+
+void room_spatial_index::clear()
+{
+    cells.clear();
+    count = 0;
+}
+
+void room_spatial_index::add(room *r)
+{
+    each_cell(r, [this, r](uint64_t key)
+    {
+        auto & cell = cells[key];
+        if (cell.empty() || cell.back() != r)
+        {
+            cell.push_back(r);
+        }
+    });
+    count++;
+}
+
+room *room_spatial_index::find(df::coord t) const
+{
+    auto cell = cells.find(cell_key(t.x, t.y, t.z));
+    if (cell == cells.end())
     {
         return nullptr;
     }
-    for (auto r : by_z->second)
+
+    for (auto r : cell->second)
     {
         if (r->safe_include(t))
         {
             return r;
         }
     }
+
     return nullptr;
 }
 
@@ -370,6 +424,7 @@ room *Plan::find_typed_corridor(color_ostream & out, corridor_type::type type, d
                 );
                 r2->accesspath.push_back(r);
                 rooms_and_corridors.push_back(r2);
+                room_by_block.add(r2);
                 r = r2;
 
                 cur = prev;
@@ -2,6 +2,7 @@
 #include "plan.h"
 #include "stocks.h"
 
+#include <iterator>
 #include <unordered_map>
 
 #include "modules/World.h"
@@ -13,8 +14,32 @@ command_result Plan::persist(color_ostream &)
         // we haven't initialized yet.
         return CR_OK;
     }
-    std::ofstream f("data/save/current/df-ai-plan.dat", std::ofstream::trunc);
-    save(f);
+
+    // most saves only change a few rooms, so append those to the journal
+    // instead of rewriting the whole plan.
+    if (!journal.needs_compaction())
+    {
+        std::fstream f("data/save/current/df-ai-plan.journal", std::fstream::in | std::fstream::out | std::fstream::binary);
+        f.seekp(0, std::fstream::end);
+        if (f.good() && uint64_t(f.tellp()) == journal.journal_size)
+        {
+            write_journal(f, journal);
+            f.flush();
+            if (f.good())
+            {
+                return CR_OK;
+            }
+        }
+        // the journal isn't the one we wrote; start over from a snapshot.
+        journal.clear();
+    }
+
+    {
+        std::ofstream f("data/save/current/df-ai-plan.dat", std::ofstream::trunc | std::ofstream::binary);
+        write_snapshot(f, journal);
+    }
+    std::ofstream f("data/save/current/df-ai-plan.journal", std::ofstream::trunc | std::ofstream::binary);
+    write_journal_header(f, journal);
     return CR_OK;
 }
 
@@ -22,10 +47,13 @@ command_result Plan::unpersist(color_ostream &)
 {
     std::remove("data/save/current/df-ai-plan.dat");
     std::remove(("data/save/" + World::ReadWorldFolder() + "/df-ai-plan.dat").c_str());
+    std::remove("data/save/current/df-ai-plan.journal");
+    std::remove(("data/save/" + World::ReadWorldFolder() + "/df-ai-plan.journal").c_str());
+    journal.clear();
     return CR_OK;
 }
 
-void Plan::save(std::ostream & out)
+void Plan::save_json(std::ostream & out)
 {
     std::vector<furniture *> all_furniture;
     std::vector<room *> all_rooms;
@@ -297,7 +325,7 @@ void Plan::save(std::ostream & out)
     out << all;
 }
 
-void Plan::load(std::istream & in)
+void Plan::clear_persisted()
 {
     for (auto it = tasks_generic.begin(); it != tasks_generic.end(); it++)
     {
@@ -309,13 +337,43 @@ void Plan::load(std::istream & in)
         delete *it;
     }
     tasks_furniture.clear();
+    recount_tasks();
     for (auto it = rooms_and_corridors.begin(); it != rooms_and_corridors.end(); it++)
     {
         delete *it;
     }
     rooms_and_corridors.clear();
     priorities.clear();
+}
 
+bool Plan::load(std::istream & in, std::istream *journal_in, std::string & error)
+{
+    clear_persisted();
+    // the first save after loading always writes a fresh snapshot.
+    journal.clear();
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (is_binary_plan(data))
+    {
+        std::string journal_data;
+        if (journal_in)
+        {
+            journal_data.assign(std::istreambuf_iterator<char>(*journal_in), std::istreambuf_iterator<char>());
+        }
+        bool ok = load_binary(data, journal_data, error);
+        recount_tasks();
+        return ok;
+    }
+
+    // older saves (and debug exports) are JSON.
+    std::istringstream json(data);
+    load_json(json);
+    recount_tasks();
+    return true;
+}
+
+void Plan::load_json(std::istream & in)
+{
     Json::Value all(Json::objectValue);
     in >> all;
 
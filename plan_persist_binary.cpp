@@ -0,0 +1,1267 @@
+#include "ai.h"
+#include "plan.h"
+#include "stocks.h"
+#include "plan_binary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <type_traits>
+#include <unordered_map>
+
+// df-ai-plan.dat binary format. All integers are little-endian.
+//
+// header:
+//     char magic[8] = "DFAIPLAN"
+//     uint32 version
+//     uint32 section count
+// section table, one entry per section:
+//     uint32 id
+//     uint32 record count
+//     uint64 offset from the start of the file
+//     uint64 size in bytes
+//
+// Sections with an unknown id are skipped. Enums are stored as int16, and the
+// enums section records the name of every value at the time of saving so that
+// adding or reordering enum items does not break existing saves. Rooms,
+// furniture, and tasks refer to each other by index.
+//
+// df-ai-plan.journal holds the changes made since the .dat was written:
+//     char magic[8] = "DFAIJRNL"
+//     uint32 version
+//     uint64 snapshot id (must match the journal section of the .dat)
+// followed by batches, one per save:
+//     uint32 size in bytes
+//     entries, each:
+//         uint8 kind (section id, or journal_room_order)
+//         uint32 slot (rooms and furniture) or record count
+//         uint32 size, then the record in the same encoding as the .dat
+//
+// A batch that was not completely written is ignored. Once the journal grows
+// too large, the next save writes a new .dat and starts an empty journal.
+
+const static char plan_binary_magic[8] = { 'D', 'F', 'A', 'I', 'P', 'L', 'A', 'N' };
+const static uint32_t plan_binary_version = 1;
+const static char plan_journal_magic[8] = { 'D', 'F', 'A', 'I', 'J', 'R', 'N', 'L' };
+const static uint32_t plan_journal_version = 1;
+
+enum plan_binary_section : uint32_t
+{
+    section_enums = 1,
+    section_rooms = 2,
+    section_furniture = 3,
+    section_tasks = 4,
+    section_fort = 5,
+    section_priorities = 6,
+    section_watch = 7,
+    section_journal = 8,
+};
+
+// order of the enum name tables in the enums section.
+enum plan_binary_enum
+{
+    enum_task_type,
+    enum_room_status,
+    enum_room_type,
+    enum_corridor_type,
+    enum_farm_type,
+    enum_stockpile_type,
+    enum_nobleroom_type,
+    enum_outpost_type,
+    enum_location_type,
+    enum_cistern_type,
+    enum_layout_type,
+    enum_workshop_type,
+    enum_furnace_type,
+    enum_construction_type,
+    enum_tile_dig_designation,
+    enum_stockpile_list,
+
+    plan_binary_enum_count
+};
+
+// maps the enum values stored in a file to the current values.
+struct plan_binary_enum_map
+{
+    int32_t first;
+    std::vector<std::string> names;
+    std::vector<int32_t> values;
+    std::vector<bool> known;
+
+    plan_binary_enum_map() : first(0), names(), values(), known() {}
+
+    template<typename T>
+    void resolve(int32_t count)
+    {
+        std::ostringstream stringify;
+        std::map<std::string, int32_t> current;
+        for (int32_t i = 0; i < count; i++)
+        {
+            stringify.str(std::string());
+            stringify.clear();
+            stringify << T(i);
+            current[stringify.str()] = i;
+        }
+
+        values.resize(names.size(), 0);
+        known.resize(names.size(), false);
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            auto it = current.find(names.at(i));
+            if (it != current.end())
+            {
+                values.at(i) = it->second;
+                known.at(i) = true;
+            }
+        }
+    }
+    template<typename T>
+    void resolve_df()
+    {
+        values.resize(names.size(), 0);
+        known.resize(names.size(), false);
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            T value = T();
+            if (find_enum_item(&value, names.at(i)))
+            {
+                values.at(i) = int32_t(value);
+                known.at(i) = true;
+            }
+        }
+    }
+    template<typename T>
+    bool get(int16_t stored, T & value) const
+    {
+        int32_t idx = int32_t(stored) - first;
+        if (idx < 0 || size_t(idx) >= values.size() || !known.at(size_t(idx)))
+        {
+            return false;
+        }
+        value = T(values.at(size_t(idx)));
+        return true;
+    }
+};
+
+template<typename T>
+static void write_enum_names(plan_binary_writer & w, int32_t count)
+{
+    std::ostringstream stringify;
+    w.put<int32_t>(0);
+    w.put<uint32_t>(uint32_t(count));
+    for (int32_t i = 0; i < count; i++)
+    {
+        stringify.str(std::string());
+        stringify.clear();
+        stringify << T(i);
+        w.put_string(stringify.str());
+    }
+}
+
+template<typename T>
+static void write_df_enum_names(plan_binary_writer & w)
+{
+    int32_t first = int32_t(df::enum_traits<T>::first_item_value);
+    int32_t last = int32_t(df::enum_traits<T>::last_item_value);
+    w.put<int32_t>(first);
+    w.put<uint32_t>(uint32_t(last - first + 1));
+    for (int32_t i = first; i <= last; i++)
+    {
+        w.put_string(enum_item_key(T(i)));
+    }
+}
+
+// journal entries for data that isn't indexed by slot use the section id of
+// the same data in the snapshot; this one only appears in journals.
+const static uint8_t journal_room_order = 9;
+const static uint64_t journal_compact_min_size = 64 * 1024;
+const static uint32_t journal_compact_batches = 64;
+
+struct plan_binary_view
+{
+    const std::string *data;
+    uint32_t count;
+    size_t offset;
+    size_t size;
+
+    inline plan_binary_reader reader() const
+    {
+        return plan_binary_reader(*data, offset, size);
+    }
+};
+
+plan_journal_t::plan_journal_t() :
+    valid(false),
+    snapshot_id(0),
+    snapshot_size(0),
+    journal_size(0),
+    batches(0),
+    room_slot(),
+    furniture_slot(),
+    room_records(),
+    furniture_records(),
+    room_order(),
+    tasks(),
+    fort(),
+    priorities(),
+    watch(),
+    dirty_rooms(),
+    dirty_furniture(),
+    dirty_tasks(true),
+    dirty_order(true)
+{
+}
+
+void plan_journal_t::clear()
+{
+    valid = false;
+    snapshot_id = 0;
+    snapshot_size = 0;
+    journal_size = 0;
+    batches = 0;
+    room_slot.clear();
+    furniture_slot.clear();
+    room_records.clear();
+    furniture_records.clear();
+    room_order.clear();
+    tasks.clear();
+    fort.clear();
+    priorities.clear();
+    watch.clear();
+    dirty_rooms.clear();
+    dirty_furniture.clear();
+    dirty_tasks = true;
+    dirty_order = true;
+}
+
+bool plan_journal_t::needs_compaction() const
+{
+    return !valid || batches >= journal_compact_batches || journal_size > std::max(journal_compact_min_size, snapshot_size / 2);
+}
+
+// references to rooms or furniture that have no slot (no longer in the plan)
+// are dropped rather than saved with a slot that will not be loaded.
+static uint32_t room_slot_of(room *r, const plan_journal_t & state)
+{
+    auto it = r ? state.room_slot.find(r) : state.room_slot.end();
+    return it == state.room_slot.end() ? plan_binary_none : it->second;
+}
+
+static uint32_t furniture_slot_of(furniture *f, const plan_journal_t & state)
+{
+    auto it = f ? state.furniture_slot.find(f) : state.furniture_slot.end();
+    return it == state.furniture_slot.end() ? plan_binary_none : it->second;
+}
+
+static std::string encode_room(const room *r, const plan_journal_t & state)
+{
+    plan_binary_writer w;
+    w.put_enum(r->status);
+    w.put_enum(r->type);
+    w.put_enum(r->corridor_type);
+    w.put_enum(r->farm_type);
+    w.put_enum(r->stockpile_type);
+    w.put_enum(r->nobleroom_type);
+    w.put_enum(r->outpost_type);
+    w.put_enum(r->location_type);
+    w.put_enum(r->cistern_type);
+    w.put_enum(r->workshop_type);
+    w.put_enum(r->furnace_type);
+    w.put_string(r->raw_type);
+    w.put_string(r->comment);
+    w.put_coord(r->min);
+    w.put_coord(r->max);
+    std::vector<uint32_t> accesspath;
+    for (auto ap : r->accesspath)
+    {
+        uint32_t slot = room_slot_of(ap, state);
+        if (slot != plan_binary_none)
+        {
+            accesspath.push_back(slot);
+        }
+    }
+    w.put<uint32_t>(uint32_t(accesspath.size()));
+    for (auto slot : accesspath)
+    {
+        w.put<uint32_t>(slot);
+    }
+    w.put<uint32_t>(uint32_t(r->layout.size()));
+    for (auto f : r->layout)
+    {
+        w.put<uint32_t>(state.furniture_slot.at(f));
+    }
+    w.put<int32_t>(r->owner);
+    w.put<int32_t>(r->bld_id);
+    w.put<int32_t>(r->squad_id);
+    w.put<int32_t>(r->level);
+    w.put<int32_t>(r->noblesuite);
+    w.put<int32_t>(r->queue);
+    w.put<uint32_t>(room_slot_of(r->workshop, state));
+    w.put<uint32_t>(uint32_t(r->users.size()));
+    for (auto u : r->users)
+    {
+        w.put<int32_t>(u);
+    }
+    w.put_coord(r->channel_enable);
+    w.put<uint32_t>(uint32_t(r->stock_disable.size()));
+    for (auto sd : r->stock_disable)
+    {
+        w.put_enum(sd);
+    }
+    w.put_bool(r->stock_specific1);
+    w.put_bool(r->stock_specific2);
+    w.put<uint64_t>(uint64_t(r->has_users));
+    w.put_bool(r->furnished);
+    w.put_bool(r->queue_dig);
+    w.put_bool(r->temporary);
+    w.put_bool(r->outdoor);
+    w.put_bool(r->channeled);
+    w.put_bool(r->build_when_accessible);
+    w.put<int32_t>(r->required_value);
+    w.put<int32_t>(r->data1);
+    w.put<int32_t>(r->data2);
+    return w.data;
+}
+
+static std::string encode_furniture(const furniture *f, const plan_journal_t & state)
+{
+    plan_binary_writer w;
+    w.put_enum(f->type);
+    w.put_enum(f->construction);
+    w.put_enum(f->dig);
+    w.put<int32_t>(f->bld_id);
+    w.put_coord(f->pos);
+    w.put<uint32_t>(furniture_slot_of(f->target, state));
+    w.put<uint32_t>(uint32_t(f->users.size()));
+    for (auto u : f->users)
+    {
+        w.put<int32_t>(u);
+    }
+    w.put<uint64_t>(uint64_t(f->has_users));
+    w.put_bool(f->ignore);
+    w.put_bool(f->makeroom);
+    w.put_bool(f->internal);
+    w.put_string(f->comment);
+    return w.data;
+}
+
+// tasks for a room or piece of furniture that is no longer in the plan are
+// not saved. count is the number of tasks that were.
+static std::string encode_tasks(const std::list<task *> & tasks_generic, const std::list<task *> & tasks_furniture, const plan_journal_t & state, uint32_t & count)
+{
+    plan_binary_writer w;
+    count = 0;
+    for (auto list : { &tasks_generic, &tasks_furniture })
+    {
+        for (auto t : *list)
+        {
+            uint32_t r_slot = room_slot_of(t->r, state);
+            uint32_t f_slot = furniture_slot_of(t->f, state);
+            if ((t->r && r_slot == plan_binary_none) || (t->f && f_slot == plan_binary_none))
+            {
+                continue;
+            }
+            w.put_enum(t->type);
+            w.put<uint32_t>(r_slot);
+            w.put<uint32_t>(f_slot);
+            w.put<int32_t>(t->item_id);
+            w.put_string(t->last_status);
+            count++;
+        }
+    }
+    return w.data;
+}
+
+static std::string encode_json(const Json::Value & value)
+{
+    std::ostringstream json;
+    json << value;
+    plan_binary_writer w;
+    w.put_string(json.str());
+    return w.data;
+}
+
+#define READ_ENUM(reader, kind, field, what) \
+    if (!enums.at(kind).get(reader.get<int16_t>(), field) && reader.ok) \
+    { \
+        error = "unknown " what " in saved plan"; \
+        return false; \
+    }
+#define READ_DF_ENUM(reader, kind, field) \
+    enums.at(kind).get(reader.get<int16_t>(), field)
+
+static bool decode_room(plan_binary_reader & r, room *rr, const std::vector<plan_binary_enum_map> & enums, const std::vector<room *> & all_rooms, const std::vector<furniture *> & all_furniture, std::string & error)
+{
+    // journal entries are decoded over the snapshot's version of the room.
+    rr->accesspath.clear();
+    rr->layout.clear();
+    rr->users.clear();
+    rr->stock_disable.clear();
+
+    READ_ENUM(r, enum_room_status, rr->status, "room status");
+    READ_ENUM(r, enum_room_type, rr->type, "room type");
+    READ_ENUM(r, enum_corridor_type, rr->corridor_type, "corridor type");
+    READ_ENUM(r, enum_farm_type, rr->farm_type, "farm type");
+    READ_ENUM(r, enum_stockpile_type, rr->stockpile_type, "stockpile type");
+    READ_ENUM(r, enum_nobleroom_type, rr->nobleroom_type, "noble room type");
+    READ_ENUM(r, enum_outpost_type, rr->outpost_type, "outpost type");
+    READ_ENUM(r, enum_location_type, rr->location_type, "location type");
+    READ_ENUM(r, enum_cistern_type, rr->cistern_type, "cistern type");
+    READ_DF_ENUM(r, enum_workshop_type, rr->workshop_type);
+    READ_DF_ENUM(r, enum_furnace_type, rr->furnace_type);
+    rr->raw_type = r.get_string();
+    rr->comment = r.get_string();
+    rr->min = r.get_coord();
+    rr->max = r.get_coord();
+    rr->accesspath.resize(r.get_count(4));
+    for (auto & ap : rr->accesspath)
+    {
+        r.get_index(all_rooms, ap);
+    }
+    rr->layout.resize(r.get_count(4));
+    for (auto & f : rr->layout)
+    {
+        r.get_index(all_furniture, f);
+    }
+    rr->owner = r.get<int32_t>();
+    rr->bld_id = r.get<int32_t>();
+    rr->squad_id = r.get<int32_t>();
+    rr->level = r.get<int32_t>();
+    rr->noblesuite = r.get<int32_t>();
+    rr->queue = r.get<int32_t>();
+    r.get_index(all_rooms, rr->workshop);
+    for (uint32_t i = r.get_count(4); i > 0; i--)
+    {
+        rr->users.insert(rr->users.end(), r.get<int32_t>());
+    }
+    rr->channel_enable = r.get_coord();
+    for (uint32_t i = r.get_count(2); i > 0; i--)
+    {
+        df::stockpile_list disable;
+        if (READ_DF_ENUM(r, enum_stockpile_list, disable))
+        {
+            rr->stock_disable.insert(disable);
+        }
+    }
+    rr->stock_specific1 = r.get_bool();
+    rr->stock_specific2 = r.get_bool();
+    rr->has_users = size_t(r.get<uint64_t>());
+    rr->furnished = r.get_bool();
+    rr->queue_dig = r.get_bool();
+    rr->temporary = r.get_bool();
+    rr->outdoor = r.get_bool();
+    rr->channeled = r.get_bool();
+    rr->build_when_accessible = r.get_bool();
+    rr->required_value = r.get<int32_t>();
+    rr->data1 = r.get<int32_t>();
+    rr->data2 = r.get<int32_t>();
+    if (!r.ok)
+    {
+        error = "truncated or invalid room record";
+        return false;
+    }
+    return true;
+}
+
+static bool decode_furniture(plan_binary_reader & r, furniture *f, const std::vector<plan_binary_enum_map> & enums, const std::vector<furniture *> & all_furniture, std::string & error)
+{
+    f->users.clear();
+
+    READ_ENUM(r, enum_layout_type, f->type, "furniture type");
+    READ_DF_ENUM(r, enum_construction_type, f->construction);
+    READ_DF_ENUM(r, enum_tile_dig_designation, f->dig);
+    f->bld_id = r.get<int32_t>();
+    f->pos = r.get_coord();
+    r.get_index(all_furniture, f->target);
+    for (uint32_t i = r.get_count(4); i > 0; i--)
+    {
+        f->users.insert(f->users.end(), r.get<int32_t>());
+    }
+    f->has_users = size_t(r.get<uint64_t>());
+    f->ignore = r.get_bool();
+    f->makeroom = r.get_bool();
+    f->internal = r.get_bool();
+    f->comment = r.get_string();
+    if (!r.ok)
+    {
+        error = "truncated or invalid furniture record";
+        return false;
+    }
+    return true;
+}
+
+static bool decode_tasks(const plan_binary_view & view, std::list<task *> & tasks_generic, std::list<task *> & tasks_furniture, const std::vector<plan_binary_enum_map> & enums, const std::vector<room *> & all_rooms, const std::vector<furniture *> & all_furniture, std::string & error)
+{
+    plan_binary_reader r = view.reader();
+    for (uint32_t i = view.count; i > 0; i--)
+    {
+        task_type::type type = task_type::type();
+        READ_ENUM(r, enum_task_type, type, "task type");
+        task *t = new task(type);
+        r.get_index(all_rooms, t->r);
+        r.get_index(all_furniture, t->f);
+        t->item_id = r.get<int32_t>();
+        t->last_status = r.get_string();
+        if (t->type == task_type::furnish || t->type == task_type::check_furnish)
+        {
+            tasks_furniture.push_back(t);
+        }
+        else
+        {
+            tasks_generic.push_back(t);
+        }
+        if (!r.ok)
+        {
+            error = "truncated or invalid tasks section";
+            return false;
+        }
+    }
+    return true;
+}
+
+#undef READ_ENUM
+#undef READ_DF_ENUM
+
+bool Plan::is_binary_plan(const std::string & data)
+{
+    return data.size() >= sizeof(plan_binary_magic) && std::memcmp(data.data(), plan_binary_magic, sizeof(plan_binary_magic)) == 0;
+}
+
+// gives every room and piece of furniture in the plan a slot, keeping the
+// slots from earlier saves, and lists the room slots in plan order. Anything
+// given a new slot is marked dirty.
+void Plan::assign_journal_slots(plan_journal_t & state, std::vector<uint32_t> & order)
+{
+    std::vector<bool> seen(state.room_slot.size() + rooms_and_corridors.size(), false);
+    order.clear();
+    order.reserve(rooms_and_corridors.size());
+    for (auto r : rooms_and_corridors)
+    {
+        auto ins = state.room_slot.insert(std::make_pair(r, uint32_t(state.room_slot.size())));
+        uint32_t slot = ins.first->second;
+        if (seen.at(slot))
+        {
+            continue;
+        }
+        seen.at(slot) = true;
+        order.push_back(slot);
+        if (ins.second)
+        {
+            state.dirty_rooms.insert(r);
+        }
+
+        assign_furniture_slots(state, r);
+    }
+}
+
+void Plan::assign_furniture_slots(plan_journal_t & state, room *r)
+{
+    for (auto f : r->layout)
+    {
+        if (state.furniture_slot.insert(std::make_pair(f, uint32_t(state.furniture_slot.size()))).second)
+        {
+            state.dirty_furniture.insert(f);
+        }
+    }
+}
+
+void Plan::room_dirty(room *r)
+{
+    journal.dirty_rooms.insert(r);
+}
+
+void Plan::furniture_dirty(furniture *f)
+{
+    journal.dirty_furniture.insert(f);
+}
+
+void Plan::journal_room_deleted(room *r)
+{
+    // records that are not dirty may still refer to the room's slots, so
+    // the next save writes a full snapshot. The slots are dropped now so a
+    // new object at the same address can't be saved under them.
+    journal.valid = false;
+    journal.dirty_rooms.erase(r);
+    journal.room_slot.erase(r);
+    for (auto f : r->layout)
+    {
+        journal.dirty_furniture.erase(f);
+        journal.furniture_slot.erase(f);
+    }
+    journal.dirty_order = true;
+}
+
+void Plan::save(std::ostream & out)
+{
+    plan_journal_t state;
+    write_snapshot(out, state);
+}
+
+void Plan::write_snapshot(std::ostream & out, plan_journal_t & state)
+{
+    state.clear();
+    assign_journal_slots(state, state.room_order);
+
+    std::vector<room *> all_rooms(state.room_slot.size());
+    for (auto & slot : state.room_slot)
+    {
+        all_rooms.at(slot.second) = slot.first;
+    }
+    std::vector<furniture *> all_furniture(state.furniture_slot.size());
+    for (auto & slot : state.furniture_slot)
+    {
+        all_furniture.at(slot.second) = slot.first;
+    }
+
+    plan_binary_writer enums;
+    enums.put<uint16_t>(plan_binary_enum_count);
+    write_enum_names<task_type::type>(enums, task_type::_task_type_count);
+    write_enum_names<room_status::status>(enums, room_status::_room_status_count);
+    write_enum_names<room_type::type>(enums, room_type::_room_type_count);
+    write_enum_names<corridor_type::type>(enums, corridor_type::_corridor_type_count);
+    write_enum_names<farm_type::type>(enums, farm_type::_farm_type_count);
+    write_enum_names<stockpile_type::type>(enums, stockpile_type::_stockpile_type_count);
+    write_enum_names<nobleroom_type::type>(enums, nobleroom_type::_nobleroom_type_count);
+    write_enum_names<outpost_type::type>(enums, outpost_type::_outpost_type_count);
+    write_enum_names<location_type::type>(enums, location_type::_location_type_count);
+    write_enum_names<cistern_type::type>(enums, cistern_type::_cistern_type_count);
+    write_enum_names<layout_type::type>(enums, layout_type::_layout_type_count);
+    write_df_enum_names<df::workshop_type>(enums);
+    write_df_enum_names<df::furnace_type>(enums);
+    write_df_enum_names<df::construction_type>(enums);
+    write_df_enum_names<df::tile_dig_designation>(enums);
+    write_df_enum_names<df::stockpile_list>(enums);
+
+    std::string rooms;
+    state.room_records.reserve(all_rooms.size());
+    for (auto r : all_rooms)
+    {
+        state.room_records.push_back(encode_room(r, state));
+        rooms += state.room_records.back();
+    }
+
+    std::string furnitures;
+    state.furniture_records.reserve(all_furniture.size());
+    for (auto f : all_furniture)
+    {
+        state.furniture_records.push_back(encode_furniture(f, state));
+        furnitures += state.furniture_records.back();
+    }
+
+    uint32_t task_count;
+    state.tasks = encode_tasks(tasks_generic, tasks_furniture, state, task_count);
+
+    plan_binary_writer fort;
+    fort.put<uint32_t>(state.room_slot.at(fort_entrance));
+    fort.put<int32_t>(ai.pop.military_min);
+    fort.put<int32_t>(ai.pop.military_max);
+    state.fort = fort.data;
+
+    // priorities and stock goals are small and nested, so they stay JSON.
+    state.priorities = encode_json(priorities_to_json(priorities));
+    state.watch = encode_json(Watch.to_json());
+
+    std::random_device rd;
+    state.snapshot_id = (uint64_t(rd()) << 32) | uint64_t(rd());
+    plan_binary_writer journal_id;
+    journal_id.put<uint64_t>(state.snapshot_id);
+
+    struct section_t
+    {
+        uint32_t id;
+        uint32_t count;
+        const std::string *data;
+    };
+    const section_t sections[] =
+    {
+        { section_enums, plan_binary_enum_count, &enums.data },
+        { section_rooms, uint32_t(all_rooms.size()), &rooms },
+        { section_furniture, uint32_t(all_furniture.size()), &furnitures },
+        { section_tasks, task_count, &state.tasks },
+        { section_fort, 1, &state.fort },
+        { section_priorities, 1, &state.priorities },
+        { section_watch, 1, &state.watch },
+        { section_journal, 1, &journal_id.data },
+    };
+    const uint32_t section_count = uint32_t(sizeof(sections) / sizeof(sections[0]));
+
+    plan_binary_writer header;
+    header.data.append(plan_binary_magic, sizeof(plan_binary_magic));
+    header.put<uint32_t>(plan_binary_version);
+    header.put<uint32_t>(section_count);
+    uint64_t offset = header.data.size() + section_count * (4 + 4 + 8 + 8);
+    for (auto & s : sections)
+    {
+        header.put<uint32_t>(s.id);
+        header.put<uint32_t>(s.count);
+        header.put<uint64_t>(offset);
+        header.put<uint64_t>(uint64_t(s.data->size()));
+        offset += s.data->size();
+    }
+
+    out.write(header.data.data(), std::streamsize(header.data.size()));
+    for (auto & s : sections)
+    {
+        out.write(s.data->data(), std::streamsize(s.data->size()));
+    }
+
+    state.snapshot_size = offset;
+    state.journal_size = 0;
+    state.batches = 0;
+    state.valid = true;
+    state.dirty_rooms.clear();
+    state.dirty_furniture.clear();
+    state.dirty_tasks = false;
+    state.dirty_order = false;
+}
+
+void Plan::write_journal_header(std::ostream & out, plan_journal_t & state)
+{
+    plan_binary_writer header;
+    header.data.append(plan_journal_magic, sizeof(plan_journal_magic));
+    header.put<uint32_t>(plan_journal_version);
+    header.put<uint64_t>(state.snapshot_id);
+    out.write(header.data.data(), std::streamsize(header.data.size()));
+    state.journal_size = header.data.size();
+    state.batches = 0;
+}
+
+void Plan::write_journal(std::ostream & out, plan_journal_t & state)
+{
+    // not every path that adds a room to the plan marks the order dirty,
+    // but all of them change the number of rooms.
+    if (state.dirty_order || rooms_and_corridors.size() != state.room_order.size())
+    {
+        std::vector<uint32_t> order;
+        assign_journal_slots(state, order);
+        state.dirty_order = order != state.room_order;
+        state.room_order.swap(order);
+    }
+
+    // a dirty room may have new furniture in its layout.
+    for (auto r : state.dirty_rooms)
+    {
+        if (state.room_slot.count(r))
+        {
+            assign_furniture_slots(state, r);
+        }
+    }
+    state.room_records.resize(state.room_slot.size());
+    state.furniture_records.resize(state.furniture_slot.size());
+
+    plan_binary_writer batch;
+    auto add_entry = [&batch](uint8_t kind, uint32_t slot, const std::string & record)
+    {
+        batch.put<uint8_t>(kind);
+        batch.put<uint32_t>(slot);
+        batch.put_string(record);
+    };
+
+    // new slots must be written in order. Rooms that are dirty but have no
+    // slot were never added to the plan.
+    std::vector<std::pair<uint32_t, room *>> rooms;
+    for (auto r : state.dirty_rooms)
+    {
+        auto it = state.room_slot.find(r);
+        if (it != state.room_slot.end())
+        {
+            rooms.push_back(std::make_pair(it->second, r));
+        }
+    }
+    std::sort(rooms.begin(), rooms.end());
+    for (auto & r : rooms)
+    {
+        std::string record = encode_room(r.second, state);
+        if (record != state.room_records.at(r.first))
+        {
+            add_entry(section_rooms, r.first, record);
+            state.room_records.at(r.first).swap(record);
+        }
+    }
+    state.dirty_rooms.clear();
+
+    std::vector<std::pair<uint32_t, furniture *>> furnitures;
+    for (auto f : state.dirty_furniture)
+    {
+        auto it = state.furniture_slot.find(f);
+        if (it != state.furniture_slot.end())
+        {
+            furnitures.push_back(std::make_pair(it->second, f));
+        }
+    }
+    std::sort(furnitures.begin(), furnitures.end());
+    for (auto & f : furnitures)
+    {
+        std::string record = encode_furniture(f.second, state);
+        if (record != state.furniture_records.at(f.first))
+        {
+            add_entry(section_furniture, f.first, record);
+            state.furniture_records.at(f.first).swap(record);
+        }
+    }
+    state.dirty_furniture.clear();
+
+    if (state.dirty_order)
+    {
+        plan_binary_writer w;
+        for (auto slot : state.room_order)
+        {
+            w.put<uint32_t>(slot);
+        }
+        add_entry(journal_room_order, uint32_t(state.room_order.size()), w.data);
+        state.dirty_order = false;
+    }
+
+    if (state.dirty_tasks)
+    {
+        uint32_t task_count;
+        std::string tasks = encode_tasks(tasks_generic, tasks_furniture, state, task_count);
+        if (tasks != state.tasks)
+        {
+            add_entry(section_tasks, task_count, tasks);
+            state.tasks.swap(tasks);
+        }
+        state.dirty_tasks = false;
+    }
+
+    plan_binary_writer fort;
+    fort.put<uint32_t>(state.room_slot.at(fort_entrance));
+    fort.put<int32_t>(ai.pop.military_min);
+    fort.put<int32_t>(ai.pop.military_max);
+    if (fort.data != state.fort)
+    {
+        add_entry(section_fort, 1, fort.data);
+        state.fort.swap(fort.data);
+    }
+
+    std::string p = encode_json(priorities_to_json(priorities));
+    if (p != state.priorities)
+    {
+        add_entry(section_priorities, 1, p);
+        state.priorities.swap(p);
+    }
+
+    std::string w = encode_json(Watch.to_json());
+    if (w != state.watch)
+    {
+        add_entry(section_watch, 1, w);
+        state.watch.swap(w);
+    }
+
+    if (batch.data.empty())
+    {
+        return;
+    }
+
+    plan_binary_writer size;
+    size.put<uint32_t>(uint32_t(batch.data.size()));
+    out.write(size.data.data(), std::streamsize(size.data.size()));
+    out.write(batch.data.data(), std::streamsize(batch.data.size()));
+    state.journal_size += size.data.size() + batch.data.size();
+    state.batches++;
+}
+
+bool Plan::load_binary(const std::string & data, const std::string & journal_data, std::string & error)
+{
+    plan_binary_reader header(data, 0, data.size());
+    header.pos += sizeof(plan_binary_magic);
+    uint32_t version = header.get<uint32_t>();
+    uint32_t section_count = header.get_count(4 + 4 + 8 + 8);
+    if (!header.ok)
+    {
+        error = "truncated header";
+        return false;
+    }
+    if (version == 0 || version > plan_binary_version)
+    {
+        error = "unsupported version " + std::to_string(version);
+        return false;
+    }
+
+    std::map<uint32_t, plan_binary_view> sections;
+    for (uint32_t i = 0; i < section_count; i++)
+    {
+        uint32_t id = header.get<uint32_t>();
+        uint32_t count = header.get<uint32_t>();
+        uint64_t offset = header.get<uint64_t>();
+        uint64_t size = header.get<uint64_t>();
+        if (offset > data.size() || size > data.size() - offset)
+        {
+            error = "section " + std::to_string(id) + " is outside of the file";
+            return false;
+        }
+        sections[id] = plan_binary_view{ &data, count, size_t(offset), size_t(size) };
+    }
+
+    for (auto id : { section_enums, section_rooms, section_furniture, section_tasks, section_fort })
+    {
+        if (!sections.count(id))
+        {
+            error = "missing section " + std::to_string(id);
+            return false;
+        }
+    }
+
+    std::vector<plan_binary_enum_map> enums(plan_binary_enum_count);
+    {
+        plan_binary_reader r = sections.at(section_enums).reader();
+        uint16_t stored = r.get<uint16_t>();
+        for (uint16_t e = 0; e < stored && r.ok; e++)
+        {
+            plan_binary_enum_map map;
+            map.first = r.get<int32_t>();
+            uint32_t count = r.get_count(4);
+            map.names.reserve(count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                map.names.push_back(r.get_string());
+            }
+            if (e < plan_binary_enum_count)
+            {
+                enums.at(e) = map;
+            }
+        }
+        if (!r.ok)
+        {
+            error = "truncated enums section";
+            return false;
+        }
+
+        enums.at(enum_task_type).resolve<task_type::type>(task_type::_task_type_count);
+        enums.at(enum_room_status).resolve<room_status::status>(room_status::_room_status_count);
+        enums.at(enum_room_type).resolve<room_type::type>(room_type::_room_type_count);
+        enums.at(enum_corridor_type).resolve<corridor_type::type>(corridor_type::_corridor_type_count);
+        enums.at(enum_farm_type).resolve<farm_type::type>(farm_type::_farm_type_count);
+        enums.at(enum_stockpile_type).resolve<stockpile_type::type>(stockpile_type::_stockpile_type_count);
+        enums.at(enum_nobleroom_type).resolve<nobleroom_type::type>(nobleroom_type::_nobleroom_type_count);
+        enums.at(enum_outpost_type).resolve<outpost_type::type>(outpost_type::_outpost_type_count);
+        enums.at(enum_location_type).resolve<location_type::type>(location_type::_location_type_count);
+        enums.at(enum_cistern_type).resolve<cistern_type::type>(cistern_type::_cistern_type_count);
+        enums.at(enum_layout_type).resolve<layout_type::type>(layout_type::_layout_type_count);
+        enums.at(enum_workshop_type).resolve_df<df::workshop_type>();
+        enums.at(enum_furnace_type).resolve_df<df::furnace_type>();
+        enums.at(enum_construction_type).resolve_df<df::construction_type>();
+        enums.at(enum_tile_dig_designation).resolve_df<df::tile_dig_designation>();
+        enums.at(enum_stockpile_list).resolve_df<df::stockpile_list>();
+    }
+
+    // rooms take at least 64 bytes and furniture at least 32, so a corrupt
+    // count can't make us allocate more than the file could hold.
+    uint32_t room_total = sections.at(section_rooms).count;
+    uint32_t furniture_total = sections.at(section_furniture).count;
+    if (uint64_t(room_total) * 64 > sections.at(section_rooms).size || uint64_t(furniture_total) * 32 > sections.at(section_furniture).size)
+    {
+        error = "record count does not match section size";
+        return false;
+    }
+
+    // journal entries, in the order they were written. A batch that was cut
+    // off (by a crash during a save) is ignored along with anything after it.
+    std::vector<std::pair<uint8_t, plan_binary_view>> entries;
+    if (sections.count(section_journal) && journal_data.size() >= sizeof(plan_journal_magic) && std::memcmp(journal_data.data(), plan_journal_magic, sizeof(plan_journal_magic)) == 0)
+    {
+        plan_binary_reader id_reader = sections.at(section_journal).reader();
+        uint64_t snapshot_id = id_reader.get<uint64_t>();
+
+        plan_binary_reader jr(journal_data, 0, journal_data.size());
+        jr.pos += sizeof(plan_journal_magic);
+        uint32_t journal_version = jr.get<uint32_t>();
+        uint64_t journal_id = jr.get<uint64_t>();
+        if (id_reader.ok && jr.ok && journal_version == plan_journal_version && journal_id == snapshot_id)
+        {
+            while (jr.ok && jr.pos != jr.end)
+            {
+                uint32_t batch_size = jr.get<uint32_t>();
+                if (!jr.ok || size_t(jr.end - jr.pos) < batch_size)
+                {
+                    break;
+                }
+
+                plan_binary_reader br(journal_data, size_t(jr.pos - journal_data.data()), batch_size);
+                std::vector<std::pair<uint8_t, plan_binary_view>> batch;
+                while (br.ok && br.pos != br.end)
+                {
+                    uint8_t kind = br.get<uint8_t>();
+                    uint32_t slot = br.get<uint32_t>();
+                    uint32_t size = br.get<uint32_t>();
+                    if (!br.ok || size_t(br.end - br.pos) < size)
+                    {
+                        br.ok = false;
+                        break;
+                    }
+                    batch.push_back(std::make_pair(kind, plan_binary_view{ &journal_data, slot, size_t(br.pos - journal_data.data()), size_t(size) }));
+                    br.pos += size;
+                }
+                if (!br.ok)
+                {
+                    break;
+                }
+                entries.insert(entries.end(), batch.begin(), batch.end());
+                jr.pos += batch_size;
+            }
+        }
+    }
+
+    // new slots are always the next unused one.
+    for (auto & e : entries)
+    {
+        if (e.first != section_rooms && e.first != section_furniture)
+        {
+            continue;
+        }
+        uint32_t & total = e.first == section_rooms ? room_total : furniture_total;
+        if (e.second.count > total)
+        {
+            error = "journal skips a slot";
+            return false;
+        }
+        if (e.second.count == total)
+        {
+            total++;
+        }
+    }
+
+    std::vector<room *> all_rooms;
+    std::vector<furniture *> all_furniture;
+    all_rooms.reserve(room_total);
+    for (uint32_t i = 0; i < room_total; i++)
+    {
+        all_rooms.push_back(new room(room_type::type(), df::coord(), df::coord()));
+    }
+    all_furniture.reserve(furniture_total);
+    for (uint32_t i = 0; i < furniture_total; i++)
+    {
+        all_furniture.push_back(new furniture());
+    }
+
+    auto fail = [this, &all_rooms, &all_furniture, &error](const std::string & message) -> bool
+    {
+        // furniture is owned by the room layouts, but slots that were
+        // replaced by the journal may not be attached to anything.
+        rooms_and_corridors.clear();
+        for (auto r : all_rooms)
+        {
+            r->layout.clear();
+            delete r;
+        }
+        for (auto f : all_furniture)
+        {
+            delete f;
+        }
+        clear_persisted();
+        error = message;
+        return false;
+    };
+
+    std::string decode_error;
+    {
+        plan_binary_reader r = sections.at(section_rooms).reader();
+        for (uint32_t i = 0; i < sections.at(section_rooms).count; i++)
+        {
+            if (!decode_room(r, all_rooms.at(i), enums, all_rooms, all_furniture, decode_error))
+            {
+                return fail(decode_error);
+            }
+        }
+    }
+    {
+        plan_binary_reader r = sections.at(section_furniture).reader();
+        for (uint32_t i = 0; i < sections.at(section_furniture).count; i++)
+        {
+            if (!decode_furniture(r, all_furniture.at(i), enums, all_furniture, decode_error))
+            {
+                return fail(decode_error);
+            }
+        }
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < sections.at(section_rooms).count; i++)
+    {
+        order.push_back(i);
+    }
+    plan_binary_view tasks_view = sections.at(section_tasks);
+    plan_binary_view fort_view = sections.at(section_fort);
+    plan_binary_view priorities_view = { nullptr, 0, 0, 0 };
+    plan_binary_view watch_view = { nullptr, 0, 0, 0 };
+    if (sections.count(section_priorities))
+    {
+        priorities_view = sections.at(section_priorities);
+    }
+    if (sections.count(section_watch))
+    {
+        watch_view = sections.at(section_watch);
+    }
+
+    for (auto & e : entries)
+    {
+        plan_binary_reader r = e.second.reader();
+        switch (e.first)
+        {
+        case section_rooms:
+            if (!decode_room(r, all_rooms.at(e.second.count), enums, all_rooms, all_furniture, decode_error))
+            {
+                return fail(decode_error);
+            }
+            break;
+        case section_furniture:
+            if (!decode_furniture(r, all_furniture.at(e.second.count), enums, all_furniture, decode_error))
+            {
+                return fail(decode_error);
+            }
+            break;
+        case journal_room_order:
+            order.clear();
+            for (uint32_t i = e.second.count; i > 0; i--)
+            {
+                uint32_t slot = r.get<uint32_t>();
+                if (!r.ok || slot >= all_rooms.size())
+                {
+                    return fail("invalid room order in journal");
+                }
+                order.push_back(slot);
+            }
+            break;
+        case section_tasks:
+            tasks_view = e.second;
+            break;
+        case section_fort:
+            fort_view = e.second;
+            break;
+        case section_priorities:
+            priorities_view = e.second;
+            break;
+        case section_watch:
+            watch_view = e.second;
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<bool> live_room(all_rooms.size(), false);
+    std::vector<bool> live_furniture(all_furniture.size(), false);
+    std::unordered_map<room *, size_t> room_index;
+    std::unordered_map<furniture *, size_t> furniture_index;
+    for (size_t i = 0; i < all_rooms.size(); i++)
+    {
+        room_index[all_rooms.at(i)] = i;
+    }
+    for (size_t i = 0; i < all_furniture.size(); i++)
+    {
+        furniture_index[all_furniture.at(i)] = i;
+    }
+    rooms_and_corridors.reserve(order.size());
+    for (auto slot : order)
+    {
+        if (live_room.at(slot))
+        {
+            continue;
+        }
+        live_room.at(slot) = true;
+        rooms_and_corridors.push_back(all_rooms.at(slot));
+        for (auto f : all_rooms.at(slot)->layout)
+        {
+            live_furniture.at(furniture_index.at(f)) = true;
+        }
+    }
+    auto is_live_room = [&](room *r) -> bool { return !r || live_room.at(room_index.at(r)); };
+    auto is_live_furniture = [&](furniture *f) -> bool { return !f || live_furniture.at(furniture_index.at(f)); };
+    for (auto r : rooms_and_corridors)
+    {
+        if (!is_live_room(r->workshop) || !std::all_of(r->accesspath.begin(), r->accesspath.end(), is_live_room))
+        {
+            return fail("saved plan refers to a removed room");
+        }
+        for (auto f : r->layout)
+        {
+            if (!is_live_furniture(f->target))
+            {
+                return fail("saved plan refers to removed furniture");
+            }
+        }
+    }
+
+    if (!decode_tasks(tasks_view, tasks_generic, tasks_furniture, enums, all_rooms, all_furniture, decode_error))
+    {
+        return fail(decode_error);
+    }
+    for (auto list : { &tasks_generic, &tasks_furniture })
+    {
+        for (auto t : *list)
+        {
+            if (!is_live_room(t->r) || !is_live_furniture(t->f))
+            {
+                return fail("saved task refers to a removed room or furniture");
+            }
+        }
+    }
+
+    {
+        plan_binary_reader r = fort_view.reader();
+        r.get_index(all_rooms, fort_entrance);
+        int32_t military_min = r.get<int32_t>();
+        int32_t military_max = r.get<int32_t>();
+        if (!r.ok || !fort_entrance || !is_live_room(fort_entrance))
+        {
+            return fail("truncated or invalid fort section");
+        }
+        if (military_min >= 0 && military_max <= 100 && military_min <= military_max)
+        {
+            ai.pop.military_min = military_min;
+            ai.pop.military_max = military_max;
+        }
+    }
+
+    // everything is valid; drop the records that the journal replaced.
+    for (size_t i = 0; i < all_rooms.size(); i++)
+    {
+        if (!live_room.at(i))
+        {
+            all_rooms.at(i)->layout.clear();
+            delete all_rooms.at(i);
+        }
+    }
+    for (size_t i = 0; i < all_furniture.size(); i++)
+    {
+        if (!live_furniture.at(i))
+        {
+            delete all_furniture.at(i);
+        }
+    }
+
+    for (auto r : rooms_and_corridors)
+    {
+        if (r->type == room_type::pasture)
+        {
+            ai.pop.pet_check.insert(r->users.begin(), r->users.end());
+        }
+        for (auto f : r->layout)
+        {
+            ai.pop.citizen.insert(f->users.begin(), f->users.end());
+        }
+    }
+    categorize_all();
+
+    if (priorities_view.data)
+    {
+        plan_binary_reader r = priorities_view.reader();
+        std::istringstream json(r.get_string());
+        Json::Value p;
+        json >> p;
+        std::string priorities_error;
+        priorities_from_json(priorities, p, priorities_error);
+    }
+
+    if (watch_view.data)
+    {
+        plan_binary_reader r = watch_view.reader();
+        std::istringstream json(r.get_string());
+        Json::Value s;
+        json >> s;
+        std::string watch_error;
+        Watch.from_json(s, watch_error);
+    }
+
+    return true;
+}
@@ -1,5 +1,6 @@
 #include "plan_priorities.h"
 #include "ai.h"
+#include "job_index.h"
 #include "plan.h"
 
 #include <functional>
@@ -20,31 +21,19 @@ PLAN_PRIORITY_ENUMS
 #undef END_ENUM
 
 #define AI_ENUM_PROPERTY(type, name) \
-    if (name##_not.count(obj->name)) \
-    { \
-        return false; \
-    } \
-    if (!name.empty() && !name.count(obj->name)) \
+    if (!name##_table.is_match(obj->name)) \
     { \
         return false; \
     }
 #define DF_ENUM_PROPERTY(type, name) \
-    if (name##_not.count(obj->name)) \
-    { \
-        return false; \
-    } \
-    if (!name.empty() && !name.count(obj->name)) \
+    if (!name##_table.is_match(obj->name)) \
     { \
         return false; \
     }
 #define AI_ENUM_SET_PROPERTY(type, name) \
     for (auto e : obj->name) \
     { \
-        if (name##_not.count(e)) \
-        { \
-            return false; \
-        } \
-        if (!name.empty() && !name.count(e)) \
+        if (!name##_table.is_match(e)) \
         { \
             return false; \
         } \
@@ -52,11 +41,7 @@ PLAN_PRIORITY_ENUMS
 #define DF_ENUM_SET_PROPERTY(type, name) \
     for (auto e : obj->name) \
     { \
-        if (name##_not.count(e)) \
-        { \
-            return false; \
-        } \
-        if (!name.empty() && !name.count(e)) \
+        if (!name##_table.is_match(e)) \
         { \
             return false; \
         } \
@@ -146,6 +131,58 @@ bool plan_priority_t::furniture_filter_t::is_match(furniture * const & obj) cons
 #undef COUNT_PROPERTY
 #undef FILTER_PROPERTY
 
+#define AI_ENUM_PROPERTY(type, name) name##_table.compile(name, name##_not);
+#define DF_ENUM_PROPERTY(type, name) name##_table.compile(name, name##_not);
+#define AI_ENUM_SET_PROPERTY(type, name) name##_table.compile(name, name##_not);
+#define DF_ENUM_SET_PROPERTY(type, name) name##_table.compile(name, name##_not);
+#define STRING_PROPERTY(name)
+#define BOOL_PROPERTY(name, value)
+#define BETWEEN_PROPERTY(type, name, value)
+#define COUNT_PROPERTY(filter, name)
+#define FILTER_PROPERTY(filter, name)
+
+void plan_priority_t::room_filter_t::compile()
+{
+    ROOM_FILTER_PROPERTIES
+
+    // a change to the other room would not be noticed.
+    bool nested_fixed = true;
+    for (auto & f : workshop)
+    {
+        nested_fixed = nested_fixed && f.fixed;
+    }
+    for (auto & f : workshop_not)
+    {
+        nested_fixed = nested_fixed && f.fixed;
+    }
+
+    // everything not listed here is set when the room is planned.
+    tracked = nested_fixed &&
+        accesspath.empty() && accesspath_not.empty() &&
+        layout.empty() && layout_not.empty() &&
+        !has_owner.has_value && !has_squad.has_value &&
+        !users.has_min && !users.has_max &&
+        stock_disable.empty() && stock_disable_not.empty() &&
+        !has_users.has_min && !has_users.has_max &&
+        !queue_dig.has_value && !channeled.has_value;
+    fixed = tracked && status.empty() && status_not.empty() && !furnished.has_value;
+}
+
+void plan_priority_t::furniture_filter_t::compile()
+{
+    FURNITURE_FILTER_PROPERTIES
+}
+
+#undef AI_ENUM_PROPERTY
+#undef DF_ENUM_PROPERTY
+#undef AI_ENUM_SET_PROPERTY
+#undef DF_ENUM_SET_PROPERTY
+#undef STRING_PROPERTY
+#undef BOOL_PROPERTY
+#undef BETWEEN_PROPERTY
+#undef COUNT_PROPERTY
+#undef FILTER_PROPERTY
+
 #define STR2(x) #x
 #define STR(x) STR2(x)
 
@@ -434,6 +471,8 @@ bool plan_priority_t::apply(Json::Value & obj, std::string & error)
 
     checked = false;
     working = false;
+    counted = false;
+    counted_rooms = 0;
 
     name.clear();
     if (obj.isMember("name"))
@@ -455,6 +494,29 @@ bool plan_priority_t::apply(Json::Value & obj, std::string & error)
     FILTER_PROPERTY(room_filter_t, match)
     COUNT_PROPERTY(room_filter_t, count)
 
+    count_state.clear();
+    for (auto & c : count)
+    {
+        bool tracked = true;
+        for (auto & m : c.match)
+        {
+            tracked = tracked && m.tracked;
+        }
+        count_state.push_back(count_state_t{ tracked, 0, std::vector<bool>() });
+    }
+
+    candidates_tracked = true;
+    for (auto & m : match)
+    {
+        candidates_tracked = candidates_tracked && m.tracked;
+    }
+    for (auto & m : match_not)
+    {
+        candidates_tracked = candidates_tracked && m.tracked;
+    }
+    candidates.clear();
+    candidate_position.clear();
+
     return apply_unhandled_properties(obj, "priority", error);
 }
 
@@ -462,14 +524,26 @@ bool plan_priority_t::room_filter_t::apply(Json::Value & obj, std::string & erro
 {
     ROOM_FILTER_PROPERTIES
 
-    return apply_unhandled_properties(obj, "room filter", error);
+    if (!apply_unhandled_properties(obj, "room filter", error))
+    {
+        return false;
+    }
+
+    compile();
+    return true;
 }
 
 bool plan_priority_t::furniture_filter_t::apply(Json::Value & obj, std::string & error)
 {
     FURNITURE_FILTER_PROPERTIES
 
-    return apply_unhandled_properties(obj, "layout filter", error);
+    if (!apply_unhandled_properties(obj, "layout filter", error))
+    {
+        return false;
+    }
+
+    compile();
+    return true;
 }
 
 #undef AI_ENUM_PROPERTY
@@ -588,19 +662,12 @@ bool plan_priority_t::act(AI & ai, color_ostream & out, std::ostream & reason)
 {
     checked = true;
 
-    auto check_count = [this, &ai]() -> bool
+    if (!counted || counted_rooms != ai.plan.rooms_and_corridors.size())
     {
-        for (auto & c : count)
-        {
-            if (!c.is_match(ai.plan.rooms_and_corridors))
-            {
-                return false;
-            }
-        }
-        return true;
-    };
+        recount(ai.plan.rooms_and_corridors);
+    }
 
-    if (!check_count())
+    if (!check_count(ai.plan.rooms_and_corridors))
     {
         return false;
     }
@@ -611,127 +678,30 @@ bool plan_priority_t::act(AI & ai, color_ostream & out, std::ostream & reason)
         case plan_priority_action::dig_immediate:
         case plan_priority_action::unignore_furniture:
         case plan_priority_action::finish:
-            for (room *r : ai.plan.rooms_and_corridors)
+            if (candidates_tracked)
             {
-                if ((action == plan_priority_action::dig || action == plan_priority_action::dig_immediate) && r->status >= room_status::dug)
-                {
-                    continue;
-                }
-                if (action == plan_priority_action::unignore_furniture)
+                // act_on can take the room out of candidates.
+                for (auto it = candidates.begin(); it != candidates.end(); )
                 {
-                    bool any_unbuilt_furniture = false;
-                    for (auto f : r->layout)
-                    {
-                        if (f->type == layout_type::none)
-                        {
-                            continue;
-                        }
-
-                        if (f->bld_id == -1)
-                        {
-                            any_unbuilt_furniture = true;
-                            break;
-                        }
-
-                        auto bld = df::building::find(f->bld_id);
-                        if (!bld || bld->getBuildStage() != bld->getMaxBuildStage())
-                        {
-                            any_unbuilt_furniture = true;
-                            break;
-                        }
-                    }
-
-                    if (!any_unbuilt_furniture)
+                    size_t pos = it->first;
+                    bool result;
+                    if (act_on(ai, out, reason, it->second, result))
                     {
-                        continue;
+                        return result;
                     }
+                    it = candidates.upper_bound(pos);
                 }
-                if (action == plan_priority_action::finish && r->furnished)
-                {
-                    continue;
-                }
-
-                bool any_match = false;
-                for (auto & f : match_not)
-                {
-                    if (f.is_match(r))
-                    {
-                        any_match = true;
-                    }
-                }
-                if (any_match)
-                {
-                    continue;
-                }
-
-                for (auto & f : match)
+            }
+            else
+            {
+                for (room *r : ai.plan.rooms_and_corridors)
                 {
-                    if (f.is_match(r))
+                    bool result;
+                    if (act_on(ai, out, reason, r, result))
                     {
-                        any_match = true;
-                        break;
+                        return result;
                     }
                 }
-                if (!any_match)
-                {
-                    continue;
-                }
-
-                working = true;
-
-                switch (action)
-                {
-                    case plan_priority_action::dig:
-                        if (do_dig(ai, out, r))
-                        {
-                            reason << "want dig: " << AI::describe_room(r);
-                            if (!keep_going || !check_count())
-                            {
-                                return !keep_going;
-                            }
-                            reason << "; ";
-                        }
-                        break;
-                    case plan_priority_action::dig_immediate:
-                        if (do_dig_immediate(ai, out, r))
-                        {
-                            reason << "dig room: " << AI::describe_room(r);
-                            if (!keep_going || !check_count())
-                            {
-                                return !keep_going;
-                            }
-                            reason << "; ";
-                        }
-                        break;
-                    case plan_priority_action::unignore_furniture:
-                        if (do_unignore_furniture(ai, out, r))
-                        {
-                            reason << "furnishing: " << AI::describe_room(r);
-                            if (!keep_going || !check_count())
-                            {
-                                return !keep_going;
-                            }
-                            reason << "; ";
-                        }
-                        break;
-                    case plan_priority_action::finish:
-                        if (do_finish(ai, out, r))
-                        {
-                            reason << "finishing: " << AI::describe_room(r);
-                            if (!keep_going || !check_count())
-                            {
-                                return !keep_going;
-                            }
-                            reason << "; ";
-                        }
-                        break;
-                    case plan_priority_action::start_ore_search:
-                    case plan_priority_action::past_initial_phase:
-                    case plan_priority_action::deconstruct_wagons:
-                    case plan_priority_action::dig_next_cavern_outpost:
-                    case plan_priority_action::_plan_priority_action_count:
-                        break;
-                }
             }
             break;
         case plan_priority_action::start_ore_search:
@@ -772,6 +742,257 @@ bool plan_priority_t::act(AI & ai, color_ostream & out, std::ostream & reason)
     return false;
 }
 
+bool plan_priority_t::act_on(AI & ai, color_ostream & out, std::ostream & reason, room *r, bool & result)
+{
+    if ((action == plan_priority_action::dig || action == plan_priority_action::dig_immediate) && r->status >= room_status::dug)
+    {
+        return false;
+    }
+    if (action == plan_priority_action::unignore_furniture)
+    {
+        bool any_unbuilt_furniture = false;
+        for (auto f : r->layout)
+        {
+            if (f->type == layout_type::none)
+            {
+                continue;
+            }
+
+            if (f->bld_id == -1)
+            {
+                any_unbuilt_furniture = true;
+                break;
+            }
+
+            auto bld = df::building::find(f->bld_id);
+            if (!bld || bld->getBuildStage() != bld->getMaxBuildStage())
+            {
+                any_unbuilt_furniture = true;
+                break;
+            }
+        }
+
+        if (!any_unbuilt_furniture)
+        {
+            return false;
+        }
+    }
+    if (action == plan_priority_action::finish && r->furnished)
+    {
+        return false;
+    }
+
+    if (!candidates_tracked && !is_candidate(r))
+    {
+        return false;
+    }
+
+    working = true;
+
+    bool acted = false;
+    switch (action)
+    {
+        case plan_priority_action::dig:
+            if (do_dig(ai, out, r))
+            {
+                reason << "want dig: " << AI::describe_room(r);
+                acted = true;
+            }
+            break;
+        case plan_priority_action::dig_immediate:
+            if (do_dig_immediate(ai, out, r))
+            {
+                reason << "dig room: " << AI::describe_room(r);
+                acted = true;
+            }
+            break;
+        case plan_priority_action::unignore_furniture:
+            if (do_unignore_furniture(ai, out, r))
+            {
+                reason << "furnishing: " << AI::describe_room(r);
+                acted = true;
+            }
+            break;
+        case plan_priority_action::finish:
+            if (do_finish(ai, out, r))
+            {
+                reason << "finishing: " << AI::describe_room(r);
+                acted = true;
+            }
+            break;
+        case plan_priority_action::start_ore_search:
+        case plan_priority_action::past_initial_phase:
+        case plan_priority_action::deconstruct_wagons:
+        case plan_priority_action::dig_next_cavern_outpost:
+        case plan_priority_action::_plan_priority_action_count:
+            break;
+    }
+
+    if (!acted)
+    {
+        return false;
+    }
+    if (!keep_going || !check_count(ai.plan.rooms_and_corridors))
+    {
+        result = !keep_going;
+        return true;
+    }
+    reason << "; ";
+    return false;
+}
+
+bool plan_priority_t::check_count(const std::vector<room *> & rooms) const
+{
+    for (size_t i = 0; i < count.size(); i++)
+    {
+        auto & state = count_state.at(i);
+        if (state.tracked ? !count.at(i).is.is_match(state.matched) : !count.at(i).is_match(rooms))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool plan_priority_t::is_candidate(room *r) const
+{
+    for (auto & f : match_not)
+    {
+        if (f.is_match(r))
+        {
+            return false;
+        }
+    }
+
+    for (auto & f : match)
+    {
+        if (f.is_match(r))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool any_count_match(const plan_priority_t::count_t<plan_priority_t::room_filter_t> & c, room *r)
+{
+    for (auto & m : c.match)
+    {
+        if (m.is_match(r))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void plan_priority_t::recount(const std::vector<room *> & rooms)
+{
+    for (size_t i = 0; i < count.size(); i++)
+    {
+        auto & state = count_state.at(i);
+        state.matched = 0;
+        state.counted.clear();
+        if (!state.tracked)
+        {
+            continue;
+        }
+
+        for (auto r : rooms)
+        {
+            if (any_count_match(count.at(i), r))
+            {
+                if (state.counted.size() <= r->handle)
+                {
+                    state.counted.resize(r->handle + 1, false);
+                }
+                state.counted.at(r->handle) = true;
+                state.matched++;
+            }
+        }
+    }
+
+    candidates.clear();
+    candidate_position.clear();
+    if (candidates_tracked)
+    {
+        for (size_t pos = 0; pos < rooms.size(); pos++)
+        {
+            room *r = rooms.at(pos);
+            if (candidate_position.size() <= r->handle)
+            {
+                candidate_position.resize(r->handle + 1, std::numeric_limits<size_t>::max());
+            }
+            candidate_position.at(r->handle) = pos;
+            if (is_candidate(r))
+            {
+                candidates[pos] = r;
+            }
+        }
+    }
+
+    counted = true;
+    counted_rooms = rooms.size();
+}
+
+void plan_priority_t::room_changed(room *r)
+{
+    if (!counted)
+    {
+        return;
+    }
+
+    if (candidates_tracked)
+    {
+        if (r->handle >= candidate_position.size() || candidate_position.at(r->handle) == std::numeric_limits<size_t>::max())
+        {
+            // not in the plan when the candidates were collected.
+            counted = false;
+            return;
+        }
+
+        size_t pos = candidate_position.at(r->handle);
+        if (is_candidate(r))
+        {
+            candidates[pos] = r;
+        }
+        else
+        {
+            candidates.erase(pos);
+        }
+    }
+
+    for (size_t i = 0; i < count.size(); i++)
+    {
+        auto & state = count_state.at(i);
+        if (!state.tracked)
+        {
+            continue;
+        }
+
+        bool was = r->handle < state.counted.size() && state.counted.at(r->handle);
+        bool is = any_count_match(count.at(i), r);
+        if (was == is)
+        {
+            continue;
+        }
+
+        if (state.counted.size() <= r->handle)
+        {
+            state.counted.resize(r->handle + 1, false);
+        }
+        state.counted.at(r->handle) = is;
+        if (is)
+        {
+            state.matched++;
+        }
+        else
+        {
+            state.matched--;
+        }
+    }
+}
+
 bool plan_priority_t::do_dig(AI & ai, color_ostream & out, room *r)
 {
     return ai.plan.wantdig(out, r, r->outdoor ? 1 : 0);
@@ -791,6 +1012,7 @@ bool plan_priority_t::do_unignore_furniture(AI & ai, color_ostream & out, room *
         {
             any = true;
             f->ignore = false;
+            ai.plan.furniture_dirty(f);
         }
     }
 
@@ -815,10 +1037,12 @@ bool plan_priority_t::do_finish(AI & ai, color_ostream & out, room *r)
     }
 
     r->furnished = true;
+    ai.plan.room_changed(r);
 
     for (furniture *f : r->layout)
     {
         f->ignore = false;
+        ai.plan.furniture_dirty(f);
     }
 
     ai.plan.furnish_room(out, r);
@@ -856,6 +1080,7 @@ bool plan_priority_t::do_deconstruct_wagons(AI & ai, color_ostream &)
     for (auto wagon : world->buildings.other[buildings_other_id::WAGON])
     {
         Buildings::deconstruct(wagon);
+        job_index.invalidate();
     }
     ai.plan.deconstructed_wagons = true;
     return true;
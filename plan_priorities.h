@@ -4,6 +4,10 @@
 #include "json/json.h"
 #include "room.h"
 
+#include <algorithm>
+#include <limits>
+#include <map>
+
 class AI;
 struct task;
 
@@ -265,6 +269,63 @@ struct plan_priority_t
         }
     };
 
+    // A flattened enum set and its _not set: one flag per value between the
+    // smallest and largest value either set mentions. Values outside that
+    // range only match if the filter does not list any values to match.
+    template<typename enum_t>
+    struct enum_table_t
+    {
+        enum_table_t() : first(0), allowed(), allow_other(true)
+        {
+        }
+
+        int32_t first;
+        std::vector<bool> allowed;
+        bool allow_other;
+
+        inline bool is_match(enum_t e) const
+        {
+            int32_t i = int32_t(e) - first;
+            if (i < 0 || size_t(i) >= allowed.size())
+            {
+                return allow_other;
+            }
+            return allowed.at(size_t(i));
+        }
+
+        void compile(const std::set<enum_t> & match, const std::set<enum_t> & match_not)
+        {
+            allow_other = match.empty();
+            allowed.clear();
+            first = 0;
+            if (match.empty() && match_not.empty())
+            {
+                return;
+            }
+
+            int32_t last = std::numeric_limits<int32_t>::min();
+            first = std::numeric_limits<int32_t>::max();
+            for (auto & m : { &match, &match_not })
+            {
+                if (!m->empty())
+                {
+                    first = std::min(first, int32_t(*m->begin()));
+                    last = std::max(last, int32_t(*m->rbegin()));
+                }
+            }
+
+            allowed.resize(size_t(last - first + 1), allow_other);
+            for (auto e : match)
+            {
+                allowed.at(size_t(int32_t(e) - first)) = true;
+            }
+            for (auto e : match_not)
+            {
+                allowed.at(size_t(int32_t(e) - first)) = false;
+            }
+        }
+    };
+
 #define ROOM_FILTER_PROPERTIES \
     AI_ENUM_PROPERTY(room_status::status, status) \
     AI_ENUM_PROPERTY(room_type::type, type) \
@@ -308,10 +369,10 @@ struct plan_priority_t
     BOOL_PROPERTY(internal, internal) \
     STRING_PROPERTY(comment)
 
-#define AI_ENUM_PROPERTY(type, name) std::set<type> name, name##_not;
-#define DF_ENUM_PROPERTY(type, name) std::set<type> name, name##_not;
-#define AI_ENUM_SET_PROPERTY(type, name) std::set<type> name, name##_not;
-#define DF_ENUM_SET_PROPERTY(type, name) std::set<type> name, name##_not;
+#define AI_ENUM_PROPERTY(type, name) std::set<type> name, name##_not; enum_table_t<type> name##_table;
+#define DF_ENUM_PROPERTY(type, name) std::set<type> name, name##_not; enum_table_t<type> name##_table;
+#define AI_ENUM_SET_PROPERTY(type, name) std::set<type> name, name##_not; enum_table_t<type> name##_table;
+#define DF_ENUM_SET_PROPERTY(type, name) std::set<type> name, name##_not; enum_table_t<type> name##_table;
 #define STRING_PROPERTY(name) std::set<std::string> name, name##_not;
 #define BOOL_PROPERTY(name, value) bool_filter_t name;
 #define BETWEEN_PROPERTY(type, name, value) between_t<type> name;
@@ -328,18 +389,45 @@ struct plan_priority_t
 
         bool apply(Json::Value & val, std::string & error);
         Json::Value to_json() const;
+
+    private:
+        void compile();
     };
 
     struct room_filter_t
     {
         using object_type = room *;
 
+        room_filter_t() : tracked(false), fixed(false)
+        {
+        }
+
         ROOM_FILTER_PROPERTIES
 
+        // the filter only reads properties that never change once the room
+        // is in the plan, or that Plan::room_changed is told about.
+        bool tracked;
+        // the filter only reads properties that never change.
+        bool fixed;
+
         bool is_match(const object_type & obj) const;
 
         bool apply(Json::Value & val, std::string & error);
         Json::Value to_json() const;
+
+    private:
+        void compile();
+    };
+
+    // the number of rooms in the plan matching one entry of count. only
+    // kept for entries whose filters are all tracked; the rest are counted
+    // by walking every room.
+    struct count_state_t
+    {
+        bool tracked;
+        size_t matched;
+        // by room handle.
+        std::vector<bool> counted;
     };
 
     bool keep_going;
@@ -350,13 +438,34 @@ struct plan_priority_t
     FILTER_PROPERTY(room_filter_t, match)
     COUNT_PROPERTY(room_filter_t, count)
 
+    // false until the rooms are first counted, and again whenever rooms are
+    // added to or removed from the plan.
+    bool counted;
+    size_t counted_rooms;
+    std::vector<count_state_t> count_state;
+
+    // the rooms that pass match and match_not, keyed by their position in
+    // the plan so act visits them in plan order. only kept when every match
+    // and match_not filter is tracked; otherwise act walks every room.
+    bool candidates_tracked;
+    std::map<size_t, room *> candidates;
+    // by room handle.
+    std::vector<size_t> candidate_position;
+
     bool act(AI & ai, color_ostream & out, std::ostream & reason);
     bool match_task(task *t) const;
+    void recount(const std::vector<room *> & rooms);
+    void room_changed(room *r);
 
     bool apply(Json::Value & val, std::string & error);
     Json::Value to_json() const;
 
 private:
+    bool check_count(const std::vector<room *> & rooms) const;
+    bool is_candidate(room *r) const;
+    // returns true if act should stop and return result.
+    bool act_on(AI & ai, color_ostream & out, std::ostream & reason, room *r, bool & result);
+
     static bool do_dig(AI & ai, color_ostream & out, room *r);
     static bool do_dig_immediate(AI & ai, color_ostream & out, room *r);
     static bool do_unignore_furniture(AI & ai, color_ostream & out, room *r);
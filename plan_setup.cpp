@@ -2,6 +2,7 @@
 #include "plan_setup.h"
 #include "plan.h"
 #include "blueprint.h"
+#include "config.h"
 #include "debug.h"
 
 #include "df/inorganic_raw.h"
@@ -28,11 +29,94 @@ public:
     }
 };
 
+setup_worker_pool::setup_worker_pool(size_t thread_count) :
+    threads(),
+    mutex(),
+    wake(),
+    done(),
+    job(nullptr),
+    job_count(0),
+    next_job(0),
+    busy(0),
+    generation(0),
+    stopping(false)
+{
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        threads.emplace_back(&setup_worker_pool::work, this);
+    }
+}
+
+setup_worker_pool::~setup_worker_pool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto & t : threads)
+    {
+        t.join();
+    }
+}
+
+void setup_worker_pool::run(size_t count, const std::function<void(size_t)> & fn)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &fn;
+        job_count = count;
+        next_job = 0;
+        busy = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() -> bool { return busy == 0; });
+    job = nullptr;
+}
+
+void setup_worker_pool::drain()
+{
+    for (size_t i = next_job++; i < job_count; i = next_job++)
+    {
+        (*job)(i);
+    }
+}
+
+void setup_worker_pool::work()
+{
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wake.wait(lock, [this, &seen]() -> bool { return stopping || generation != seen; });
+        if (stopping)
+        {
+            return;
+        }
+        seen = generation;
+
+        lock.unlock();
+        drain();
+        lock.lock();
+
+        if (--busy == 0)
+        {
+            done.notify_one();
+        }
+    }
+}
+
 PlanSetup::PlanSetup(AI & ai) :
     ExclusiveCallback("blueprint setup", 2),
     ai(ai),
     next_noblesuite(0),
-    quieter_count(0)
+    quieter_count(0),
+    workers()
 {
 }
 
@@ -46,13 +130,28 @@ void PlanSetup::Run(color_ostream & out)
     plan_setup_screen_helper screen_helper(*this);
     ExpectScreen<viewscreen_ai_plan_setupst>("dfhack/df-ai/plan/setup");
 
+    Log("Scanning map...");
+    tiles.take();
+
+    size_t thread_count = config.plan_setup_threads > 0 ? size_t(config.plan_setup_threads) : size_t(std::thread::hardware_concurrency());
+    if (thread_count > 1)
+    {
+        workers = std::make_unique<setup_worker_pool>(thread_count - 1);
+    }
+
     Log("Reading blueprints...");
-    blueprints_t blueprints(out);
+    blueprints_t blueprints(out, workers.get());
 
-    if (build_from_blueprint(blueprints))
+    bool built = build_from_blueprint(blueprints);
+    if (built)
     {
         create_from_blueprint(ai.plan.fort_entrance, ai.plan.rooms_and_corridors, ai.plan.priorities);
+    }
+    workers.reset();
+    tiles.clear();
 
+    if (built)
+    {
         ai.plan.categorize_all();
 
         if (ai.plan.priorities.empty())
@@ -86,23 +185,14 @@ void PlanSetup::Run(color_ostream & out)
         mining_basis = veinshaft->pos();
     }
 
-    for (auto & vein : ai.plan.map_veins)
+    ai.plan.map_veins.set_basis(mining_basis);
+    for (int32_t mat : ai.plan.map_veins.materials())
     {
-        std::stable_sort(vein.second.begin(), vein.second.end(), [&](std::pair<df::coord, int32_t> a, std::pair<df::coord, int32_t> b) -> bool
-            {
-                auto dist = [](df::coord c0, df::coord c1) -> int32_t
-                {
-                    df::coord d = df::coord(c0.x * 16, c0.y * 16, c0.z) - c1;
-                    return d.x * d.x + d.y * d.y + d.z * d.z;
-                };
-                return dist(a.first, mining_basis) < dist(b.first, mining_basis);
-            });
-
-        auto ore = df::inorganic_raw::find(vein.first);
+        auto ore = df::inorganic_raw::find(mat);
         if (ore->flags.is_set(inorganic_flags::METAL_ORE))
         {
             LogQuiet("Planning tunnel to " + ore->id + " vein...", false);
-            ai.plan.dig_vein(out, vein.first, 0);
+            ai.plan.dig_vein(out, mat, 0);
         }
     }
 
@@ -298,7 +388,7 @@ void PlanSetup::create_from_blueprint(room * & fort_entrance, std::vector<room *
             {
                 for (t.y = in->min.y; t.y <= in->max.y; t.y++)
                 {
-                    int16_t z = Plan::surface_tile_at(t.x, t.y, true).z;
+                    int16_t z = tiles.surface(t.x, t.y).z;
                     for (t.z = in->min.z; t.z <= in->max.z; t.z++)
                     {
                         bool has_layout = false;
@@ -5,6 +5,13 @@
 #include "stocks.h"
 #include "exclusive_callback.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "modules/Screen.h"
 
 class PlanSetup;
@@ -23,6 +30,114 @@ public:
     static virtual_identity _identity;
 };
 
+// Read-only copy of the tile properties checked while placing blueprints,
+// stored as one bit per tile per property so that each row of a box can be
+// tested 64 tiles at a time.
+struct tile_snapshot_t
+{
+    enum flag_t
+    {
+        wall, // wall shaped, not part of a tree
+        tree,
+        water, // has liquid or is a pool, river, or brook
+        building,
+        stone, // stone, mineral, or feature stone material
+        frozen,
+        grass,
+
+        flag_count
+    };
+
+    tile_snapshot_t();
+
+    void take();
+    void clear();
+
+    // first tile (in z, y, x order) in the box where the flag equals value,
+    // or an invalid coordinate if there is none.
+    df::coord find(flag_t flag, df::coord min, df::coord max, bool value = true) const;
+    int32_t count(flag_t flag, df::coord min, df::coord max) const;
+    df::coord surface(int16_t x, int16_t y) const;
+
+private:
+    int16_t x_count, y_count, z_count;
+    size_t row_words;
+    std::vector<uint64_t> planes[flag_count];
+    std::vector<df::coord> surface_tiles;
+
+    inline size_t row_index(int16_t y, int16_t z) const
+    {
+        return (size_t(z) * size_t(y_count) + size_t(y)) * row_words;
+    }
+    bool clip(df::coord & min, df::coord & max) const;
+};
+
+// Tiles claimed for one purpose (corridor, interior, no_room, or no_corridor)
+// by the rooms placed so far. Each z level with a claim gets a dense grid of
+// owner tags and one bit per tile, 64 tiles to a word along x, so each run of
+// a candidate blueprint is tested a word at a time. Tag 0 means unclaimed.
+// Tiles outside the map are never claimed.
+class tile_claims_t
+{
+public:
+    typedef uint16_t tag_t;
+
+    tile_claims_t();
+
+    void clear();
+    tag_t at(df::coord t) const;
+    inline bool count(df::coord t) const
+    {
+        return at(t) != 0;
+    }
+    void set(df::coord t, tag_t tag);
+    // first claimed tile of the runs moved by offset, or an invalid
+    // coordinate if none of them are claimed.
+    df::coord find(const std::vector<blueprint_tile_run> & runs, df::coord offset) const;
+
+private:
+    struct layer_t
+    {
+        std::vector<tag_t> tags;
+        std::vector<uint64_t> bits;
+    };
+
+    int16_t x_count, y_count, z_count;
+    size_t row_words;
+    std::vector<std::unique_ptr<layer_t>> layers;
+
+    const layer_t *layer(int16_t z) const;
+    uint64_t row_bits(const layer_t & l, int16_t x, int16_t y) const;
+};
+
+// Fixed set of threads used to check candidate room positions. run() hands
+// out job indexes to the workers and to the calling thread, and returns once
+// every job in the batch has finished.
+class setup_worker_pool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)> *job;
+    size_t job_count;
+    std::atomic<size_t> next_job;
+    size_t busy;
+    uint64_t generation;
+    bool stopping;
+
+public:
+    explicit setup_worker_pool(size_t thread_count);
+    ~setup_worker_pool();
+
+    inline size_t size() const { return threads.size() + 1; }
+    void run(size_t count, const std::function<void(size_t)> & fn);
+
+private:
+    void drain();
+    void work();
+};
+
 class PlanSetup : public ExclusiveCallback
 {
     AI & ai;
@@ -36,10 +151,27 @@ class PlanSetup : public ExclusiveCallback
     int32_t military_min, military_max;
 
     std::map<df::coord, std::pair<room_base::roomindex_t, std::map<std::string, variable_string::context_t>>> room_connect;
-    std::map<df::coord, std::string> corridor;
-    std::map<df::coord, std::string> interior;
-    std::map<df::coord, std::string> no_room;
-    std::map<df::coord, std::string> no_corridor;
+    tile_claims_t corridor;
+    tile_claims_t interior;
+    tile_claims_t no_room;
+    tile_claims_t no_corridor;
+    // names of the blueprints that claimed tiles, by tag. only needed for
+    // messages and for telling a room's own tiles apart.
+    std::vector<std::string> claim_owners;
+    std::map<std::string, tile_claims_t::tag_t> claim_tags;
+
+    tile_snapshot_t tiles;
+
+    struct placement_t
+    {
+        const room_blueprint *rb;
+        df::coord pos;
+        room_base::roomindex_t parent;
+        variable_string::context_t context;
+        bool connect;
+        bool ok;
+    };
+    std::unique_ptr<setup_worker_pool> workers;
 
 public:
     std::vector<std::pair<std::string, bool>> log;
@@ -56,23 +188,28 @@ private:
     void create_from_blueprint(room * & fort_entrance, std::vector<room *> & real_rooms_and_corridors, std::vector<plan_priority_t> & real_priorities) const;
 
     typedef void (PlanSetup::*find_fn)(std::vector<const room_blueprint *> &, const std::map<std::string, size_t> &, const std::map<std::string, std::map<std::string, size_t>> &, const blueprints_t &, const blueprint_plan_template &);
-    typedef bool (PlanSetup::*try_add_fn)(const room_blueprint &, std::map<std::string, size_t> &, std::map<std::string, std::map<std::string, size_t>> &, const blueprint_plan_template &);
-
-    bool add(const room_blueprint & rb, std::string & error, df::coord exit_location = df::coord());
-    bool add(const room_blueprint & rb, room_base::roomindex_t parent, std::string & error, df::coord exit_location = df::coord());
+    typedef bool (PlanSetup::*pick_fn)(const room_blueprint &, const blueprint_plan_template &, placement_t &);
+
+    bool add(const placed_blueprint & pb, std::string & error, df::coord exit_location = df::coord());
+    bool add(const placed_blueprint & pb, room_base::roomindex_t parent, std::string & error, df::coord exit_location = df::coord());
+    bool add(const placed_blueprint & pb, const room_base::roomindex_t *parent, std::string & error, df::coord exit_location);
+    tile_claims_t::tag_t claim_tag(const std::string & owner);
+    // 0 if nothing has been claimed by owner.
+    tile_claims_t::tag_t find_claim_tag(const std::string & owner) const;
     void add_count(const room_blueprint & rb, const blueprint_plan_template & plan, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts);
     bool build(const blueprints_t & blueprints, const blueprint_plan_template & plan);
-    void place_rooms(std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, find_fn find, try_add_fn try_add);
+    void place_rooms(std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, find_fn find, pick_fn pick);
     void clear();
     void find_available_blueprints(std::vector<const room_blueprint *> & available_blueprints, const std::map<std::string, size_t> & counts, const std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, const std::set<std::string> & available_tags_base, const std::function<bool(const room_blueprint &)> & check);
     void find_available_blueprints_start(std::vector<const room_blueprint *> & available_blueprints, const std::map<std::string, size_t> & counts, const std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan);
     void find_available_blueprints_outdoor(std::vector<const room_blueprint *> & available_blueprints, const std::map<std::string, size_t> & counts, const std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan);
     void find_available_blueprints_connect(std::vector<const room_blueprint *> & available_blueprints, const std::map<std::string, size_t> & counts, const std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan);
-    bool can_add_room(const room_blueprint & rb, df::coord pos);
-    bool try_add_room_start(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan);
-    bool try_add_room_outdoor(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan);
-    bool try_add_room_outdoor_shared(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan, int16_t x, int16_t y);
-    bool try_add_room_connect(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan);
+    bool can_add_room(const room_blueprint & rb, df::coord pos) const;
+    bool pick_room_start(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement);
+    bool pick_room_outdoor(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement);
+    bool pick_room_outdoor_shared(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement, int16_t x, int16_t y);
+    bool pick_room_connect(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement);
+    bool commit_room(const placement_t & placement, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan);
     bool have_minimum_requirements(std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan);
     void remove_unused_rooms();
     void handle_stairs_special();
@@ -5,7 +5,6 @@
 
 #include "modules/Maps.h"
 
-#include "df/block_square_event_grassst.h"
 #include "df/feature_init_outdoor_riverst.h"
 #include "df/feature_outdoor_riverst.h"
 #include "df/map_block.h"
@@ -17,39 +16,43 @@
 
 REQUIRE_GLOBAL(world);
 
-bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VARIABLE_IS_NOT_USED exit_location)
+bool PlanSetup::add(const placed_blueprint & pb, std::string & error, df::coord exit_location)
 {
-    for (auto c : rb.corridor)
+    return add(pb, nullptr, error, exit_location);
+}
+
+bool PlanSetup::add(const placed_blueprint & pb, room_base::roomindex_t parent, std::string & error, df::coord exit_location)
+{
+    return add(pb, &parent, error, exit_location);
+}
+
+bool PlanSetup::add(const placed_blueprint & pb, const room_base::roomindex_t *parent, std::string & error, df::coord VARIABLE_IS_NOT_USED exit_location)
+{
+    const room_blueprint & rb = pb.base;
+
+    df::coord hit = no_corridor.find(rb.corridor_runs, pb.offset);
+    if (hit.isValid())
     {
-        if (no_corridor.count(c))
-        {
-            error = "room corridor intersects no_corridor tile (" + no_corridor.at(c) + ")";
-            return false;
-        }
+        error = "room corridor intersects no_corridor tile (" + claim_owners.at(no_corridor.at(hit)) + ")";
+        return false;
     }
-    for (auto c : rb.interior)
+    hit = no_room.find(rb.interior_runs, pb.offset);
+    if (hit.isValid())
     {
-        if (no_room.count(c))
-        {
-            error = "room interior intersects no_room tile (" + no_room.at(c) + ")";
-            return false;
-        }
+        error = "room interior intersects no_room tile (" + claim_owners.at(no_room.at(hit)) + ")";
+        return false;
     }
-    for (auto c : rb.no_corridor)
+    hit = corridor.find(rb.no_corridor_runs, pb.offset);
+    if (hit.isValid())
     {
-        if (corridor.count(c))
-        {
-            error = "room no_corridor intersects corridor tile (" + corridor.at(c) + ")";
-            return false;
-        }
+        error = "room no_corridor intersects corridor tile (" + claim_owners.at(corridor.at(hit)) + ")";
+        return false;
     }
-    for (auto c : rb.no_room)
+    hit = interior.find(rb.no_room_runs, pb.offset);
+    if (hit.isValid())
     {
-        if (interior.count(c))
-        {
-            error = "room no_room intersects interior tile (" + interior.at(c) + ")";
-            return false;
-        }
+        error = "room no_room intersects interior tile (" + claim_owners.at(interior.at(hit)) + ")";
+        return false;
     }
 
     room_base::layoutindex_t layout_start = layout.size();
@@ -60,6 +63,7 @@ bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VA
     for (auto f : rb.layout)
     {
         f = new room_base::furniture_t(*f);
+        f->context = pb.context;
         f->shift(layout_start, room_start);
         layout.push_back(f);
     }
@@ -67,7 +71,14 @@ bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VA
     for (auto r : rb.rooms)
     {
         r = new room_base::room_t(*r);
+        r->context = pb.context;
+        r->min = r->min + pb.offset;
+        r->max = r->max + pb.offset;
         r->shift(layout_start, room_start);
+        if (parent)
+        {
+            r->accesspath.push_back(*parent);
+        }
         if (r->noblesuite != -1)
         {
             r->noblesuite += noblesuite_start;
@@ -92,19 +103,22 @@ bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VA
         }
     }
 
+    tile_claims_t::tag_t owner = claim_tag(rb.type + "/" + rb.tmpl_name + "/" + rb.name);
+
     for (auto c : rb.corridor)
     {
-        corridor[c] = rb.type + "/" + rb.tmpl_name + "/" + rb.name;
+        corridor.set(c + pb.offset, owner);
     }
 
     for (auto c : rb.interior)
     {
-        interior[c] = rb.type + "/" + rb.tmpl_name + "/" + rb.name;
+        interior.set(c + pb.offset, owner);
     }
 
     for (auto c : rb.no_room)
     {
-        no_room[c] = rb.type + "/" + rb.tmpl_name + "/" + rb.name;
+        c = c + pb.offset;
+        no_room.set(c, owner);
 #ifndef DFAI_RELEASE
         auto old_connect = room_connect.find(c);
         if (old_connect != room_connect.end())
@@ -115,7 +129,7 @@ bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VA
             {
                 if (c != exit_location || exit.first != rb.type)
                 {
-                    DFAI_DEBUG(blueprint, 5, "Removing blocked " << exit.first << " exit on " << r->blueprint << " at " << DBG_COORD_PLUS(rp, c - rp) << " - blocked by " << DBG_ROOM(rb) << " " << DBG_COORD(c - rb.origin) << ")");
+                    DFAI_DEBUG(blueprint, 5, "Removing blocked " << exit.first << " exit on " << r->blueprint << " at " << DBG_COORD_PLUS(rp, c - rp) << " - blocked by " << DBG_ROOM(rb) << " " << DBG_COORD(c - pb.origin()) << ")");
                 }
             }
         }
@@ -125,23 +139,36 @@ bool PlanSetup::add(const room_blueprint & rb, std::string & error, df::coord VA
 
     for (auto c : rb.no_corridor)
     {
-        no_corridor[c] = rb.type + "/" + rb.tmpl_name + "/" + rb.name;
+        no_corridor.set(c + pb.offset, owner);
     }
 
     return true;
 }
 
-bool PlanSetup::add(const room_blueprint & rb, room_base::roomindex_t parent, std::string & error, df::coord exit_location)
+tile_claims_t::tag_t PlanSetup::claim_tag(const std::string & owner)
 {
-    parent += (~rooms.size()) + 1;
+    if (claim_owners.empty())
+    {
+        // tag 0 is unclaimed.
+        claim_owners.push_back(std::string());
+    }
 
-    room_blueprint rb_parent(rb);
-    for (auto r : rb_parent.rooms)
+    auto it = claim_tags.find(owner);
+    if (it != claim_tags.end())
     {
-        r->accesspath.push_back(parent);
+        return it->second;
     }
 
-    return add(rb_parent, error, exit_location);
+    tile_claims_t::tag_t tag = tile_claims_t::tag_t(claim_owners.size());
+    claim_owners.push_back(owner);
+    claim_tags[owner] = tag;
+    return tag;
+}
+
+tile_claims_t::tag_t PlanSetup::find_claim_tag(const std::string & owner) const
+{
+    auto it = claim_tags.find(owner);
+    return it == claim_tags.end() ? 0 : it->second;
 }
 
 void PlanSetup::add_count(const room_blueprint & rb, const blueprint_plan_template & plan, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts)
@@ -173,7 +200,7 @@ bool PlanSetup::build(const blueprints_t & blueprints, const blueprint_plan_temp
     std::map<std::string, std::map<std::string, size_t>> instance_counts;
 
     DFAI_DEBUG(blueprint, 1, "Placing starting room...");
-    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_start, &PlanSetup::try_add_room_start);
+    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_start, &PlanSetup::pick_room_start);
     if (rooms.empty())
     {
         DFAI_DEBUG(blueprint, 1, "No rooms placed by initial phase. Cannot continue building.");
@@ -181,10 +208,10 @@ bool PlanSetup::build(const blueprints_t & blueprints, const blueprint_plan_temp
     }
 
     DFAI_DEBUG(blueprint, 1, "Placing outdoor rooms...");
-    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_outdoor, &PlanSetup::try_add_room_outdoor);
+    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_outdoor, &PlanSetup::pick_room_outdoor);
 
     DFAI_DEBUG(blueprint, 1, "Building remainder of fortress...");
-    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_connect, &PlanSetup::try_add_room_connect);
+    place_rooms(counts, instance_counts, blueprints, plan, &PlanSetup::find_available_blueprints_connect, &PlanSetup::pick_room_connect);
 
     if (!have_minimum_requirements(counts, instance_counts, plan))
     {
@@ -207,9 +234,25 @@ bool PlanSetup::build(const blueprints_t & blueprints, const blueprint_plan_temp
     return true;
 }
 
-void PlanSetup::place_rooms(std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, PlanSetup::find_fn find, PlanSetup::try_add_fn try_add)
+void PlanSetup::place_rooms(std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, PlanSetup::find_fn find, PlanSetup::pick_fn pick)
 {
+    // Candidates are picked on this thread in the same order (and with the
+    // same random numbers) as a one-at-a-time search would use. Only the
+    // read-only can_add_room check is done on the worker threads, and the
+    // first candidate that passes is committed, so the result for a given
+    // seed does not depend on the number of threads.
+    bool parallel = workers && workers->size() > 1 && debug_category_config.blueprint < 4;
+    size_t batch_size = parallel ? workers->size() * 4 : 1;
+
     std::vector<const room_blueprint *> available_blueprints;
+    std::vector<placement_t> batch;
+    std::vector<std::mt19937> rng_after;
+    std::function<void(size_t)> check = [&](size_t i)
+    {
+        auto & p = batch.at(i);
+        p.ok = p.ok && can_add_room(*p.rb, p.pos);
+    };
+
     for (;;)
     {
         available_blueprints.clear();
@@ -224,21 +267,49 @@ void PlanSetup::place_rooms(std::map<std::string, size_t> & counts, std::map<std
 
         bool stop = false;
         size_t failures = 0;
+        size_t next_blueprint = 0;
         while (!stop)
         {
-            for (auto rb : available_blueprints)
+            size_t count = std::max<size_t>(std::min(batch_size, plan.max_failures - failures), 1);
+            batch.resize(count);
+            rng_after.clear();
+            for (auto & p : batch)
+            {
+                p.rb = available_blueprints.at(next_blueprint);
+                next_blueprint = (next_blueprint + 1) % available_blueprints.size();
+                p.ok = (this->*pick)(*p.rb, plan, p);
+                if (parallel)
+                {
+                    rng_after.push_back(ai.rng);
+                }
+            }
+
+            if (parallel)
             {
-                if (!(this->*try_add)(*rb, counts, instance_counts, plan))
+                workers->run(batch.size(), check);
+            }
+            else
+            {
+                check(0);
+            }
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                auto & p = batch.at(i);
+                if (p.ok && commit_room(p, counts, instance_counts, plan))
                 {
-                    failures++;
-                    DFAI_DEBUG(blueprint, 4, "Failed to place room " << DBG_ROOM(*rb) << ". Failure count: " << failures << " of " << plan.max_failures << ".");
-                    if (failures >= plan.max_failures)
+                    if (parallel)
                     {
-                        stop = true;
-                        break;
+                        // rewind the candidates we picked but did not need
+                        ai.rng = rng_after.at(i);
                     }
+                    stop = true;
+                    break;
                 }
-                else
+
+                failures++;
+                DFAI_DEBUG(blueprint, 4, "Failed to place room " << DBG_ROOM(*p.rb) << ". Failure count: " << failures << " of " << plan.max_failures << ".");
+                if (failures >= plan.max_failures)
                 {
                     stop = true;
                     break;
@@ -273,6 +344,8 @@ void PlanSetup::clear()
     interior.clear();
     no_room.clear();
     no_corridor.clear();
+    claim_owners.clear();
+    claim_tags.clear();
 }
 
 void PlanSetup::find_available_blueprints(std::vector<const room_blueprint *> & available_blueprints, const std::map<std::string, size_t> & counts, const std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprints_t & blueprints, const blueprint_plan_template & plan, const std::set<std::string> & available_tags_base, const std::function<bool(const room_blueprint &)> & check)
@@ -393,7 +466,7 @@ void PlanSetup::find_available_blueprints_connect(std::vector<const room_bluepri
     find_available_blueprints(available_blueprints, counts, instance_counts, blueprints, plan, available_tags, [](const room_blueprint &) -> bool { return true; });
 }
 
-bool PlanSetup::can_add_room(const room_blueprint & rb, df::coord pos)
+bool PlanSetup::can_add_room(const room_blueprint & rb, df::coord pos) const
 {
     for (auto c : rb.no_room)
     {
@@ -417,58 +490,40 @@ bool PlanSetup::can_add_room(const room_blueprint & rb, df::coord pos)
 
         if (r->outdoor)
         {
-            for (df::coord t = min; t.x <= max.x; t.x++)
+            df::coord t = tiles.find(tile_snapshot_t::wall, min, max);
+            if (t.isValid())
+            {
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is underground");
+                return false;
+            }
+
+            if (r->require_floor)
             {
-                for (t.y = min.y; t.y <= max.y; t.y++)
+                for (t = min; t.x <= max.x; t.x++)
                 {
-                    for (t.z = min.z; t.z <= max.z; t.z++)
+                    for (t.y = min.y; t.y <= max.y; t.y++)
                     {
-                        df::tiletype tt = *Maps::getTileType(t);
-                        if (ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) == tiletype_shape_basic::Wall && ENUM_ATTR(tiletype, material, tt) != tiletype_material::TREE)
-                        {
-                            DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is underground");
-                            return false;
-                        }
-
-                        if (r->require_floor && Plan::surface_tile_at(t.x, t.y, true).z != t.z)
+                        int16_t z = tiles.surface(t.x, t.y).z;
+                        if (z != min.z || z != max.z)
                         {
+                            t.z = z != min.z ? min.z : max.z;
                             DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is not on the ground");
                             return false;
                         }
-
-                        auto building = Maps::getTileOccupancy(t)->bits.building;
-                        if (building != tile_building_occ::None)
-                        {
-                            DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " contains building " << enum_item_key_str(building));
-                            return false;
-                        }
                     }
                 }
             }
 
-            if (r->require_grass > 0)
+            t = tiles.find(tile_snapshot_t::building, min, max);
+            if (t.isValid())
             {
-                int32_t grass_count = 0;
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " contains building " << enum_item_key_str(Maps::getTileOccupancy(t)->bits.building));
+                return false;
+            }
 
-                for (df::coord t = min; t.x <= max.x; t.x++)
-                {
-                    for (t.y = min.y; t.y <= max.y; t.y++)
-                    {
-                        for (t.z = min.z; t.z <= max.z; t.z++)
-                        {
-                            auto & events = Maps::getTileBlock(t)->block_events;
-                            for (auto be : events)
-                            {
-                                df::block_square_event_grassst *grass = virtual_cast<df::block_square_event_grassst>(be);
-                                if (grass && grass->amount[t.x & 0xf][t.y & 0xf] > 0)
-                                {
-                                    grass_count++;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
+            if (r->require_grass > 0)
+            {
+                int32_t grass_count = tiles.count(tile_snapshot_t::grass, min, max);
 
                 if (grass_count < r->require_grass)
                 {
@@ -508,79 +563,53 @@ bool PlanSetup::can_add_room(const room_blueprint & rb, df::coord pos)
                 if (f->dig != tile_dig_designation::No && f->dig != tile_dig_designation::Default && f->dig != tile_dig_designation::UpStair && f->dig != tile_dig_designation::Ramp)
                 {
                     df::coord t = min + f->pos;
-                    for (int16_t dx = -1; dx <= 1; dx++)
+                    if (tiles.find(tile_snapshot_t::wall, t + df::coord(-1, -1, -1), t + df::coord(1, 1, -1), false).isValid())
                     {
-                        for (int16_t dy = -1; dy <= 1; dy++)
-                        {
-                            df::tiletype tt = *Maps::getTileType(t + df::coord(dx, dy, -1));
-                            if (ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) != tiletype_shape_basic::Wall || ENUM_ATTR(tiletype, material, tt) == tiletype_material::TREE)
-                            {
-                                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << enum_item_key_str(f->dig) << " is directly above a cavern");
-                                return false;
-                            }
-                        }
+                        DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << enum_item_key_str(f->dig) << " is directly above a cavern");
+                        return false;
                     }
                 }
             }
 
-            for (df::coord t = min - df::coord(1, 1, 0); t.x <= max.x + 1; t.x++)
+            df::coord t = tiles.find(tile_snapshot_t::water, min - df::coord(1, 1, 0), max + df::coord(1, 1, 1));
+            if (t.isValid())
             {
-                for (t.y = min.y - 1; t.y <= max.y + 1; t.y++)
-                {
-                    for (t.z = min.z; t.z <= max.z + 1; t.z++)
-                    {
-                        df::tiletype tt = *Maps::getTileType(t);
-                        auto des = *Maps::getTileDesignation(t);
-                        if (des.bits.flow_size > 0 || ENUM_ATTR(tiletype, material, tt) == tiletype_material::POOL || ENUM_ATTR(tiletype, material, tt) == tiletype_material::RIVER || ENUM_ATTR(tiletype, material, tt) == tiletype_material::BROOK)
-                        {
-                            DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " has water");
-                            return false;
-                        }
-
-                        if (t.z == max.z + 1)
-                        {
-                            continue;
-                        }
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " has water");
+                return false;
+            }
 
-                        if (ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) != tiletype_shape_basic::Wall || ENUM_ATTR(tiletype, material, tt) == tiletype_material::TREE)
-                        {
-                            DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is above ground");
-                            return false;
-                        }
+            t = tiles.find(tile_snapshot_t::wall, min - df::coord(1, 1, 0), max + df::coord(1, 1, 0), false);
+            if (t.isValid())
+            {
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is above ground");
+                return false;
+            }
 
-                        auto building = Maps::getTileOccupancy(t)->bits.building;
-                        if (building != tile_building_occ::None)
-                        {
-                            DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " contains building (" << enum_item_key_str(building) << ")");
-                            return false;
-                        }
+            t = tiles.find(tile_snapshot_t::building, min - df::coord(1, 1, 0), max + df::coord(1, 1, 0));
+            if (t.isValid())
+            {
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " contains building (" << enum_item_key_str(Maps::getTileOccupancy(t)->bits.building) << ")");
+                return false;
+            }
 
-                        if (r->require_stone)
-                        {
-                            auto mat = ENUM_ATTR(tiletype, material, tt);
-                            if (mat != tiletype_material::STONE && mat != tiletype_material::MINERAL && mat != tiletype_material::FEATURE)
-                            {
-                                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is not stone (" << enum_item_key_str(mat) << ")");
-                                return false;
-                            }
-                        }
-                    }
+            if (r->require_stone)
+            {
+                t = tiles.find(tile_snapshot_t::stone, min - df::coord(1, 1, 0), max + df::coord(1, 1, 0), false);
+                if (t.isValid())
+                {
+                    DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is not stone (" << enum_item_key_str(ENUM_ATTR(tiletype, material, *Maps::getTileType(t))) << ")");
+                    return false;
                 }
             }
         }
 
         if (r->type == room_type::farmplot)
         {
-            for (df::coord t = min - df::coord(0, 0, 1); t.x <= max.x; t.x++)
+            df::coord t = tiles.find(tile_snapshot_t::frozen, min - df::coord(0, 0, 1), df::coord(max.x, max.y, min.z - 1));
+            if (t.isValid())
             {
-                for (t.y = min.y; t.y <= max.y; t.y++)
-                {
-                    if (ENUM_ATTR(tiletype, material, *Maps::getTileType(t)) == tiletype_material::FROZEN_LIQUID)
-                    {
-                        DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is ice");
-                        return false;
-                    }
-                }
+                DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << DBG_COORD(t) << " is ice");
+                return false;
             }
         }
     }
@@ -588,7 +617,7 @@ bool PlanSetup::can_add_room(const room_blueprint & rb, df::coord pos)
     return true;
 }
 
-bool PlanSetup::try_add_room_start(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan)
+bool PlanSetup::pick_room_start(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement)
 {
     int16_t min_x = plan.padding_x.first, max_x = plan.padding_x.second, min_y = plan.padding_y.first, max_y = plan.padding_y.second;
     for (auto c : rb.no_room)
@@ -602,10 +631,10 @@ bool PlanSetup::try_add_room_start(const room_blueprint & rb, std::map<std::stri
     int16_t x = std::uniform_int_distribution<int16_t>(2 - min_x, world->map.x_count - 3 - max_x)(ai.rng);
     int16_t y = std::uniform_int_distribution<int16_t>(2 - min_y, world->map.y_count - 3 - max_y)(ai.rng);
 
-    return try_add_room_outdoor_shared(rb, counts, instance_counts, plan, x, y);
+    return pick_room_outdoor_shared(rb, plan, placement, x, y);
 }
 
-bool PlanSetup::try_add_room_outdoor(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan)
+bool PlanSetup::pick_room_outdoor(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement)
 {
     int16_t min_x = 0, max_x = 0, min_y = 0, max_y = 0;
     for (auto c : rb.no_room)
@@ -619,37 +648,25 @@ bool PlanSetup::try_add_room_outdoor(const room_blueprint & rb, std::map<std::st
     int16_t x = std::uniform_int_distribution<int16_t>(2 - min_x, world->map.x_count - 3 - max_x)(ai.rng);
     int16_t y = std::uniform_int_distribution<int16_t>(2 - min_y, world->map.y_count - 3 - max_y)(ai.rng);
 
-    return try_add_room_outdoor_shared(rb, counts, instance_counts, plan, x, y);
+    return pick_room_outdoor_shared(rb, plan, placement, x, y);
 }
 
-bool PlanSetup::try_add_room_outdoor_shared(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan, int16_t x, int16_t y)
+bool PlanSetup::pick_room_outdoor_shared(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement, int16_t x, int16_t y)
 {
-    df::coord pos = Plan::surface_tile_at(x, y, true);
+    placement.pos = tiles.surface(x, y);
+    placement.context = plan.context;
+    placement.connect = false;
 
-    if (!pos.isValid())
+    if (!placement.pos.isValid())
     {
         DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at (" << x << ", " << y << ", ?): no surface position");
         return false;
     }
 
-    if (can_add_room(rb, pos))
-    {
-        std::string error;
-        if (add(room_blueprint(rb, pos, plan.context), error))
-        {
-            add_count(rb, plan, counts, instance_counts);
-            DFAI_DEBUG(blueprint, 3, "Placed " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ".");
-            LogQuiet(stl_sprintf("Placed %s/%s/%s at (%d, %d, %d)", rb.type.c_str(), rb.tmpl_name.c_str(), rb.name.c_str(), pos.x, pos.y, pos.z), true);
-            return true;
-        }
-
-        DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << error);
-    }
-
-    return false;
+    return true;
 }
 
-bool PlanSetup::try_add_room_connect(const room_blueprint & rb, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan)
+bool PlanSetup::pick_room_connect(const room_blueprint & rb, const blueprint_plan_template & plan, placement_t & placement)
 {
     std::set<std::string> tags;
     tags.insert(rb.type);
@@ -677,20 +694,33 @@ bool PlanSetup::try_add_room_connect(const room_blueprint & rb, std::map<std::st
 
     auto chosen = connectors.at(std::uniform_int_distribution<size_t>(0, connectors.size() - 1)(ai.rng));
 
-    if (can_add_room(rb, std::get<1>(chosen)))
-    {
-        std::string error;
-        if (add(room_blueprint(rb, std::get<1>(chosen), std::get<2>(chosen)), std::get<0>(chosen), error, std::get<1>(chosen)))
-        {
-            add_count(rb, plan, counts, instance_counts);
-            DFAI_DEBUG(blueprint, 3, "Placed " << DBG_ROOM(rb) << " at " << DBG_COORD(std::get<1>(chosen)) << ".");
-            LogQuiet(stl_sprintf("Placed %s/%s/%s at (%d, %d, %d)", rb.type.c_str(), rb.tmpl_name.c_str(), rb.name.c_str(), std::get<1>(chosen).x, std::get<1>(chosen).y, std::get<1>(chosen).z), true);
-            return true;
-        }
+    placement.parent = std::get<0>(chosen);
+    placement.pos = std::get<1>(chosen);
+    placement.context = std::get<2>(chosen);
+    placement.connect = true;
+
+    return true;
+}
 
-        DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(std::get<1>(chosen)) << ": " << error);
+bool PlanSetup::commit_room(const placement_t & placement, std::map<std::string, size_t> & counts, std::map<std::string, std::map<std::string, size_t>> & instance_counts, const blueprint_plan_template & plan)
+{
+    const room_blueprint & rb = *placement.rb;
+    df::coord pos = placement.pos;
+
+    std::string error;
+    placed_blueprint pb(rb, pos, placement.context);
+    bool ok = placement.connect ?
+        add(pb, placement.parent, error, pos) :
+        add(pb, error);
+    if (ok)
+    {
+        add_count(rb, plan, counts, instance_counts);
+        DFAI_DEBUG(blueprint, 3, "Placed " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ".");
+        LogQuiet(stl_sprintf("Placed %s/%s/%s at (%d, %d, %d)", rb.type.c_str(), rb.tmpl_name.c_str(), rb.name.c_str(), pos.x, pos.y, pos.z), true);
+        return true;
     }
 
+    DFAI_DEBUG(blueprint, 4, "Error placing " << DBG_ROOM(rb) << " at " << DBG_COORD(pos) << ": " << error);
     return false;
 }
 
@@ -961,8 +991,8 @@ void PlanSetup::add_extra_doors()
         layout.push_back(door);
         door_rooms.push_back(door_room);
 
-        interior[c] = "door";
-        no_room[c] = "door";
+        interior.set(c, claim_tag("door"));
+        no_room.set(c, claim_tag("door"));
     };
 
     for (auto it1 = rooms.begin(); it1 != rooms.end(); it1++)
@@ -1164,7 +1194,8 @@ void PlanSetup::handle_special_exits()
                             bool bad_position = false;
                             if (cur != origin)
                             {
-                                bad_position = (no_room.count(cur) && no_room.at(cur) != r->blueprint) || (no_corridor.count(cur) && no_corridor.at(cur) != r->blueprint);
+                                tile_claims_t::tag_t own = find_claim_tag(r->blueprint);
+                                bad_position = (no_room.count(cur) && no_room.at(cur) != own) || (no_corridor.count(cur) && no_corridor.at(cur) != own);
                                 for (int16_t dx = -1; dx <= 1; dx++)
                                 {
                                     for (int16_t dy = -1; dy <= 1; dy++)
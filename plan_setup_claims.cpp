@@ -0,0 +1,130 @@
+#include "ai.h"
+#include "plan_setup.h"
+
+#include "df/world.h"
+
+REQUIRE_GLOBAL(world);
+
+tile_claims_t::tile_claims_t() :
+    x_count(0),
+    y_count(0),
+    z_count(0),
+    row_words(0),
+    layers()
+{
+}
+
+void tile_claims_t::clear()
+{
+    x_count = 0;
+    y_count = 0;
+    z_count = 0;
+    row_words = 0;
+    layers.clear();
+}
+
+const tile_claims_t::layer_t *tile_claims_t::layer(int16_t z) const
+{
+    if (z < 0 || size_t(z) >= layers.size())
+    {
+        return nullptr;
+    }
+    return layers.at(size_t(z)).get();
+}
+
+tile_claims_t::tag_t tile_claims_t::at(df::coord t) const
+{
+    const layer_t *l = layer(t.z);
+    if (!l || t.x < 0 || t.x >= x_count || t.y < 0 || t.y >= y_count)
+    {
+        return 0;
+    }
+    return l->tags.at(size_t(t.y) * size_t(x_count) + size_t(t.x));
+}
+
+void tile_claims_t::set(df::coord t, tile_claims_t::tag_t tag)
+{
+    if (!x_count)
+    {
+        x_count = int16_t(world->map.x_count);
+        y_count = int16_t(world->map.y_count);
+        z_count = int16_t(world->map.z_count);
+        row_words = (size_t(x_count) + 63) / 64;
+        layers.resize(size_t(z_count));
+    }
+
+    if (t.x < 0 || t.x >= x_count || t.y < 0 || t.y >= y_count || t.z < 0 || t.z >= z_count)
+    {
+        return;
+    }
+
+    auto & l = layers.at(size_t(t.z));
+    if (!l)
+    {
+        l.reset(new layer_t());
+        l->tags.resize(size_t(x_count) * size_t(y_count), 0);
+        l->bits.resize(row_words * size_t(y_count), 0);
+    }
+
+    l->tags.at(size_t(t.y) * size_t(x_count) + size_t(t.x)) = tag;
+    uint64_t & word = l->bits.at(size_t(t.y) * row_words + size_t(t.x) / 64);
+    uint64_t bit = uint64_t(1) << (t.x % 64);
+    if (tag)
+    {
+        word |= bit;
+    }
+    else
+    {
+        word &= ~bit;
+    }
+}
+
+// the 64 tiles starting at x, as bits. tiles off the map are unclaimed.
+uint64_t tile_claims_t::row_bits(const layer_t & l, int16_t x, int16_t y) const
+{
+    if (y < 0 || y >= y_count || x >= x_count || x <= -64)
+    {
+        return 0;
+    }
+
+    const uint64_t *row = &l.bits.at(size_t(y) * row_words);
+    if (x < 0)
+    {
+        return row[0] << -x;
+    }
+
+    size_t w = size_t(x) / 64;
+    size_t shift = size_t(x) % 64;
+    uint64_t bits = row[w] >> shift;
+    if (shift && w + 1 < row_words)
+    {
+        bits |= row[w + 1] << (64 - shift);
+    }
+    return bits;
+}
+
+df::coord tile_claims_t::find(const std::vector<blueprint_tile_run> & runs, df::coord offset) const
+{
+    for (auto & run : runs)
+    {
+        df::coord start = run.start + offset;
+        const layer_t *l = layer(start.z);
+        if (!l)
+        {
+            continue;
+        }
+
+        uint64_t hit = row_bits(*l, start.x, start.y) & run.bits;
+        if (hit)
+        {
+            while (!(hit & 1))
+            {
+                hit >>= 1;
+                start.x++;
+            }
+            return start;
+        }
+    }
+
+    return df::coord();
+}
@@ -0,0 +1,215 @@
+#include "ai.h"
+#include "plan.h"
+#include "plan_setup.h"
+
+#include <bitset>
+
+#include "modules/Maps.h"
+
+#include "df/block_square_event_grassst.h"
+#include "df/map_block.h"
+#include "df/world.h"
+
+REQUIRE_GLOBAL(world);
+
+tile_snapshot_t::tile_snapshot_t() :
+    x_count(0),
+    y_count(0),
+    z_count(0),
+    row_words(0),
+    planes(),
+    surface_tiles()
+{
+}
+
+void tile_snapshot_t::take()
+{
+    clear();
+
+    x_count = int16_t(world->map.x_count);
+    y_count = int16_t(world->map.y_count);
+    z_count = int16_t(world->map.z_count);
+    row_words = (size_t(x_count) + 63) / 64;
+
+    for (auto & plane : planes)
+    {
+        plane.resize(row_words * size_t(y_count) * size_t(z_count), 0);
+    }
+
+    for (auto block : world->map.map_blocks)
+    {
+        std::vector<df::block_square_event_grassst *> grass_events;
+        for (auto be : block->block_events)
+        {
+            if (auto grass = virtual_cast<df::block_square_event_grassst>(be))
+            {
+                grass_events.push_back(grass);
+            }
+        }
+
+        for (int16_t dx = 0; dx < 16; dx++)
+        {
+            for (int16_t dy = 0; dy < 16; dy++)
+            {
+                df::coord t = block->map_pos + df::coord(dx, dy, 0);
+                if (t.x >= x_count || t.y >= y_count || t.z >= z_count)
+                {
+                    continue;
+                }
+
+                df::tiletype tt = block->tiletype[dx][dy];
+                df::tiletype_material tm = ENUM_ATTR(tiletype, material, tt);
+                auto des = block->designation[dx][dy];
+                auto occ = block->occupancy[dx][dy];
+
+                bool set[flag_count];
+                set[wall] = ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, tt)) == tiletype_shape_basic::Wall && tm != tiletype_material::TREE;
+                set[tree] = tm == tiletype_material::TREE;
+                set[water] = des.bits.flow_size > 0 || tm == tiletype_material::POOL || tm == tiletype_material::RIVER || tm == tiletype_material::BROOK;
+                set[building] = occ.bits.building != tile_building_occ::None;
+                set[stone] = tm == tiletype_material::STONE || tm == tiletype_material::MINERAL || tm == tiletype_material::FEATURE;
+                set[frozen] = tm == tiletype_material::FROZEN_LIQUID;
+                set[grass] = false;
+                for (auto g : grass_events)
+                {
+                    if (g->amount[dx][dy] > 0)
+                    {
+                        set[grass] = true;
+                        break;
+                    }
+                }
+
+                size_t word = row_index(t.y, t.z) + size_t(t.x) / 64;
+                uint64_t bit = uint64_t(1) << (t.x & 63);
+                for (int f = 0; f < flag_count; f++)
+                {
+                    if (set[f])
+                    {
+                        planes[f][word] |= bit;
+                    }
+                }
+            }
+        }
+    }
+
+    surface_tiles.resize(size_t(x_count) * size_t(y_count));
+    for (int16_t x = 0; x < x_count; x++)
+    {
+        for (int16_t y = 0; y < y_count; y++)
+        {
+            surface_tiles[size_t(y) * size_t(x_count) + size_t(x)] = Plan::surface_tile_at(x, y, true);
+        }
+    }
+}
+
+void tile_snapshot_t::clear()
+{
+    x_count = 0;
+    y_count = 0;
+    z_count = 0;
+    row_words = 0;
+    for (auto & plane : planes)
+    {
+        plane.clear();
+        plane.shrink_to_fit();
+    }
+    surface_tiles.clear();
+    surface_tiles.shrink_to_fit();
+}
+
+bool tile_snapshot_t::clip(df::coord & min, df::coord & max) const
+{
+    min.x = std::max<int16_t>(min.x, 0);
+    min.y = std::max<int16_t>(min.y, 0);
+    min.z = std::max<int16_t>(min.z, 0);
+    max.x = std::min<int16_t>(max.x, x_count - 1);
+    max.y = std::min<int16_t>(max.y, y_count - 1);
+    max.z = std::min<int16_t>(max.z, z_count - 1);
+
+    return min.x <= max.x && min.y <= max.y && min.z <= max.z;
+}
+
+static inline uint64_t row_mask(size_t w, int16_t x0, int16_t x1)
+{
+    uint64_t mask = ~uint64_t(0);
+    if (w == size_t(x0) / 64)
+    {
+        mask &= ~uint64_t(0) << (x0 & 63);
+    }
+    if (w == size_t(x1) / 64)
+    {
+        mask &= ~uint64_t(0) >> (63 - (x1 & 63));
+    }
+    return mask;
+}
+
+df::coord tile_snapshot_t::find(flag_t flag, df::coord min, df::coord max, bool value) const
+{
+    if (clip(min, max))
+    {
+        const auto & plane = planes[flag];
+        uint64_t invert = value ? 0 : ~uint64_t(0);
+
+        for (int16_t z = min.z; z <= max.z; z++)
+        {
+            for (int16_t y = min.y; y <= max.y; y++)
+            {
+                size_t row = row_index(y, z);
+                for (size_t w = size_t(min.x) / 64; w <= size_t(max.x) / 64; w++)
+                {
+                    uint64_t bits = (plane[row + w] ^ invert) & row_mask(w, min.x, max.x);
+                    if (bits)
+                    {
+                        int16_t x = int16_t(w * 64);
+                        while (!(bits & 1))
+                        {
+                            bits >>= 1;
+                            x++;
+                        }
+                        return df::coord(x, y, z);
+                    }
+                }
+            }
+        }
+    }
+
+    df::coord invalid;
+    invalid.clear();
+    return invalid;
+}
+
+int32_t tile_snapshot_t::count(flag_t flag, df::coord min, df::coord max) const
+{
+    int32_t total = 0;
+    if (!clip(min, max))
+    {
+        return total;
+    }
+
+    const auto & plane = planes[flag];
+    for (int16_t z = min.z; z <= max.z; z++)
+    {
+        for (int16_t y = min.y; y <= max.y; y++)
+        {
+            size_t row = row_index(y, z);
+            for (size_t w = size_t(min.x) / 64; w <= size_t(max.x) / 64; w++)
+            {
+                total += int32_t(std::bitset<64>(plane[row + w] & row_mask(w, min.x, max.x)).count());
+            }
+        }
+    }
+
+    return total;
+}
+
+df::coord tile_snapshot_t::surface(int16_t x, int16_t y) const
+{
+    if (x < 0 || y < 0 || x >= x_count || y >= y_count)
+    {
+        df::coord invalid;
+        invalid.clear();
+        return invalid;
+    }
+
+    return surface_tiles[size_t(y) * size_t(x_count) + size_t(x)];
+}
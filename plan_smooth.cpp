@@ -1,6 +1,10 @@
 #include "ai.h"
+#include "designation_batch.h"
+#include "job_index.h"
 #include "plan.h"
 
+#include <bitset>
+
 #include "modules/Maps.h"
 
 #include "df/engraving.h"
@@ -11,9 +15,71 @@
 
 REQUIRE_GLOBAL(world);
 
+// tiletype properties that smooth and is_smooth need, indexed by tiletype.
+struct smooth_tiletypes_t
+{
+    // stone or mineral, so it can be smoothed at all.
+    std::bitset<size_t(df::enum_traits<df::tiletype>::last_item_value + 1)> stone;
+    // wall or floor shape.
+    std::bitset<size_t(df::enum_traits<df::tiletype>::last_item_value + 1)> shape;
+    // counts as smooth whatever is on it.
+    std::bitset<size_t(df::enum_traits<df::tiletype>::last_item_value + 1)> smooth;
+    // smooth, but can still be engraved.
+    std::bitset<size_t(df::enum_traits<df::tiletype>::last_item_value + 1)> polished;
+
+    smooth_tiletypes_t()
+    {
+        FOR_ENUM_ITEMS(tiletype, tt)
+        {
+            size_t i = size_t(tt);
+            df::tiletype_material mat = ENUM_ATTR(tiletype, material, tt);
+            df::tiletype_shape s = ENUM_ATTR(tiletype, shape, tt);
+            df::tiletype_shape_basic sb = ENUM_ATTR(tiletype_shape, basic_shape, s);
+            df::tiletype_special sp = ENUM_ATTR(tiletype, special, tt);
+
+            stone[i] = mat == tiletype_material::STONE ||
+                mat == tiletype_material::MINERAL;
+            shape[i] = sb == tiletype_shape_basic::Wall ||
+                sb == tiletype_shape_basic::Floor;
+            smooth[i] = mat == tiletype_material::SOIL ||
+                mat == tiletype_material::GRASS_LIGHT ||
+                mat == tiletype_material::GRASS_DARK ||
+                mat == tiletype_material::PLANT ||
+                mat == tiletype_material::ROOT ||
+                mat == tiletype_material::TREE ||
+                mat == tiletype_material::FROZEN_LIQUID ||
+                sp == tiletype_special::TRACK ||
+                s == tiletype_shape::FORTIFICATION ||
+                sb == tiletype_shape_basic::Open ||
+                sb == tiletype_shape_basic::Stair;
+            polished[i] = sp == tiletype_special::SMOOTH;
+        }
+    }
+};
+
+static const smooth_tiletypes_t & smooth_tiletypes()
+{
+    static const smooth_tiletypes_t types;
+    return types;
+}
+
+template<typename F>
+static bool is_smooth_tile(df::tiletype tt, df::tile_occupancy occ, bool engrave, F engraved)
+{
+    const smooth_tiletypes_t & types = smooth_tiletypes();
+    df::tile_building_occ bld = occ.bits.building;
+    if (types.smooth.test(size_t(tt)) ||
+        (bld != tile_building_occ::None &&
+            bld != tile_building_occ::Dynamic))
+    {
+        return true;
+    }
+    return types.polished.test(size_t(tt)) && (!engrave || engraved());
+}
+
 bool Plan::smooth_room(color_ostream &, room *r, bool engrave)
 {
-    std::set<df::coord> tiles;
+    DesignationBatch tiles;
     auto insert_tile = [&](df::coord t)
     {
         auto tt = Maps::getTileType(t);
@@ -23,7 +89,7 @@ bool Plan::smooth_room(color_ostream &, room *r, bool engrave)
                 std::find_if(o->layout.begin(), o->layout.end(), [t, o](furniture* f) -> bool { return o->min + f->pos == t &&
                     f->dig == tile_dig_designation::No && f->construction == construction_type::Wall; }) == o->layout.end(); }) == room_z.end())
         {
-            tiles.insert(t);
+            tiles.add(t);
         }
     };
     for (auto f : r->layout)
@@ -66,113 +132,113 @@ void Plan::smooth_room_access(color_ostream & out, room *r)
 
 bool Plan::smooth_xyz(df::coord min, df::coord max, bool engrave)
 {
-    std::set<df::coord> tiles;
-    for (int16_t x = min.x; x <= max.x; x++)
-    {
-        for (int16_t y = min.y; y <= max.y; y++)
-        {
-            for (int16_t z = min.z; z <= max.z; z++)
-            {
-                tiles.insert(df::coord(x, y, z));
-            }
-        }
-    }
+    DesignationBatch tiles;
+    tiles.add_box(min, max);
     return smooth(tiles, engrave);
 }
 
-bool Plan::smooth(std::set<df::coord> tiles, bool engrave)
+bool Plan::smooth(DesignationBatch & tiles, bool engrave)
 {
+    const smooth_tiletypes_t & types = smooth_tiletypes();
     bool all_already_smooth = true;
 
-    // remove tiles that are not smoothable
-    for (auto it = tiles.begin(); it != tiles.end(); )
+    // engravings are only looked up when engraving, and only once.
+    std::vector<df::coord> engraved;
+    if (engrave)
     {
-        // not a smoothable material
-        df::tiletype tt = *Maps::getTileType(*it);
-        df::tiletype_material mat = ENUM_ATTR(tiletype, material, tt);
-        if (mat != tiletype_material::STONE &&
-            mat != tiletype_material::MINERAL)
+        for (auto e : world->engravings)
         {
-            tiles.erase(it++);
-            continue;
-        }
-
-        // already designated for something
-        df::tile_designation des = *Maps::getTileDesignation(*it);
-        if (des.bits.dig != tile_dig_designation::No ||
-            des.bits.smooth != 0 ||
-            des.bits.hidden)
-        {
-            all_already_smooth = false;
-            tiles.erase(it++);
-            continue;
+            engraved.push_back(e->pos);
         }
+        std::sort(engraved.begin(), engraved.end());
+    }
 
-        // already smooth
-        if (is_smooth(*it, engrave))
+    // remove tiles that are not smoothable
+    tiles.each([&](DesignationBatch::block_t & b)
+    {
+        df::map_block *block = Maps::getTileBlock(b.origin);
+        if (!block)
         {
-            tiles.erase(it++);
-            continue;
+            b.rows.fill(0);
+            return;
         }
 
-        // wrong shape
-        df::tiletype_shape s = ENUM_ATTR(tiletype, shape, tt);
-        df::tiletype_shape_basic sb = ENUM_ATTR(tiletype_shape, basic_shape, s);
-        if (sb != tiletype_shape_basic::Wall &&
-            sb != tiletype_shape_basic::Floor)
+        for (int16_t x = 0; x < 16; x++)
         {
-            tiles.erase(it++);
-            continue;
+            for (int16_t y = 0; b.rows[x] >> y; y++)
+            {
+                if (!b.test(x, y))
+                {
+                    continue;
+                }
+
+                // not a smoothable material
+                df::tiletype tt = block->tiletype[x][y];
+                if (!types.stone.test(size_t(tt)))
+                {
+                    b.reset(x, y);
+                    continue;
+                }
+
+                // already designated for something
+                df::tile_designation des = block->designation[x][y];
+                if (des.bits.dig != tile_dig_designation::No ||
+                    des.bits.smooth != 0 ||
+                    des.bits.hidden)
+                {
+                    all_already_smooth = false;
+                    b.reset(x, y);
+                    continue;
+                }
+
+                // already smooth, or wrong shape
+                df::coord t = b.origin + df::coord(x, y, 0);
+                if (is_smooth_tile(tt, block->occupancy[x][y], engrave, [&engraved, t]() -> bool { return std::binary_search(engraved.begin(), engraved.end(), t); }) ||
+                    !types.shape.test(size_t(tt)))
+                {
+                    b.reset(x, y);
+                    continue;
+                }
+            }
         }
-
-        it++;
-    }
+    });
 
     // remove tiles that are already being smoothed
-    for (auto j : world->jobs.list)
+    for (auto type : { job_type::DetailWall, job_type::DetailFloor })
     {
-        if (j->job_type == job_type::DetailWall ||
-            j->job_type == job_type::DetailFloor)
+        for (auto j : job_index.of_type(type))
         {
             all_already_smooth = false;
-            tiles.erase(j->pos);
+            tiles.remove(j->pos);
         }
     }
 
     // mark the tiles to be smoothed!
-    for (auto t : tiles)
+    tiles.each([engrave](DesignationBatch::block_t & b)
     {
-        Maps::getTileDesignation(t)->bits.smooth = engrave ? 2 : 1;
-        Maps::getTileOccupancy(t)->bits.dig_marked = 0;
-        auto block = Maps::getTileBlock(t);
+        df::map_block *block = Maps::getTileBlock(b.origin);
+        for (int16_t x = 0; x < 16; x++)
+        {
+            for (int16_t y = 0; b.rows[x] >> y; y++)
+            {
+                if (b.test(x, y))
+                {
+                    block->designation[x][y].bits.smooth = engrave ? 2 : 1;
+                    block->occupancy[x][y].bits.dig_marked = 0;
+                }
+            }
+        }
         block->flags.bits.designated = true;
         block->dsgn_check_cooldown = 0;
-    }
+    });
 
     return all_already_smooth;
 }
 
 bool Plan::is_smooth(df::coord t, bool engrave)
 {
-    df::tiletype tt = *Maps::getTileType(t);
-    df::tiletype_material mat = ENUM_ATTR(tiletype, material, tt);
-    df::tiletype_shape s = ENUM_ATTR(tiletype, shape, tt);
-    df::tiletype_shape_basic sb = ENUM_ATTR(tiletype_shape, basic_shape, s);
-    df::tiletype_special sp = ENUM_ATTR(tiletype, special, tt);
-    df::tile_occupancy occ = *Maps::getTileOccupancy(t);
-    df::tile_building_occ bld = occ.bits.building;
-    return mat == tiletype_material::SOIL ||
-        mat == tiletype_material::GRASS_LIGHT ||
-        mat == tiletype_material::GRASS_DARK ||
-        mat == tiletype_material::PLANT ||
-        mat == tiletype_material::ROOT ||
-        mat == tiletype_material::TREE ||
-        mat == tiletype_material::FROZEN_LIQUID ||
-        sp == tiletype_special::TRACK ||
-        (sp == tiletype_special::SMOOTH && (!engrave || std::find_if(world->engravings.begin(), world->engravings.end(), [t](df::engraving *e) -> bool { return e->pos == t; }) != world->engravings.end())) ||
-        s == tiletype_shape::FORTIFICATION ||
-        sb == tiletype_shape_basic::Open ||
-        sb == tiletype_shape_basic::Stair ||
-        (bld != tile_building_occ::None &&
-            bld != tile_building_occ::Dynamic);
+    return is_smooth_tile(*Maps::getTileType(t), *Maps::getTileOccupancy(t), engrave, [t]() -> bool
+    {
+        return std::find_if(world->engravings.begin(), world->engravings.end(), [t](df::engraving *e) -> bool { return e->pos == t; }) != world->engravings.end();
+    });
 }
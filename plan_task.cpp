@@ -1,6 +1,8 @@
 #include "ai.h"
 #include "debug.h"
+#include "job_index.h"
 #include "plan.h"
+#include "profiler.h"
 
 #include "modules/Buildings.h"
 #include "modules/Maps.h"
@@ -18,6 +20,16 @@ REQUIRE_GLOBAL(cur_year_tick);
 
 static bool want_reupdate = false;
 
+// true while there is time left in this tick's task budget.
+static bool task_budget_left(std::chrono::steady_clock::time_point start)
+{
+    if (config.plan_task_budget_us <= 0)
+    {
+        return false;
+    }
+    return std::chrono::steady_clock::now() - start < std::chrono::microseconds(config.plan_task_budget_us);
+}
+
 void Plan::update(color_ostream &)
 {
     last_update_year = *cur_year;
@@ -26,19 +38,6 @@ void Plan::update(color_ostream &)
     {
         bg_idx_generic = tasks_generic.begin();
 
-        nrdig.clear();
-        for (auto it = tasks_generic.begin(); it != tasks_generic.end(); it++)
-        {
-            task *t = *it;
-            if ((t->type != task_type::dig_room && t->type != task_type::dig_room_immediate) || (t->r->type == room_type::corridor && (t->r->corridor_type == corridor_type::veinshaft || t->r->corridor_type == corridor_type::outpost)))
-                continue;
-            df::coord size = t->r->size();
-            if (t->r->type != room_type::corridor || size.z > 1)
-                nrdig[t->r->queue]++;
-            if (t->r->type != room_type::corridor && size.x * size.y * size.z >= 10)
-                nrdig[t->r->queue]++;
-        }
-
         want_reupdate = false;
         events.onupdate_register_once("df-ai plan bg generic", [this](color_ostream & out) -> bool
         {
@@ -47,134 +46,20 @@ void Plan::update(color_ostream &)
                 return true;
             }
 
-            if (bg_idx_generic == tasks_generic.end())
-            {
-                if (want_reupdate)
-                {
-                    update(out);
-                }
-                return true;
-            }
-            std::ostringstream reason;
-            task & t = **bg_idx_generic;
-
-            auto any_immediate = [this]() -> bool
+            auto start = std::chrono::steady_clock::now();
+            do
             {
-                for (auto t : tasks_generic)
+                if (bg_idx_generic == tasks_generic.end())
                 {
-                    if (t->type == task_type::dig_room_immediate)
+                    if (want_reupdate)
                     {
-                        return true;
+                        update(out);
                     }
+                    return true;
                 }
-                return false;
-            };
-
-            bool del = false;
-            switch (t.type)
-            {
-            case task_type::want_dig:
-            {
-                size_t wantdig_max = ai.stocks.count_total.count(stock_item::pick) ? std::max(ai.stocks.count_total.at(stock_item::pick), 2) : 2;
-                if (any_immediate())
-                {
-                    reason << "waiting for more important room to be dug";
-                }
-                else if (t.r->is_dug() || nrdig[t.r->queue] < wantdig_max)
-                {
-                    digroom(out, t.r);
-                    del = true;
-                }
-                else
-                {
-                    reason << "dig queue " << t.r->queue << " has " << nrdig[t.r->queue] << " of " << wantdig_max << " slots already filled";
-                }
-                break;
-            }
-            case task_type::dig_room:
-            case task_type::dig_room_immediate:
-                fixup_open(out, t.r);
-                if (t.r->is_dug(reason))
-                {
-                    t.r->status = room_status::dug;
-                    construct_room(out, t.r);
-                    want_reupdate = true; // wantdig asap
-                    del = true;
-                }
-                else
-                {
-                    t.r->dig();
-                }
-                break;
-            case task_type::construct_tradedepot:
-                del = try_construct_tradedepot(out, t.r, reason);
-                break;
-            case task_type::construct_workshop:
-                del = try_construct_workshop(out, t.r, reason);
-                break;
-            case task_type::construct_farmplot:
-                del = try_construct_farmplot(out, t.r, reason);
-                break;
-            case task_type::construct_furnace:
-                del = try_construct_furnace(out, t.r, reason);
-                break;
-            case task_type::construct_stockpile:
-                del = try_construct_stockpile(out, t.r, reason);
-                break;
-            case task_type::construct_activityzone:
-                del = try_construct_activityzone(out, t.r, reason);
-                break;
-            case task_type::construct_windmill:
-                del = try_construct_windmill(out, t.r, reason);
-                break;
-            case task_type::monitor_farm_irrigation:
-                del = monitor_farm_irrigation(out, t.r, reason);
-                break;
-            case task_type::setup_farmplot:
-                del = try_setup_farmplot(out, t.r, reason);
-                break;
-            case task_type::furnish:
-                break;
-            case task_type::check_furnish:
-                break;
-            case task_type::check_construct:
-                del = try_endconstruct(out, t.r, reason);
-                break;
-            case task_type::dig_cistern:
-                del = try_digcistern(out, t.r);
-                break;
-            case task_type::dig_garbage:
-                del = true;
-                break;
-            case task_type::check_idle:
-                del = checkidle(out, reason);
-                break;
-            case task_type::check_rooms:
-                checkrooms(out);
-                break;
-            case task_type::monitor_cistern:
-                monitor_cistern(out, reason);
-                break;
-            case task_type::monitor_room_value:
-                del = monitor_room_value(out, t.r, reason);
-                break;
-            case task_type::rescue_caged:
-                del = rescue_caged(out, t.r, t.f, t.item_id, reason);
-                break;
-            case task_type::_task_type_count:
-                break;
-            }
-
-            if (del)
-            {
-                delete *bg_idx_generic;
-                tasks_generic.erase(bg_idx_generic++);
-            }
-            else
-            {
-                t.last_status = reason.str();
-                bg_idx_generic++;
+                update_generic_task(out);
             }
+            while (task_budget_left(start));
             return false;
         });
     }
@@ -191,41 +76,347 @@ void Plan::update(color_ostream &)
                 return true;
             }
 
-            if (bg_idx_furniture == tasks_furniture.end())
-            {
-                return true;
-            }
-            std::ostringstream reason;
-            task & t = **bg_idx_furniture;
-
-            bool del = false;
-            switch (t.type)
-            {
-            case task_type::furnish:
-                del = try_furnish(out, t.r, t.f, reason);
-                break;
-            case task_type::check_furnish:
-                del = try_endfurnish(out, t.r, t.f, reason);
-                break;
-            default:
-                break;
-            }
-
-            if (del)
+            auto start = std::chrono::steady_clock::now();
+            do
             {
-                delete *bg_idx_furniture;
-                tasks_furniture.erase(bg_idx_furniture++);
-            }
-            else
-            {
-                t.last_status = reason.str();
-                bg_idx_furniture++;
+                if (bg_idx_furniture == tasks_furniture.end())
+                {
+                    return true;
+                }
+                update_furniture_task(out);
             }
+            while (task_budget_left(start));
             return false;
         });
     }
 }
 
+// true for task types whose handler only builds the task's own room. The
+// others (check_rooms, check_idle, dig_room) also try to build and furnish
+// other rooms on the way, and a missing item there must not park the whole
+// task.
+static bool task_can_wait(task_type::type type)
+{
+    switch (type)
+    {
+    case task_type::construct_tradedepot:
+    case task_type::construct_workshop:
+    case task_type::construct_farmplot:
+    case task_type::construct_furnace:
+    case task_type::construct_stockpile:
+    case task_type::construct_activityzone:
+    case task_type::construct_windmill:
+    case task_type::check_construct:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Plan::update_generic_task(color_ostream & out)
+{
+    task & t = **bg_idx_generic;
+    if (still_waiting(t))
+    {
+        bg_idx_generic++;
+        return;
+    }
+
+    task_reason_buf.clear();
+    task_reason.clear();
+    std::ostream & reason = task_reason;
+    tick_profile_scope timer(profiler.for_task(t.type));
+    current_task = task_can_wait(t.type) ? &t : nullptr;
+
+    bool del = false;
+    switch (t.type)
+    {
+    case task_type::want_dig:
+    {
+        size_t wantdig_max = ai.stocks.count_total.count(stock_item::pick) ? std::max(ai.stocks.count_total.at(stock_item::pick), 2) : 2;
+        if (task_count.at(task_type::dig_room_immediate) != 0)
+        {
+            reason << "waiting for more important room to be dug";
+        }
+        else if (t.r->is_dug() || nrdig[t.r->queue] < wantdig_max)
+        {
+            digroom(out, t.r);
+            del = true;
+        }
+        else
+        {
+            reason << "dig queue " << t.r->queue << " has " << nrdig[t.r->queue] << " of " << wantdig_max << " slots already filled";
+        }
+        break;
+    }
+    case task_type::dig_room:
+    case task_type::dig_room_immediate:
+        fixup_open(out, t.r);
+        if (t.r->is_dug(reason))
+        {
+            t.r->status = room_status::dug;
+            room_changed(t.r);
+            construct_room(out, t.r);
+            want_reupdate = true; // wantdig asap
+            del = true;
+        }
+        else
+        {
+            t.r->dig();
+        }
+        break;
+    case task_type::construct_tradedepot:
+        del = try_construct_tradedepot(out, t.r, reason);
+        break;
+    case task_type::construct_workshop:
+        del = try_construct_workshop(out, t.r, reason);
+        break;
+    case task_type::construct_farmplot:
+        del = try_construct_farmplot(out, t.r, reason);
+        break;
+    case task_type::construct_furnace:
+        del = try_construct_furnace(out, t.r, reason);
+        break;
+    case task_type::construct_stockpile:
+        del = try_construct_stockpile(out, t.r, reason);
+        break;
+    case task_type::construct_activityzone:
+        del = try_construct_activityzone(out, t.r, reason);
+        break;
+    case task_type::construct_windmill:
+        del = try_construct_windmill(out, t.r, reason);
+        break;
+    case task_type::monitor_farm_irrigation:
+        del = monitor_farm_irrigation(out, t.r, reason);
+        break;
+    case task_type::setup_farmplot:
+        del = try_setup_farmplot(out, t.r, reason);
+        break;
+    case task_type::furnish:
+        break;
+    case task_type::check_furnish:
+        break;
+    case task_type::check_construct:
+        del = try_endconstruct(out, t.r, reason);
+        break;
+    case task_type::dig_cistern:
+        del = try_digcistern(out, t.r);
+        break;
+    case task_type::dig_garbage:
+        del = true;
+        break;
+    case task_type::check_idle:
+        del = checkidle(out, reason);
+        break;
+    case task_type::check_rooms:
+        checkrooms(out);
+        break;
+    case task_type::monitor_cistern:
+        monitor_cistern(out, reason);
+        break;
+    case task_type::monitor_room_value:
+        del = monitor_room_value(out, t.r, reason);
+        break;
+    case task_type::rescue_caged:
+        del = rescue_caged(out, t.r, t.f, t.item_id, reason);
+        break;
+    case task_type::_task_type_count:
+        break;
+    }
+    current_task = nullptr;
+
+    if (del)
+    {
+        task_removed(*bg_idx_generic);
+        delete *bg_idx_generic;
+        tasks_generic.erase(bg_idx_generic++);
+    }
+    else
+    {
+        // assign reuses the old status's storage, and most tasks report
+        // the same status as last time anyway.
+        if (t.last_status != task_reason_buf.str())
+        {
+            t.last_status = task_reason_buf.str();
+            journal.dirty_tasks = true;
+        }
+        bg_idx_generic++;
+    }
+}
+
+void Plan::update_furniture_task(color_ostream & out)
+{
+    task & t = **bg_idx_furniture;
+    if (still_waiting(t))
+    {
+        bg_idx_furniture++;
+        return;
+    }
+
+    task_reason_buf.clear();
+    task_reason.clear();
+    std::ostream & reason = task_reason;
+    tick_profile_scope timer(profiler.for_task(t.type));
+    current_task = &t;
+
+    bool del = false;
+    switch (t.type)
+    {
+    case task_type::furnish:
+        del = try_furnish(out, t.r, t.f, reason);
+        break;
+    case task_type::check_furnish:
+        del = try_endfurnish(out, t.r, t.f, reason);
+        break;
+    default:
+        break;
+    }
+    current_task = nullptr;
+
+    if (del)
+    {
+        task_removed(*bg_idx_furniture);
+        delete *bg_idx_furniture;
+        tasks_furniture.erase(bg_idx_furniture++);
+    }
+    else
+    {
+        if (t.last_status != task_reason_buf.str())
+        {
+            t.last_status = task_reason_buf.str();
+            journal.dirty_tasks = true;
+        }
+        bg_idx_furniture++;
+    }
+}
+
+static int64_t task_wait_now()
+{
+    return int64_t(*cur_year) * 12 * 28 * 1200 + *cur_year_tick;
+}
+
+// The wait_for_* functions may be called by a task handler that is about to
+// fail. They do nothing when the handler was called from outside the task
+// loop or from a task that is only passing through, see task_can_wait.
+void Plan::wait_for_stock(stock_item::item item)
+{
+    if (!current_task)
+    {
+        return;
+    }
+    task_wait_t & wait = current_task->wait;
+    wait.kind = task_wait_t::stock;
+    wait.item = item;
+    auto serial = ai.stocks.count_serial.find(item);
+    wait.serial = serial == ai.stocks.count_serial.end() ? 0 : serial->second;
+    wait.since = task_wait_now();
+}
+
+void Plan::wait_for_items(const std::vector<df::item_type> & item_types)
+{
+    if (!current_task)
+    {
+        return;
+    }
+    task_wait_t & wait = current_task->wait;
+    wait.kind = task_wait_t::items;
+    wait.item_types = item_types;
+    wait.serial = ai.stocks.items_serial_of(item_types);
+    wait.since = task_wait_now();
+}
+
+void Plan::wait_for_building(int32_t bld_id)
+{
+    if (!current_task)
+    {
+        return;
+    }
+    task_wait_t & wait = current_task->wait;
+    wait.kind = task_wait_t::building;
+    wait.bld_id = bld_id;
+    wait.since = task_wait_now();
+}
+
+void Plan::wait_for_dig(df::coord pos)
+{
+    if (!current_task)
+    {
+        return;
+    }
+    task_wait_t & wait = current_task->wait;
+    wait.kind = task_wait_t::dig;
+    wait.pos = pos;
+    wait.since = task_wait_now();
+}
+
+void Plan::stock_wait_keys(std::set<stock_item::item> & keys) const
+{
+    for (auto t : tasks_generic)
+    {
+        if (t->wait.kind == task_wait_t::stock)
+        {
+            keys.insert(t->wait.item);
+        }
+    }
+    for (auto t : tasks_furniture)
+    {
+        if (t->wait.kind == task_wait_t::stock)
+        {
+            keys.insert(t->wait.item);
+        }
+    }
+}
+
+bool Plan::still_waiting(task & t)
+{
+    task_wait_t & wait = t.wait;
+    if (wait.kind == task_wait_t::none)
+    {
+        return false;
+    }
+
+    // in case the change happened in a way we don't see, give up after a
+    // while and let the handler look for itself.
+    int64_t now = task_wait_now();
+    bool waiting = now >= wait.since && now - wait.since < task_wait_t::max_ticks;
+    if (waiting)
+    {
+        switch (wait.kind)
+        {
+        case task_wait_t::none:
+            break;
+        case task_wait_t::stock:
+        {
+            auto serial = ai.stocks.count_serial.find(wait.item);
+            waiting = (serial == ai.stocks.count_serial.end() ? 0 : serial->second) == wait.serial;
+            break;
+        }
+        case task_wait_t::items:
+            waiting = ai.stocks.items_serial_of(wait.item_types) == wait.serial;
+            break;
+        case task_wait_t::building:
+        {
+            df::building *bld = df::building::find(wait.bld_id);
+            waiting = bld && bld->getBuildStage() < bld->getMaxBuildStage();
+            break;
+        }
+        case task_wait_t::dig:
+        {
+            df::tiletype *tt = Maps::getTileType(wait.pos);
+            waiting = tt && ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, *tt)) == tiletype_shape_basic::Wall;
+            break;
+        }
+        }
+    }
+
+    if (!waiting)
+    {
+        // the handler decides again whether to wait.
+        wait.kind = task_wait_t::none;
+    }
+    return waiting;
+}
+
 task *Plan::is_digging()
 {
     for (auto t : tasks_generic)
@@ -244,13 +435,7 @@ bool Plan::is_idle()
     {
         return false;
     }
-    for (auto it = tasks_generic.begin(); it != tasks_generic.end(); it++)
-    {
-        task *t = *it;
-        if (t->type != task_type::monitor_cistern && t->type != task_type::check_rooms && t->type != task_type::check_idle)
-            return false;
-    }
-    return true;
+    return tasks_generic.size() == task_count.at(task_type::monitor_cistern) + task_count.at(task_type::check_rooms) + task_count.at(task_type::check_idle);
 }
 
 bool Plan::checkidle(color_ostream & out, std::ostream & reason)
@@ -380,13 +565,13 @@ void Plan::checkroom(color_ostream & out, room *r)
                 str << "fix furniture " << f->type << " in " << AI::describe_room(r);
                 ai.debug(out, str.str());
                 f->bld_id = -1;
+                furniture_dirty(f);
 
                 add_task(task_type::furnish, r, f);
             }
             if (f->construction != construction_type::NONE)
             {
-                std::ostringstream discard;
-                try_furnish_construction(out, f->construction, t, discard);
+                try_furnish_construction(out, f->construction, t, null_reason());
             }
         }
         // tantrumed building
@@ -394,6 +579,7 @@ void Plan::checkroom(color_ostream & out, room *r)
         {
             ai.debug(out, "rebuild " + AI::describe_room(r));
             r->bld_id = -1;
+            room_dirty(r);
             construct_room(out, r);
         }
     }
@@ -413,6 +599,7 @@ bool Plan::wantdig(color_ostream & out, room *r, int32_t queue)
     }
     ai.debug(out, "wantdig " + AI::describe_room(r));
     r->queue_dig = true;
+    room_dirty(r);
     r->dig(true);
     add_task(task_type::want_dig, r);
     return true;
@@ -425,6 +612,7 @@ bool Plan::digroom(color_ostream & out, room *r, bool immediate)
     ai.debug(out, "digroom " + AI::describe_room(r));
     r->queue_dig = false;
     r->status = room_status::dig;
+    room_changed(r);
     fixup_open(out, r);
     r->dig();
 
@@ -459,14 +647,6 @@ bool Plan::digroom(color_ostream & out, room *r, bool immediate)
         return false;
     });
 
-    df::coord size = r->size();
-    if (r->type != room_type::corridor || size.z > 1)
-    {
-        nrdig[r->queue]++;
-        if (size.x * size.y * size.z >= 10)
-            nrdig[r->queue]++;
-    }
-
     return true;
 }
 
@@ -635,6 +815,7 @@ bool Plan::rescue_caged(color_ostream & out, room *r, furniture *f, int32_t item
         if (cage_bld)
         {
             Buildings::deconstruct(cage_bld);
+            job_index.invalidate();
         }
         return true;
     }
@@ -693,6 +874,7 @@ bool Plan::rescue_caged(color_ostream & out, room *r, furniture *f, int32_t item
             std::vector<df::item*> cage_item;
             cage_item.push_back(cage);
             Buildings::constructWithItems(bld, cage_item);
+            job_index.invalidate();
 
             reason << "waiting for cage to be secured to floor";
             return false;
@@ -734,4 +916,60 @@ void Plan::add_task(task_type::type type, room *r, furniture *f, int32_t item_id
         }
     }
     tasks.push_back(new task(type, r, f, item_id));
+    task_added(tasks.back());
+}
+
+void Plan::task_added(task *t)
+{
+    task_count.at(t->type)++;
+    journal.dirty_tasks = true;
+
+    if ((t->type != task_type::dig_room && t->type != task_type::dig_room_immediate) || (t->r->type == room_type::corridor && (t->r->corridor_type == corridor_type::veinshaft || t->r->corridor_type == corridor_type::outpost)))
+    {
+        t->dig_weight = 0;
+        return;
+    }
+
+    // remember what was added so that removing the task undoes it even if
+    // the room changes in the meantime.
+    df::coord size = t->r->size();
+    t->dig_queue = t->r->queue;
+    t->dig_weight = 0;
+    if (t->r->type != room_type::corridor || size.z > 1)
+        t->dig_weight++;
+    if (t->r->type != room_type::corridor && size.x * size.y * size.z >= 10)
+        t->dig_weight++;
+    if (t->dig_weight)
+        nrdig[t->dig_queue] += t->dig_weight;
+}
+
+void Plan::task_removed(task *t)
+{
+    task_count.at(t->type)--;
+    journal.dirty_tasks = true;
+
+    if (t->dig_weight)
+    {
+        auto it = nrdig.find(t->dig_queue);
+        it->second -= t->dig_weight;
+        if (it->second == 0)
+        {
+            nrdig.erase(it);
+        }
+        t->dig_weight = 0;
+    }
+}
+
+void Plan::recount_tasks()
+{
+    nrdig.clear();
+    task_count.fill(0);
+    for (auto t : tasks_generic)
+    {
+        task_added(t);
+    }
+    for (auto t : tasks_furniture)
+    {
+        task_added(t);
+    }
 }
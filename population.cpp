@@ -1,4 +1,6 @@
 #include "ai.h"
+#include "job_index.h"
+#include "unit_index.h"
 #include "population.h"
 #include "plan.h"
 #include "thirdparty/weblegends/weblegends-plugin.h"
@@ -162,7 +164,8 @@ void Population::update_citizenlist(color_ostream & out)
     // add new fort citizen to our list
     for (auto u : world->units.active)
     {
-        if (Units::isCitizen(u) && !Units::isBaby(u))
+        uint16_t flags = unit_index.of(u);
+        if ((flags & unit_class::citizen) && !(flags & unit_class::baby))
         {
             if (old.count(u->id))
             {
@@ -190,7 +193,7 @@ void Population::update_citizenlist(color_ostream & out)
                 }
             }
         }
-        else if (Units::isCitizen(u) && Units::isBaby(u))
+        else if (flags & unit_class::citizen)
         {
             auto mother = df::unit::find(u->relationship_ids[unit_relationship_type::Mother]);
             if (mother && Units::isAlive(mother) && Units::isSane(mother) && u->relationship_ids[unit_relationship_type::RiderMount] == -1 && mother->job.current_job == nullptr)
@@ -207,18 +210,15 @@ void Population::update_citizenlist(color_ostream & out)
                 unit_worker->unit_id = mother->id;
                 seek_infant->general_refs.push_back(unit_worker);
                 Job::linkIntoWorld(seek_infant);
+                job_index.invalidate();
                 mother->job.current_job = seek_infant;
             }
         }
-        else if (u->flags1.bits.inactive || u->flags1.bits.merchant || u->flags1.bits.diplomat || u->flags1.bits.forest || u->flags2.bits.slaughter)
-        {
-            // ignore
-        }
-        else if (u->flags2.bits.visitor)
+        else if (flags & unit_class::visitor)
         {
             visitor.insert(u->id);
         }
-        else if (!Units::isOwnGroup(u) && std::find_if(u->occupations.begin(), u->occupations.end(), [](df::occupation *occ) -> bool { return occ->group_id == plotinfo->group_id; }) != u->occupations.end())
+        else if (flags & unit_class::resident)
         {
             resident.insert(u->id);
         }
@@ -1,5 +1,7 @@
 #include "ai.h"
 #include "exclusive_callback.h"
+#include "job_index.h"
+#include "unit_index.h"
 #include "population.h"
 #include "plan.h"
 #include "debug.h"
@@ -656,28 +658,12 @@ public:
 
 void Population::update_military(color_ostream & out)
 {
-    bool need_pick = false, need_axe = false;
-    for (auto job : world->jobs.list)
+    auto any_designation = [](const std::vector<df::job *> & jobs) -> bool
     {
-        if (!ENUM_ATTR(job_type, is_designation, job->job_type))
-        {
-            continue;
-        }
-
-        if (ENUM_ATTR(job_type, skill, job->job_type) == job_skill::MINING)
-        {
-            need_pick = true;
-        }
-        else if (ENUM_ATTR(job_type, skill, job->job_type) == job_skill::WOODCUTTING)
-        {
-            need_axe = true;
-        }
-
-        if (need_pick && need_axe)
-        {
-            break;
-        }
-    }
+        return std::any_of(jobs.begin(), jobs.end(), [](df::job *job) -> bool { return ENUM_ATTR(job_type, is_designation, job->job_type); });
+    };
+    bool need_pick = any_designation(job_index.of_skill(job_skill::MINING));
+    bool need_axe = any_designation(job_index.of_skill(job_skill::WOODCUTTING));
 
     if (need_pick && ai.stocks.count_free.count(stock_item::pick) && ai.stocks.count_free.at(stock_item::pick) != 0)
     {
@@ -690,9 +676,9 @@ void Population::update_military(color_ostream & out)
 
     if (need_pick || need_axe)
     {
-        for (auto u : world->units.active)
+        for (auto u : unit_index.citizen_list())
         {
-            if (!Units::isCitizen(u) || !Units::isAdult(u) || !Units::isAlive(u) || !Units::isSane(u))
+            if (!Units::isAdult(u) || !Units::isAlive(u) || !Units::isSane(u))
             {
                 continue;
             }
@@ -726,7 +712,7 @@ void Population::update_military(color_ostream & out)
         for (auto m : military)
         {
             auto u = df::unit::find(m.first);
-            if (!Units::isCitizen(u) || AI::is_in_conflict(u))
+            if (!unit_index.is(u, unit_class::citizen) || unit_index.is(u, unit_class::in_conflict))
             {
                 continue;
             }
@@ -749,7 +735,7 @@ void Population::update_military(color_ostream & out)
 
     for (auto u : world->units.active)
     {
-        if (Units::isCitizen(u))
+        if (unit_index.is(u, unit_class::citizen))
         {
             for (auto trait : u->status.misc_traits)
             {
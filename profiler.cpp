@@ -0,0 +1,239 @@
+#include "ai.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+TickProfiler profiler;
+
+tick_profile_t::tick_profile_t()
+{
+    reset();
+}
+
+void tick_profile_t::record(uint64_t ns)
+{
+    calls.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t prev = max_ns.load(std::memory_order_relaxed);
+    while (ns > prev && !max_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+    {
+    }
+
+    size_t bucket = 0;
+    while (bucket < bucket_count - 1 && (ns >> (bucket + 1)) != 0)
+    {
+        bucket++;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void tick_profile_t::reset()
+{
+    calls.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+    for (auto & bucket : buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t tick_profile_t::percentile(double fraction) const
+{
+    uint64_t total = 0;
+    std::array<uint64_t, bucket_count> counts;
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t target = uint64_t(std::ceil(double(total) * fraction));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        seen += counts[i];
+        if (seen >= target)
+        {
+            // never claim more than the slowest call actually took.
+            return std::min((uint64_t(2) << i) - 1, max_ns.load(std::memory_order_relaxed));
+        }
+    }
+    return max_ns.load(std::memory_order_relaxed);
+}
+
+TickProfiler::TickProfiler() :
+    onupdate(),
+    exclusive(),
+    tasks()
+{
+}
+
+tick_profile_t & TickProfiler::for_onupdate(const std::string & description)
+{
+    return onupdate[description];
+}
+
+tick_profile_t & TickProfiler::for_exclusive(const std::string & description)
+{
+    return exclusive[description];
+}
+
+void TickProfiler::reset()
+{
+    for (auto & p : onupdate)
+    {
+        p.second.reset();
+    }
+    for (auto & p : exclusive)
+    {
+        p.second.reset();
+    }
+    for (auto & p : tasks)
+    {
+        p.reset();
+    }
+}
+
+static std::string format_ns(uint64_t ns)
+{
+    std::ostringstream str;
+    str << std::fixed << std::setprecision(3);
+    if (ns >= 1000000)
+    {
+        str << (double(ns) / 1000000.0) << " ms";
+    }
+    else
+    {
+        str << (double(ns) / 1000.0) << " us";
+    }
+    return str.str();
+}
+
+static void report_profiles(std::ostream & out, bool html, const std::string & title, const std::string & anchor, const std::vector<std::pair<std::string, const tick_profile_t *>> & entries)
+{
+    // slowest first by total time, since that is where the frame time goes.
+    std::vector<std::pair<std::string, const tick_profile_t *>> sorted;
+    for (auto & e : entries)
+    {
+        if (e.second->calls.load(std::memory_order_relaxed) != 0)
+        {
+            sorted.push_back(e);
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, const tick_profile_t *> & a, const std::pair<std::string, const tick_profile_t *> & b) -> bool
+    {
+        return a.second->total_ns.load(std::memory_order_relaxed) > b.second->total_ns.load(std::memory_order_relaxed);
+    });
+
+    if (html)
+    {
+        out << "<h2 id=\"Profile_" << anchor << "\">" << html_escape(title) << "</h2>";
+        if (sorted.empty())
+        {
+            out << "<p><i>(no samples)</i></p>";
+            return;
+        }
+        out << "<table><thead><tr><th>Name</th><th>Calls</th><th>Total</th><th>Mean</th><th>p99</th><th>Max</th></tr></thead><tbody>";
+    }
+    else
+    {
+        out << "## " << title << "\n\n";
+        if (sorted.empty())
+        {
+            out << "(no samples)\n\n";
+            return;
+        }
+    }
+
+    for (auto & e : sorted)
+    {
+        const tick_profile_t & p = *e.second;
+        uint64_t calls = p.calls.load(std::memory_order_relaxed);
+        uint64_t total = p.total_ns.load(std::memory_order_relaxed);
+        if (html)
+        {
+            out << "<tr><th>" << html_escape(e.first) << "</th><td class=\"num\">" << calls << "</td><td class=\"num\">" << format_ns(total) << "</td><td class=\"num\">" << format_ns(total / calls) << "</td><td class=\"num\">" << format_ns(p.percentile(0.99)) << "</td><td class=\"num\">" << format_ns(p.max_ns.load(std::memory_order_relaxed)) << "</td></tr>";
+        }
+        else
+        {
+            out << "- " << e.first << ": " << calls << " calls, total " << format_ns(total) << ", mean " << format_ns(total / calls) << ", p99 " << format_ns(p.percentile(0.99)) << ", max " << format_ns(p.max_ns.load(std::memory_order_relaxed)) << "\n";
+        }
+    }
+
+    if (html)
+    {
+        out << "</tbody></table>";
+    }
+    else
+    {
+        out << "\n";
+    }
+}
+
+static std::vector<std::pair<std::string, const tick_profile_t *>> profile_entries(const std::map<std::string, tick_profile_t> & map)
+{
+    std::vector<std::pair<std::string, const tick_profile_t *>> entries;
+    for (auto & p : map)
+    {
+        entries.push_back(std::make_pair(p.first, &p.second));
+    }
+    return entries;
+}
+
+static std::vector<std::pair<std::string, const tick_profile_t *>> profile_entries(const std::array<tick_profile_t, task_type::_task_type_count> & tasks)
+{
+    std::vector<std::pair<std::string, const tick_profile_t *>> entries;
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        std::ostringstream name;
+        name << task_type::type(i);
+        entries.push_back(std::make_pair(name.str(), &tasks.at(i)));
+    }
+    return entries;
+}
+
+void TickProfiler::report(std::ostream & out, bool html)
+{
+    report_profiles(out, html, "Update Callbacks", "Onupdate", profile_entries(onupdate));
+    report_profiles(out, html, "Exclusive Callbacks", "Exclusive", profile_entries(exclusive));
+    report_profiles(out, html, "Plan Tasks", "Tasks", profile_entries(tasks));
+}
+
+static Json::Value profiles_to_json(const std::vector<std::pair<std::string, const tick_profile_t *>> & entries)
+{
+    Json::Value map(Json::objectValue);
+    for (auto & e : entries)
+    {
+        const tick_profile_t & p = *e.second;
+        Json::Value entry(Json::objectValue);
+        entry["calls"] = Json::UInt64(p.calls.load(std::memory_order_relaxed));
+        entry["total_ns"] = Json::UInt64(p.total_ns.load(std::memory_order_relaxed));
+        entry["max_ns"] = Json::UInt64(p.max_ns.load(std::memory_order_relaxed));
+        entry["p99_ns"] = Json::UInt64(p.percentile(0.99));
+        Json::Value histogram(Json::arrayValue);
+        for (auto & bucket : p.buckets)
+        {
+            histogram.append(Json::UInt64(bucket.load(std::memory_order_relaxed)));
+        }
+        entry["histogram"] = histogram;
+        map[e.first] = entry;
+    }
+    return map;
+}
+
+void TickProfiler::write_json(std::ostream & out)
+{
+    Json::Value root(Json::objectValue);
+    root["onupdate"] = profiles_to_json(profile_entries(onupdate));
+    root["exclusive"] = profiles_to_json(profile_entries(exclusive));
+    root["tasks"] = profiles_to_json(profile_entries(tasks));
+    out << root << std::endl;
+}
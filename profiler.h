@@ -0,0 +1,72 @@
+#pragma once
+
+#include "dfhack_shared.h"
+#include "room.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+
+// Wall clock time spent in one kind of per-tick work. Durations are counted
+// in a histogram with one bucket per power of two nanoseconds, so
+// percentiles can be estimated without keeping every sample. All counters
+// are updated with relaxed atomics; record() never takes a lock.
+struct tick_profile_t
+{
+    static const size_t bucket_count = 48;
+
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::array<std::atomic<uint64_t>, bucket_count> buckets;
+
+    tick_profile_t();
+
+    void record(uint64_t ns);
+    void reset();
+    // upper bound of the bucket containing the requested fraction of calls.
+    uint64_t percentile(double fraction) const;
+};
+
+// Times a scope and records the duration when it ends.
+class tick_profile_scope
+{
+    tick_profile_t & profile;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit tick_profile_scope(tick_profile_t & profile) :
+        profile(profile),
+        start(std::chrono::steady_clock::now())
+    {
+    }
+    ~tick_profile_scope()
+    {
+        profile.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+};
+
+class TickProfiler
+{
+    // entries are never removed, so references handed out stay valid.
+    std::map<std::string, tick_profile_t> onupdate;
+    std::map<std::string, tick_profile_t> exclusive;
+    std::array<tick_profile_t, task_type::_task_type_count> tasks;
+
+public:
+    TickProfiler();
+
+    tick_profile_t & for_onupdate(const std::string & description);
+    tick_profile_t & for_exclusive(const std::string & description);
+    inline tick_profile_t & for_task(task_type::type type)
+    {
+        return tasks.at(size_t(type));
+    }
+
+    void reset();
+    void report(std::ostream & out, bool html);
+    void write_json(std::ostream & out);
+};
+
+extern TickProfiler profiler;
@@ -1,8 +1,11 @@
 #include "dfhack_shared.h"
 #include "room.h"
 #include "ai.h"
+#include "designation_batch.h"
 #include "plan.h"
 
+#include <mutex>
+
 #include "modules/Maps.h"
 
 #include "df/abstract_building.h"
@@ -24,7 +27,39 @@ ROOM_ENUMS
 #undef ENUM_ITEM
 #undef END_ENUM
 
+static std::mutex room_handle_mutex;
+static std::vector<room_handle> room_handle_free;
+static room_handle room_handle_next = 0;
+
+// rooms can be created by the setup worker threads.
+static room_handle allocate_room_handle()
+{
+    std::lock_guard<std::mutex> lock(room_handle_mutex);
+    if (room_handle_free.empty())
+    {
+        return room_handle_next++;
+    }
+    room_handle h = room_handle_free.back();
+    room_handle_free.pop_back();
+    return h;
+}
+
+static void free_room_handle(room_handle h)
+{
+    std::lock_guard<std::mutex> lock(room_handle_mutex);
+    room_handle_free.push_back(h);
+}
+
+std::ostream & null_reason()
+{
+    // with no buffer the stream is in a failed state, so every insertion
+    // returns immediately.
+    thread_local std::ostream discard(nullptr);
+    return discard;
+}
+
 room::room(room_type::type type, df::coord mins, df::coord maxs, std::string comment) :
+    handle(allocate_room_handle()),
     status(room_status::plan),
     type(type),
     corridor_type(),
@@ -134,10 +169,12 @@ room::~room()
     {
         delete *it;
     }
+    free_room_handle(handle);
 }
 
 void room::dig(bool plan, bool channel)
 {
+    DesignationBatch tiles;
     for (int16_t x = min.x; x <= max.x; x++)
     {
         for (int16_t y = min.y; y <= max.y; y++)
@@ -155,11 +192,7 @@ void room::dig(bool plan, bool channel)
                     df::tile_dig_designation dm = channel ? tile_dig_designation::Channel : dig_mode(t);
                     if (((dm == tile_dig_designation::DownStair || dm == tile_dig_designation::Channel) && ENUM_ATTR(tiletype, shape, *tt) != tiletype_shape::STAIR_DOWN && ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, *tt)) != tiletype_shape_basic::Open) || ENUM_ATTR(tiletype, shape, *tt) == tiletype_shape::WALL)
                     {
-                        AI::dig_tile(t, dm);
-                        if (plan)
-                        {
-                            Maps::getTileOccupancy(t)->bits.dig_marked = 1;
-                        }
+                        tiles.add(t, dm);
                     }
                 }
             }
@@ -167,7 +200,10 @@ void room::dig(bool plan, bool channel)
     }
 
     if (plan)
+    {
+        AI::dig_tiles(tiles, true);
         return;
+    }
 
     for (auto it = layout.begin(); it != layout.end(); it++)
     {
@@ -183,7 +219,7 @@ void room::dig(bool plan, bool channel)
             {
                 if (ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, *tt)) == tiletype_shape_basic::Wall || (f->dig == tile_dig_designation::Channel && ENUM_ATTR(tiletype_shape, basic_shape, ENUM_ATTR(tiletype, shape, *tt)) != tiletype_shape_basic::Open))
                 {
-                    AI::dig_tile(t, f->dig);
+                    tiles.add(t, f->dig);
                 }
             }
             else
@@ -191,11 +227,12 @@ void room::dig(bool plan, bool channel)
                 df::tile_dig_designation dm = dig_mode(t);
                 if ((dm == tile_dig_designation::DownStair && ENUM_ATTR(tiletype, shape, *tt) != tiletype_shape::STAIR_DOWN) || ENUM_ATTR(tiletype, shape, *tt) == tiletype_shape::WALL)
                 {
-                    AI::dig_tile(t, dm);
+                    tiles.add(t, dm);
                 }
             }
         }
     }
+    AI::dig_tiles(tiles);
 }
 
 bool room::include(df::coord t) const
@@ -180,8 +180,17 @@ ROOM_ENUMS
 #undef ENUM_ITEM
 #undef END_ENUM
 
+// A stream with no buffer, for callers that don't want a reason. Nothing is
+// formatted or stored.
+std::ostream & null_reason();
+
+// A small integer that identifies a room while it exists, for indexing side
+// tables. Handles are reused after their room is deleted.
+typedef uint32_t room_handle;
+
 struct room
 {
+    const room_handle handle;
     room_status::status status;
     room_type::type type;
     corridor_type::type corridor_type;
@@ -231,6 +240,8 @@ struct room
     room(cistern_type::type subtype, df::coord min, df::coord max, std::string comment = "");
     room(df::workshop_type subtype, df::coord min, df::coord max, std::string comment = "");
     room(df::furnace_type subtype, df::coord min, df::coord max, std::string comment = "");
+    room(const room &) = delete;
+    room & operator=(const room &) = delete;
     ~room();
 
     inline df::coord size() const { return max - min + df::coord{ 1, 1, 1 }; }
@@ -247,14 +258,12 @@ struct room
     df::tile_dig_designation dig_mode(df::coord t) const;
     bool is_dug(df::tiletype_shape_basic want = tiletype_shape_basic::None) const
     {
-        std::ostringstream discard;
-        return is_dug(discard, want);
+        return is_dug(null_reason(), want);
     }
     bool is_dug(std::ostream & reason, df::tiletype_shape_basic want = tiletype_shape_basic::None) const;
     bool constructions_done() const
     {
-        std::ostringstream discard;
-        return constructions_done(discard);
+        return constructions_done(null_reason());
     }
     bool constructions_done(std::ostream & reason) const;
     df::building *dfbuilding() const;
@@ -293,4 +302,6 @@ struct furniture
         comment(comment)
     {
     }
+    furniture(const furniture &) = delete;
+    furniture & operator=(const furniture &) = delete;
 };
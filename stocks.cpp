@@ -314,6 +314,9 @@ Stocks::Stocks(AI & ai) :
     count_subtype(),
     act_reason(),
     ingots(),
+    count_serial(),
+    items_serial(0),
+    item_type_serial(),
     onupdate_handle(nullptr),
     updating(),
     updating_count(),
@@ -359,7 +362,11 @@ Stocks::Stocks(AI & ai) :
     metal_pref(),
     simple_metal_ores(),
     complained_about_no_plants(),
-    cant_pickaxe(false)
+    cant_pickaxe(false),
+    ledgers(),
+    item_signatures(),
+    changed_items(),
+    item_generation(0)
 {
     last_cutpos.clear();
 }
@@ -376,6 +383,9 @@ void Stocks::reset()
     count_total.clear();
     count_subtype.clear();
     act_reason.clear();
+    ledgers.clear();
+    item_signatures.clear();
+    changed_items.clear();
     farmplots.clear();
     seeds.clear();
     plants.clear();
@@ -3,7 +3,10 @@
 #include "exclusive_callback.h"
 #include "room.h"
 
+#include <unordered_map>
+
 #include "df/biome_type.h"
+#include "df/item_type.h"
 #include "df/items_other_id.h"
 #include "df/job_material_category.h"
 #include "df/job_skill.h"
@@ -178,10 +181,16 @@ public:
     std::map<stock_item::item, std::map<int16_t, std::pair<int32_t, int32_t>>> count_subtype;
     std::map<stock_item::item, std::ostringstream> act_reason;
     std::map<int32_t, int32_t> ingots;
+    // bumped when the free or total count of a key changes, and when any item
+    // changes, so that blocked plan tasks know when to look again.
+    std::map<stock_item::item, uint32_t> count_serial;
+    uint32_t items_serial;
+    // bumped when an item of that type is created, changed, or destroyed.
+    std::map<df::item_type, uint32_t> item_type_serial;
 private:
     OnupdateCallback *onupdate_handle;
     std::vector<stock_item::item> updating;
-    std::vector<stock_item::item> updating_count;
+    std::vector<std::pair<df::items_other_id, stock_item::item>> updating_count;
     size_t lastupdating;
     std::map<std::pair<uint8_t, int32_t>, size_t> farmplots;
     std::map<int32_t, size_t> seeds;
@@ -221,6 +230,43 @@ private:
     std::set<std::tuple<farm_type::type, df::biome_type, int8_t>> complained_about_no_plants;
     bool cant_pickaxe;
 
+    // What each item contributed to a stock count the last time it was
+    // looked at, so a count can be brought up to date by re-checking only
+    // the items that changed since the previous stocks update.
+    struct stock_ledger_t
+    {
+        struct entry_t
+        {
+            int32_t count;
+            int16_t subtype;
+            bool free;
+        };
+
+        std::unordered_map<int32_t, entry_t> items;
+        int32_t total;
+        int32_t free;
+        std::map<int16_t, std::pair<int32_t, int32_t>> subtype;
+        uint32_t generation;
+        uint32_t full_generation;
+
+        void clear();
+        void add(int32_t id, int32_t count, int16_t subtype, bool free);
+        void remove(int32_t id, const std::set<int16_t> & keep_subtypes);
+    };
+    struct item_signature_t
+    {
+        int32_t id;
+        df::item_type type;
+        uint32_t flags;
+        uint32_t flags2;
+        int32_t stack_size;
+        uint32_t refs;
+    };
+    std::map<stock_item::item, stock_ledger_t> ledgers;
+    std::vector<item_signature_t> item_signatures;
+    std::vector<int32_t> changed_items;
+    uint32_t item_generation;
+
 public:
     Stocks(AI & ai);
     ~Stocks();
@@ -247,8 +293,10 @@ public:
     int32_t num_needed(stock_item::item key);
     int16_t min_subtype_for_item(stock_item::item what);
     void act(color_ostream & out, stock_item::item key);
-    void count_stocks(color_ostream & out, stock_item::item k);
-    void count_stocks_subtype(color_ostream & out, stock_item::item k, find_item_info & helper);
+    void diff_items(color_ostream & out);
+    void count_stocks(color_ostream & out, const std::vector<stock_item::item> & keys);
+    void store_stock_count(stock_item::item k, const find_item_info & helper, const stock_ledger_t & ledger);
+    void store_stock_count_values(stock_item::item k, const find_item_info & helper, const stock_ledger_t & ledger);
 
     void queue_need(color_ostream & out, stock_item::item what, int32_t amount, std::ostream & reason);
     void queue_need_weapon(color_ostream & out, stock_item::item stock_item, int32_t needed, std::ostream & reason, df::job_skill skill = job_skill::NONE, bool training = false, bool ranged = false, bool digger = false);
@@ -318,6 +366,12 @@ public:
         const bool count_min_subtype;
     };
     df::item *find_free_item(stock_item::item k);
+    // changes whenever an item of one of the types changes. An empty list
+    // means any item.
+    uint32_t items_serial_of(const std::vector<df::item_type> & types) const;
+    // the item type of an items_other list, or NONE for lists that hold more
+    // than one type.
+    static df::item_type item_type_of(df::items_other_id oidx);
     find_item_info find_item_helper(stock_item::item k);
     find_item_info find_item_helper_weapon(df::job_skill skill = job_skill::NONE, bool training = false, bool ranged = false);
     find_item_info find_item_helper_digger(df::job_skill skill = job_skill::NONE, bool training = false);
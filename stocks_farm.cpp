@@ -1,4 +1,5 @@
 #include "ai.h"
+#include "job_index.h"
 #include "stocks.h"
 
 #include "modules/Maps.h"
@@ -192,12 +193,9 @@ df::coord Stocks::cuttrees(color_ostream &, int32_t amount, std::ostream & reaso
 {
     std::set<df::coord> jobs;
 
-    for (auto job = world->jobs.list.next; job; job = job->next)
+    for (auto job : job_index.of_type(job_type::FellTree))
     {
-        if (job->item->job_type == job_type::FellTree)
-        {
-            jobs.insert(job->item->pos);
-        }
+        jobs.insert(job->pos);
     }
 
     if (last_cutpos.isValid() && (Maps::getTileDesignation(last_cutpos)->bits.dig != tile_dig_designation::No || jobs.count(last_cutpos)) && cut_wait_counter < amount * 10)
@@ -74,6 +74,36 @@ df::item *Stocks::find_free_item(stock_item::item k)
     return nullptr;
 }
 
+uint32_t Stocks::items_serial_of(const std::vector<df::item_type> & types) const
+{
+    if (types.empty())
+    {
+        return items_serial;
+    }
+
+    // each counter only goes up, so the sum changes whenever one of them does.
+    uint32_t serial = 0;
+    for (auto type : types)
+    {
+        if (type == item_type::NONE)
+        {
+            return items_serial;
+        }
+        auto it = item_type_serial.find(type);
+        if (it != item_type_serial.end())
+        {
+            serial += it->second;
+        }
+    }
+    return serial;
+}
+
+df::item_type Stocks::item_type_of(df::items_other_id oidx)
+{
+    // NONE for lists that hold more than one item type.
+    return ENUM_ATTR(items_other_id, item, oidx);
+}
+
 static int32_t count_stacks(int32_t &, df::item *)
 {
     return 1;
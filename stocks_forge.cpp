@@ -235,13 +235,13 @@ int32_t Stocks::may_forge_bars(color_ostream & out, int32_t mat_index, std::ostr
 
     if ((can_melt <= Watch.WatchStock.at(stock_item::metal_ore) && ai.plan.should_search_for_metal) || dry_run)
     {
-        for (auto & k : ai.plan.map_veins)
+        for (int32_t mat : ai.plan.map_veins.materials())
         {
-            if (simple_metal_ores.at(mat_index).count(k.first))
+            if (simple_metal_ores.at(mat_index).count(mat))
             {
-                can_melt += dry_run ? ai.plan.can_dig_vein(k.first) : ai.plan.dig_vein(out, k.first);
+                can_melt += dry_run ? ai.plan.can_dig_vein(mat) : ai.plan.dig_vein(out, mat);
 
-                reason << "mining more " << MaterialInfo(0, k.first).toString() << "\n";
+                reason << "mining more " << MaterialInfo(0, mat).toString() << "\n";
             }
         }
     }
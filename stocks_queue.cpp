@@ -481,13 +481,13 @@ void Stocks::queue_need(color_ostream & out, stock_item::item what, int32_t amou
     {
         if (ai.plan.should_search_for_metal)
         {
-            for (auto & vein : ai.plan.map_veins)
+            for (int32_t mat : ai.plan.map_veins.materials())
             {
-                if (is_gypsum(vein.first))
+                if (is_gypsum(mat))
                 {
-                    if (ai.plan.dig_vein(out, vein.first, amount))
+                    if (ai.plan.dig_vein(out, mat, amount))
                     {
-                        reason << "marked " << MaterialInfo(0, vein.first).toString() << " vein for excavation";
+                        reason << "marked " << MaterialInfo(0, mat).toString() << " vein for excavation";
                         return;
                     }
                 }
@@ -631,13 +631,13 @@ void Stocks::queue_need(color_ostream & out, stock_item::item what, int32_t amou
     {
         if (ai.plan.should_search_for_metal)
         {
-            for (auto vein : ai.plan.map_veins)
+            for (int32_t mat : ai.plan.map_veins.materials())
             {
-                if (!is_raw_coke(vein.first).empty())
+                if (!is_raw_coke(mat).empty())
                 {
-                    if (ai.plan.dig_vein(out, vein.first, amount))
+                    if (ai.plan.dig_vein(out, mat, amount))
                     {
-                        reason << "marked " << MaterialInfo(0, vein.first).toString() << " vein for excavation";
+                        reason << "marked " << MaterialInfo(0, mat).toString() << " vein for excavation";
                         return;
                     }
                 }
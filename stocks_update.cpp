@@ -1,5 +1,6 @@
 #include "ai.h"
 #include "stocks.h"
+#include "job_index.h"
 #include "population.h"
 
 #include "modules/Buildings.h"
@@ -81,8 +82,20 @@ void Stocks::update(color_ostream & out)
     {
         updating.push_back(watch.first);
     }
-    updating_count = updating;
-    updating_count.insert(updating_count.end(), Watch.AlsoCount.begin(), Watch.AlsoCount.end());
+    std::set<stock_item::item> count_keys(updating.begin(), updating.end());
+    count_keys.insert(Watch.AlsoCount.begin(), Watch.AlsoCount.end());
+    ai.plan.stock_wait_keys(count_keys);
+    updating_count.clear();
+    for (auto key : count_keys)
+    {
+        updating_count.push_back(std::make_pair(find_item_helper(key).oidx, key));
+    }
+    // keys that look at the same item list are counted together
+    std::stable_sort(updating_count.begin(), updating_count.end(), [](const std::pair<df::items_other_id, stock_item::item> & a, const std::pair<df::items_other_id, stock_item::item> & b) -> bool
+    {
+        return a.first < b.first;
+    });
+    diff_items(out);
     updating_seeds = true;
     updating_plants = true;
     updating_corpses = true;
@@ -152,9 +165,14 @@ void Stocks::update(color_ostream & out)
         }
         if (!updating_count.empty())
         {
-            stock_item::item key = updating_count.back();
-            updating_count.pop_back();
-            count_stocks(out, key);
+            df::items_other_id oidx = updating_count.back().first;
+            std::vector<stock_item::item> keys;
+            while (!updating_count.empty() && updating_count.back().first == oidx)
+            {
+                keys.push_back(updating_count.back().second);
+                updating_count.pop_back();
+            }
+            count_stocks(out, keys);
             return false;
         }
         if (!updating.empty())
@@ -422,6 +440,7 @@ void Stocks::update_slabs(color_ostream & out)
                 std::vector<df::item *> item;
                 item.push_back(i);
                 Buildings::constructWithItems(bld, item);
+                job_index.invalidate();
                 ai.debug(out, "slabbing " + AI::describe_unit(df::unit::find(df::historical_figure::find(slab->topic)->unit_id)) + ": " + slab->description);
             }
         }
@@ -462,58 +481,231 @@ void Stocks::act(color_ostream & out, stock_item::item key)
     }
 }
 
-// count unused stocks of one type of item
-void Stocks::count_stocks(color_ostream & out, stock_item::item k)
+// after this many stocks updates, a stock count is redone from scratch in
+// case an item changed in a way that its signature does not show.
+const static uint32_t stock_ledger_reconcile = 10;
+
+void Stocks::diff_items(color_ostream &)
 {
-    auto helper = find_item_helper(k);
+    item_generation++;
+    changed_items.clear();
+
+    std::vector<item_signature_t> signatures;
+    signatures.reserve(world->items.all.size());
+
+    // both lists are sorted by item ID, so this is a single merge pass.
+    auto old = item_signatures.begin();
+    for (auto i : world->items.all)
+    {
+        item_signature_t sig;
+        sig.id = i->id;
+        sig.type = i->getType();
+        sig.flags = i->flags.whole;
+        sig.flags2 = i->flags2.whole;
+        sig.stack_size = i->getStackSize();
+        sig.refs = uint32_t(i->general_refs.size()) | (uint32_t(i->specific_refs.size()) << 16);
+
+        while (old != item_signatures.end() && old->id < sig.id)
+        {
+            // destroyed
+            changed_items.push_back(old->id);
+            item_type_serial[old->type]++;
+            old++;
+        }
+
+        if (old != item_signatures.end() && old->id == sig.id)
+        {
+            if (old->flags != sig.flags || old->flags2 != sig.flags2 || old->stack_size != sig.stack_size || old->refs != sig.refs)
+            {
+                changed_items.push_back(sig.id);
+                item_type_serial[sig.type]++;
+            }
+            old++;
+        }
+        else
+        {
+            // created
+            changed_items.push_back(sig.id);
+            item_type_serial[sig.type]++;
+        }
+
+        signatures.push_back(sig);
+    }
+    for (; old != item_signatures.end(); old++)
+    {
+        changed_items.push_back(old->id);
+        item_type_serial[old->type]++;
+    }
 
-    if (helper.count_min_subtype || !helper.subtypes.empty())
+    if (!changed_items.empty())
+    {
+        items_serial++;
+    }
+
+    item_signatures.swap(signatures);
+}
+
+void Stocks::stock_ledger_t::clear()
+{
+    items.clear();
+    total = 0;
+    free = 0;
+    subtype.clear();
+}
+
+void Stocks::stock_ledger_t::add(int32_t id, int32_t count, int16_t st, bool is_free)
+{
+    items[id] = entry_t{ count, st, is_free };
+    auto & sub = subtype[st];
+    total += count;
+    sub.second += count;
+    if (is_free)
+    {
+        free += count;
+        sub.first += count;
+    }
+}
+
+void Stocks::stock_ledger_t::remove(int32_t id, const std::set<int16_t> & keep_subtypes)
+{
+    auto it = items.find(id);
+    if (it == items.end())
     {
-        count_stocks_subtype(out, k, helper);
         return;
     }
 
-    int32_t total = 0;
-    int32_t free = 0;
-    for (auto i : world->items.other[helper.oidx])
+    total -= it->second.count;
+    if (it->second.free)
+    {
+        free -= it->second.count;
+    }
+
+    auto sub = subtype.find(it->second.subtype);
+    if (sub != subtype.end())
     {
-        if (helper.pred(i))
+        sub->second.second -= it->second.count;
+        if (it->second.free)
         {
-            int32_t c = helper.count(i);
-            total += c;
-            if (helper.free(i))
-            {
-                free += c;
-            }
+            sub->second.first -= it->second.count;
+        }
+        if (sub->second.first == 0 && sub->second.second == 0 && !keep_subtypes.count(sub->first))
+        {
+            subtype.erase(sub);
         }
     }
 
-    count_free[k] = free;
-    count_total[k] = total;
+    items.erase(it);
 }
 
-void Stocks::count_stocks_subtype(color_ostream &, stock_item::item k, find_item_info & helper)
+// count unused stocks of several types of item that share an items_other list
+void Stocks::count_stocks(color_ostream &, const std::vector<stock_item::item> & keys)
 {
-    std::map<int16_t, std::pair<int32_t, int32_t>> subtype;
-    for (auto i : helper.subtypes)
+    std::vector<find_item_info> helpers;
+    std::vector<stock_ledger_t *> key_ledgers;
+    std::vector<size_t> full, partial;
+    helpers.reserve(keys.size());
+    key_ledgers.reserve(keys.size());
+
+    for (size_t n = 0; n < keys.size(); n++)
     {
-        subtype[i] = std::pair<int32_t, int32_t>();
+        helpers.push_back(find_item_helper(keys.at(n)));
+        auto & ledger = ledgers[keys.at(n)];
+        key_ledgers.push_back(&ledger);
+
+        if (ledger.generation + 1 != item_generation || item_generation - ledger.full_generation >= stock_ledger_reconcile)
+        {
+            ledger.clear();
+            for (auto st : helpers.back().subtypes)
+            {
+                ledger.subtype[st] = std::pair<int32_t, int32_t>();
+            }
+            ledger.full_generation = item_generation;
+            full.push_back(n);
+        }
+        else
+        {
+            partial.push_back(n);
+        }
+        ledger.generation = item_generation;
+    }
+
+    if (helpers.empty())
+    {
+        return;
     }
 
-    for (auto i : world->items.other[helper.oidx])
+    auto & items = world->items.other[helpers.front().oidx];
+
+    // one pass over the list for every key that needs a full count
+    if (!full.empty())
     {
-        if (helper.pred(i))
+        for (auto i : items)
         {
-            int16_t st = i->getSubtype();
-            int32_t c = helper.count(i);
-            subtype[st].second += c;
-            if (helper.free(i))
+            for (auto n : full)
+            {
+                auto & helper = helpers.at(n);
+                if (helper.pred(i))
+                {
+                    key_ledgers.at(n)->add(i->id, helper.count(i), i->getSubtype(), helper.free(i));
+                }
+            }
+        }
+    }
+
+    // and one lookup per changed item for the rest
+    if (!partial.empty())
+    {
+        for (auto id : changed_items)
+        {
+            for (auto n : partial)
+            {
+                key_ledgers.at(n)->remove(id, helpers.at(n).subtypes);
+            }
+
+            auto it = std::lower_bound(items.begin(), items.end(), id, [](df::item *i, int32_t want) -> bool { return i->id < want; });
+            if (it == items.end() || (*it)->id != id)
             {
-                subtype[st].first += c;
+                continue;
+            }
+
+            for (auto n : partial)
+            {
+                auto & helper = helpers.at(n);
+                if (helper.pred(*it))
+                {
+                    key_ledgers.at(n)->add(id, helper.count(*it), (*it)->getSubtype(), helper.free(*it));
+                }
             }
         }
     }
 
+    for (size_t n = 0; n < keys.size(); n++)
+    {
+        store_stock_count(keys.at(n), helpers.at(n), *key_ledgers.at(n));
+    }
+}
+
+void Stocks::store_stock_count(stock_item::item k, const find_item_info & helper, const stock_ledger_t & ledger)
+{
+    int32_t old_free = count_free[k];
+    int32_t old_total = count_total[k];
+    store_stock_count_values(k, helper, ledger);
+    if (count_free.at(k) != old_free || count_total.at(k) != old_total)
+    {
+        count_serial[k]++;
+    }
+}
+
+void Stocks::store_stock_count_values(stock_item::item k, const find_item_info & helper, const stock_ledger_t & ledger)
+{
+    if (!helper.count_min_subtype && helper.subtypes.empty())
+    {
+        count_free[k] = ledger.free;
+        count_total[k] = ledger.total;
+        return;
+    }
+
+    const auto & subtype = ledger.subtype;
     count_subtype[k] = subtype;
 
     if (helper.count_min_subtype)
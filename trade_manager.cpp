@@ -1,4 +1,5 @@
 #include "ai.h"
+#include "job_index.h"
 #include "population.h"
 #include "stocks.h"
 #include "trade.h"
@@ -94,25 +95,22 @@ void Population::update_trading(color_ostream & out)
 
     df::unit *broker = nullptr;
 
-    for (auto j = world->jobs.list.next; j; j = j->next)
+    for (auto j : job_index.of_type(job_type::TradeAtDepot))
     {
-        if (j->item->job_type == job_type::TradeAtDepot)
+        for (auto ref : j->general_refs)
         {
-            for (auto ref : j->item->general_refs)
+            if (ref->getType() == general_ref_type::UNIT_WORKER)
             {
-                if (ref->getType() == general_ref_type::UNIT_WORKER)
+                broker = ref->getUnit();
+                if (broker)
                 {
-                    broker = ref->getUnit();
-                    if (broker)
-                    {
-                        break;
-                    }
+                    break;
                 }
             }
-            if (broker)
-            {
-                break;
-            }
+        }
+        if (broker)
+        {
+            break;
         }
     }
 
@@ -150,14 +148,7 @@ void Population::update_trading(color_ostream & out)
         return;
     }
 
-    int32_t waiting_for_items = 0;
-    for (auto j = world->jobs.list.next; j; j = j->next)
-    {
-        if (j->item->job_type == job_type::BringItemToDepot)
-        {
-            waiting_for_items++;
-        }
-    }
+    int32_t waiting_for_items = int32_t(job_index.of_type(job_type::BringItemToDepot).size());
 
     if (waiting_for_items)
     {
@@ -0,0 +1,205 @@
+#include "ai.h"
+#include "unit_index.h"
+
+#include <algorithm>
+
+#include "modules/Units.h"
+
+#include "df/activity_event_conflictst.h"
+#include "df/creature_interaction_effect_body_transformationst.h"
+#include "df/creature_raw.h"
+#include "df/occupation.h"
+//#include "df/plotinfo.h"
+#include "df/syndrome.h"
+#include "df/unit.h"
+#include "df/unit_syndrome.h"
+#include "df/world.h"
+
+REQUIRE_GLOBAL(cur_year);
+REQUIRE_GLOBAL(cur_year_tick);
+REQUIRE_GLOBAL(plotinfo);
+REQUIRE_GLOBAL(world);
+
+UnitIndex unit_index;
+
+UnitIndex::UnitIndex() :
+    valid(false),
+    in_frame(false),
+    built_year(-1),
+    built_tick(-1),
+    flags(),
+    ids(),
+    citizens()
+{
+}
+
+uint16_t UnitIndex::classify(df::unit *u)
+{
+    uint16_t f = 0;
+
+    if (Units::isCitizen(u))
+    {
+        f |= unit_class::citizen;
+    }
+    if (Units::isBaby(u))
+    {
+        f |= unit_class::baby;
+    }
+    if (!(f & unit_class::citizen) && !(u->flags1.bits.inactive || u->flags1.bits.merchant || u->flags1.bits.diplomat || u->flags1.bits.forest || u->flags2.bits.slaughter))
+    {
+        if (u->flags2.bits.visitor)
+        {
+            f |= unit_class::visitor;
+        }
+        else if (!Units::isOwnGroup(u) && std::find_if(u->occupations.begin(), u->occupations.end(), [](df::occupation *occ) -> bool { return occ->group_id == plotinfo->group_id; }) != u->occupations.end())
+        {
+            f |= unit_class::resident;
+        }
+    }
+
+    if (u->flags1.bits.marauder ||
+        u->flags1.bits.skeleton ||
+        u->flags1.bits.active_invader ||
+        u->flags2.bits.underworld ||
+        u->flags2.bits.visitor_uninvited)
+    {
+        f |= unit_class::hostile;
+    }
+
+    df::creature_raw *race = df::creature_raw::find(u->race);
+    if (race &&
+        (race->flags.is_set(creature_raw_flags::HAS_ANY_MEGABEAST) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_SEMIMEGABEAST) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_FEATURE_BEAST) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_TITAN) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_UNIQUE_DEMON) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_DEMON) ||
+            race->flags.is_set(creature_raw_flags::HAS_ANY_NIGHT_CREATURE)))
+    {
+        f |= unit_class::megabeast;
+    }
+
+    bool in_conflict = false, fighting = false;
+    AI::is_in_conflict(u, [&in_conflict, &fighting](df::activity_event_conflictst *c) -> bool
+    {
+        in_conflict = true;
+        for (auto s : c->sides)
+        {
+            for (auto e : s->enemies)
+            {
+                if (e->conflict_level > conflict_level::Encounter && e->conflict_level != conflict_level::Training)
+                {
+                    fighting = true;
+                }
+            }
+        }
+        // keep looking until there's a serious conflict.
+        return fighting;
+    });
+    if (in_conflict)
+    {
+        f |= unit_class::in_conflict;
+    }
+    if (fighting)
+    {
+        f |= unit_class::fighting;
+    }
+
+    if (std::find_if(u->syndromes.active.begin(), u->syndromes.active.end(), [](df::unit_syndrome *us) -> bool
+    {
+        auto & s = df::syndrome::find(us->type)->ce;
+        return std::find_if(s.begin(), s.end(), [](df::creature_interaction_effect *ce) -> bool
+        {
+            return virtual_cast<df::creature_interaction_effect_body_transformationst>(ce) != nullptr;
+        }) != s.end();
+    }) != u->syndromes.active.end())
+    {
+        f |= unit_class::transformed;
+    }
+
+    if (u->military.squad_id != -1)
+    {
+        f |= unit_class::military;
+    }
+    if (u->training_level == animal_training_level::Domesticated)
+    {
+        f |= unit_class::domesticated;
+    }
+
+    return f;
+}
+
+void UnitIndex::begin_frame()
+{
+    in_frame = true;
+    valid = false;
+}
+
+void UnitIndex::end_frame()
+{
+    in_frame = false;
+    valid = false;
+}
+
+void UnitIndex::refresh()
+{
+    if (valid && (in_frame || (built_year == *cur_year && built_tick == *cur_year_tick)))
+    {
+        return;
+    }
+
+    // flags keeps its size; only the entries for last time's units need to
+    // be cleared.
+    for (auto id : ids)
+    {
+        flags.at(size_t(id)) = 0;
+    }
+    ids.clear();
+    citizens.clear();
+
+    for (auto u : world->units.active)
+    {
+        if (u->id < 0)
+        {
+            continue;
+        }
+        if (size_t(u->id) >= flags.size())
+        {
+            flags.resize(size_t(u->id) + 1, 0);
+        }
+        uint16_t f = classify(u) | unit_class::active;
+        flags.at(size_t(u->id)) = f;
+        ids.push_back(u->id);
+        if (f & unit_class::citizen)
+        {
+            citizens.push_back(u);
+        }
+    }
+
+    valid = true;
+    built_year = *cur_year;
+    built_tick = *cur_year_tick;
+}
+
+uint16_t UnitIndex::of(df::unit *u)
+{
+    if (!u || u->id < 0)
+    {
+        return 0;
+    }
+
+    refresh();
+
+    if (size_t(u->id) >= flags.size())
+    {
+        return 0;
+    }
+    return flags.at(size_t(u->id));
+}
+
+const std::vector<df::unit *> & UnitIndex::citizen_list()
+{
+    refresh();
+
+    return citizens;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "dfhack_shared.h"
+
+#include <vector>
+
+namespace df
+{
+    struct unit;
+}
+
+namespace unit_class
+{
+    enum flag : uint16_t
+    {
+        // in world->units.active
+        active = 1 << 0,
+        citizen = 1 << 1,
+        baby = 1 << 2,
+        visitor = 1 << 3,
+        resident = 1 << 4,
+        // invader, marauder, undead, underworld creature, or uninvited visitor
+        hostile = 1 << 5,
+        // megabeast, forgotten beast, titan, demon, or night creature
+        megabeast = 1 << 6,
+        // part of any conflict
+        in_conflict = 1 << 7,
+        // part of a conflict that is more than an encounter or training
+        fighting = 1 << 8,
+        // under a body transformation syndrome
+        transformed = 1 << 9,
+        // in a squad
+        military = 1 << 10,
+        domesticated = 1 << 11,
+    };
+}
+
+// Classifies every active unit once, so population, military, and the
+// camera don't each repeat the citizen, race, conflict, and syndrome checks
+// for the same units. Flags are stored in an array indexed by unit id.
+//
+// During an update pass the table is built on the first query and shared
+// until the pass ends; outside of one it is kept until the game tick
+// changes. Flags describe the units as they were when the table was built,
+// so code that moves units between squads should read the unit directly.
+class UnitIndex
+{
+    bool valid;
+    bool in_frame;
+    int32_t built_year;
+    int32_t built_tick;
+    std::vector<uint16_t> flags;
+    std::vector<int32_t> ids;
+    std::vector<df::unit *> citizens;
+
+    void refresh();
+
+public:
+    UnitIndex();
+
+    static uint16_t classify(df::unit *u);
+
+    void begin_frame();
+    void end_frame();
+    inline void invalidate() { valid = false; }
+
+    uint16_t of(df::unit *u);
+    inline bool is(df::unit *u, unit_class::flag f)
+    {
+        return (of(u) & f) != 0;
+    }
+    // active citizens, in world->units.active order.
+    const std::vector<df::unit *> & citizen_list();
+};
+
+extern UnitIndex unit_index;
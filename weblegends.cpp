@@ -3,6 +3,7 @@
 #include "event_manager.h"
 #include "plan.h"
 #include "population.h"
+#include "profiler.h"
 #include "stocks.h"
 #include "plan_setup.h"
 
@@ -348,6 +349,11 @@ static void render_event_report(weblegends_layout_v1 & layout)
     events.report(layout.content, true);
 }
 
+static void render_profile_report(weblegends_layout_v1 & layout)
+{
+    profiler.report(layout.content, true);
+}
+
 static void render_blueprint_page(weblegends_layout_v1 & layout)
 {
     dwarfAI->plan.weblegends_write_svg(layout.content);
@@ -372,6 +378,7 @@ namespace
         { "/report/population", "Population", true, false, &render_population_report },
         { "/report/stocks", "Stocks", true, false, &render_stocks_report },
         { "/report/events", "Events", true, false, &render_event_report },
+        { "/report/profile", "Profile", true, false, &render_profile_report },
         { "/plan", "Blueprints", true, false, &render_blueprint_page },
         { "/version", "Version", false, false, &render_version_page },
     };